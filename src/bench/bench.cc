@@ -0,0 +1,168 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+// 性能测试：只测试不依赖CTP前置的纯计算部分，用于衡量每次性能改动的效果
+// ./bench --benchmark_filter=InnerFutureMaster
+#include <benchmark/benchmark.h>
+#include "../libbroker_ctp/libbroker_ctp.h"
+#include "../libbroker_ctp/ctp_support.h"
+#include "../libbroker_ctp/inner_future_master.h"
+
+using namespace co;
+using namespace std;
+
+// 各交易所常见的合约品种，用于生成不同规模的持仓
+static const vector<string> kProducts = {
+    "rb", "hc", "cu", "al", "zn", "ni", "au", "ag", "ru", "fu", "bu", "sp",  // SHFE
+    "m", "y", "p", "c", "i", "j", "jm", "pp", "l", "v", "eg", "eb",  // DCE
+    "SR", "CF", "TA", "MA", "FG", "RM", "OI", "SA", "UR", "AP",  // CZCE
+    "sc", "lu", "nr", "bc"  // INE
+};
+
+static vector<string> MakeCodes(int64_t size) {
+    vector<string> codes;
+    int64_t month = 0;
+    while ((int64_t)codes.size() < size) {
+        for (auto& product : kProducts) {
+            if ((int64_t)codes.size() >= size) {
+                break;
+            }
+            codes.push_back(product + std::to_string(2401 + (month % 12)) + std::to_string(month / 12));
+        }
+        ++month;
+    }
+    return codes;
+}
+
+static InnerFutureHedgePositions MakePositions(const vector<string>& codes) {
+    InnerFutureHedgePositions positions;
+    vector<MemTradePosition>& items = positions[kHedgeFlagSpeculate];
+    for (auto& code : codes) {
+        MemTradePosition pos {};
+        strncpy(pos.code, code.c_str(), sizeof(pos.code) - 1);
+        pos.market = kMarketSHFE;
+        pos.long_pre_volume = 1000000;
+        pos.short_pre_volume = 1000000;
+        items.push_back(pos);
+    }
+    return positions;
+}
+
+static std::shared_ptr<InnerFutureMaster> NewMaster(const vector<string>& codes) {
+    std::shared_ptr<InnerFutureMaster> master = std::make_shared<InnerFutureMaster>();
+    master->set_risk_max_today_opening_volume(-1);
+    master->Init(MakePositions(codes));
+    return master;
+}
+
+static void BM_CtpTimestamp(benchmark::State& state) {
+    TThostFtdcTimeType time = "14:59:58";
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CtpTimestamp(20240612, time));
+    }
+}
+BENCHMARK(BM_CtpTimestamp);
+
+static void BM_CtpMarket2Std(benchmark::State& state) {
+    TThostFtdcExchangeIDType markets[] = {"SHFE", "DCE", "CZCE", "CFFEX", "INE", "GFEX"};
+    int64_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ctp_market2std(markets[i++ % 6]));
+    }
+}
+BENCHMARK(BM_CtpMarket2Std);
+
+static void BM_CtpOrderState2Std(benchmark::State& state) {
+    TThostFtdcOrderStatusType status[] = {
+        THOST_FTDC_OST_AllTraded, THOST_FTDC_OST_PartTradedQueueing, THOST_FTDC_OST_NoTradeQueueing,
+        THOST_FTDC_OST_Canceled, THOST_FTDC_OST_Unknown
+    };
+    TThostFtdcOrderSubmitStatusType submit_status[] = {
+        THOST_FTDC_OSS_InsertSubmitted, THOST_FTDC_OSS_Accepted, THOST_FTDC_OSS_InsertRejected
+    };
+    int64_t i = 0;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ctp_order_state2std(status[i % 5], submit_status[i % 3]));
+        ++i;
+    }
+}
+BENCHMARK(BM_CtpOrderState2Std);
+
+static void BM_InsertCzceCode(benchmark::State& state) {
+    for (auto _ : state) {
+        string code = "SR405";
+        InsertCzceCode(code);
+        benchmark::DoNotOptimize(code);
+    }
+}
+BENCHMARK(BM_InsertCzceCode);
+
+// 委托合同号: <前置编号>_<会话编号>_<报单引用>_<代码>，报单及各回报共用
+static void BM_CtpOrderNo(benchmark::State& state) {
+    TThostFtdcFrontIDType front_id = 3;
+    TThostFtdcSessionIDType session_id = -1425092542;
+    int64_t order_ref = 0;
+    TThostFtdcInstrumentIDType ctp_code = "rb2410";
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CtpOrderNo(front_id, session_id, ++order_ref, ctp_code));
+    }
+}
+BENCHMARK(BM_CtpOrderNo);
+
+// 一笔委托的完整生命周期：报单、部分成交、全部成交，参数为持仓中的合约数
+static void BM_InnerFutureMasterUpdate(benchmark::State& state) {
+    constexpr int64_t kRebuildOrders = 1 << 16;  // 委托会一直缓存在内部持仓中，定期重建以免内存无限增长
+    vector<string> codes = MakeCodes(state.range(0));
+    std::shared_ptr<InnerFutureMaster> master = NewMaster(codes);
+    co::fbs::TradeOrderT order;
+    order.market = kMarketSHFE;
+    order.hedge_flag = kHedgeFlagSpeculate;
+    order.volume = 2;
+    int64_t i = 0;
+    for (auto _ : state) {
+        if (i > 0 && i % kRebuildOrders == 0) {
+            state.PauseTiming();
+            master = NewMaster(codes);
+            state.ResumeTiming();
+        }
+        order.code = codes[i % codes.size()];
+        order.order_no = "3_-1425092542_" + std::to_string(i) + "_" + order.code;
+        order.bs_flag = (i & 1) ? kBsFlagBuy : kBsFlagSell;
+        order.oc_flag = (i & 2) ? kOcFlagOpen : kOcFlagClose;
+        order.match_volume = 0;
+        master->Update(order);
+        order.match_volume = 1;
+        master->Update(order);
+        order.match_volume = 2;
+        master->Update(order);
+        ++i;
+    }
+    state.SetItemsProcessed(state.iterations() * 3);
+}
+BENCHMARK(BM_InnerFutureMasterUpdate)->Arg(10)->Arg(100)->Arg(1000);
+
+static void BM_InnerFutureMasterGetAutoOcFlag(benchmark::State& state) {
+    vector<string> codes = MakeCodes(state.range(0));
+    std::shared_ptr<InnerFutureMaster> master = NewMaster(codes);
+    co::fbs::TradeOrderT order;
+    order.market = kMarketSHFE;
+    order.hedge_flag = kHedgeFlagSpeculate;
+    order.oc_flag = kOcFlagAuto;
+    order.volume = 1;
+    int64_t i = 0;
+    for (auto _ : state) {
+        order.code = codes[i % codes.size()];
+        order.bs_flag = (i & 1) ? kBsFlagBuy : kBsFlagSell;
+        benchmark::DoNotOptimize(master->GetAutoOcFlag(order));
+        ++i;
+    }
+}
+BENCHMARK(BM_InnerFutureMasterGetAutoOcFlag)->Arg(10)->Arg(100)->Arg(1000);
+
+int main(int argc, char** argv) {
+    CTPEventLog::Instance()->Start("", false);  // 内部持仓变动会写事件日志，由后台线程取出丢弃
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    return 0;
+}
@@ -9,7 +9,7 @@ using namespace std;
 using namespace co;
 namespace po = boost::program_options;
 
-const string kVersion = "v2.0.3";
+const string kVersion = "v2.1.0";
 
 int main(int argc, char* argv[]) {
     po::options_description desc("[Broker Server] Usage");
@@ -1,4 +1,5 @@
 #include "config.h"
+#include <boost/algorithm/string.hpp>
 #include "yaml-cpp/yaml.h"
 namespace co {
 
@@ -59,7 +60,19 @@ namespace co {
         options_ = MemBrokerOptions::Load(filename);
 
         auto broker = root["ctp"];
-        ctp_trade_front_ = getStr(broker, "ctp_trade_front");
+        auto getFronts = [&](std::vector<std::string>* ret, const YAML::Node& node, const std::string& name = "ctp_trade_front") {
+            if (node[name] && node[name].IsSequence()) {
+                getStrings(ret, node, name, true);
+            } else {
+                string front = getStr(node, name);
+                if (!front.empty()) {
+                    ret->push_back(front);
+                }
+            }
+        };
+        getFronts(&ctp_trade_fronts_, broker);
+        getFronts(&ctp_md_fronts_, broker, "ctp_md_front");
+        ctp_trade_front_ = ctp_trade_fronts_.empty() ? "" : ctp_trade_fronts_.front();
         ctp_broker_id_ = getStr(broker, "ctp_broker_id");
         ctp_investor_id_ = getStr(broker, "ctp_investor_id");
         string __password_ = getStr(broker, "ctp_password");
@@ -67,7 +80,91 @@ namespace co {
         ctp_app_id_ = getStr(broker, "ctp_app_id");
         ctp_product_info_ = getStr(broker, "ctp_product_info");
         ctp_auth_code_ = getStr(broker, "ctp_auth_code");
+        CTPAccount default_account;
+        default_account.trade_fronts = ctp_trade_fronts_;
+        default_account.broker_id = ctp_broker_id_;
+        default_account.investor_id = ctp_investor_id_;
+        default_account.password = ctp_password_;
+        default_account.app_id = ctp_app_id_;
+        default_account.product_info = ctp_product_info_;
+        default_account.auth_code = ctp_auth_code_;
+        if (broker["ctp_accounts"] && broker["ctp_accounts"].IsSequence()) {
+            for (auto item : broker["ctp_accounts"]) {
+                CTPAccount account = default_account;
+                vector<string> fronts;
+                getFronts(&fronts, item);
+                if (!fronts.empty()) {
+                    account.trade_fronts = fronts;
+                }
+                auto override = [&](string* value, const std::string& name) {
+                    string s = getStr(item, name);
+                    if (!s.empty()) {
+                        *value = s;
+                    }
+                };
+                override(&account.broker_id, "ctp_broker_id");
+                override(&account.investor_id, "ctp_investor_id");
+                override(&account.app_id, "ctp_app_id");
+                override(&account.product_info, "ctp_product_info");
+                override(&account.auth_code, "ctp_auth_code");
+                string password = getStr(item, "ctp_password");
+                if (!password.empty()) {
+                    account.password = DecodePassword(password);
+                }
+                for (auto& it : ctp_accounts_) {
+                    if (it.investor_id == account.investor_id) {
+                        throw std::runtime_error("duplicate ctp_investor_id in ctp_accounts: " + account.investor_id);
+                    }
+                }
+                ctp_accounts_.push_back(account);
+            }
+        }
+        if (ctp_accounts_.empty()) {
+            ctp_accounts_.push_back(default_account);
+        }
         disable_subscribe_ = getBool(broker, "disable_subscribe");
+        journal_dir_ = getStr(broker, "journal_dir");
+        journal_snapshot_interval_ = getInt(broker, "journal_snapshot_interval", 1000);
+        reconcile_interval_ms_ = getInt(broker, "reconcile_interval_ms", 0);
+        reconcile_self_heal_ = getBool(broker, "reconcile_self_heal");
+        query_reply_chunk_size_ = getInt(broker, "query_reply_chunk_size", 0);
+        event_log_dir_ = getStr(broker, "event_log_dir");
+        event_log_text_ = broker["event_log_text"] ? getBool(broker, "event_log_text") : true;
+        metrics_dump_interval_ms_ = getInt(broker, "metrics_dump_interval_ms", 0);
+        ctp_record_dir_ = getStr(broker, "ctp_record_dir");
+        vector<string> api_cpus;
+        getStrings(&api_cpus, broker, "ctp_api_cpus", true);
+        for (auto& cpu : api_cpus) {
+            ctp_api_cpus_.push_back(atoi(cpu.c_str()));
+        }
+        ctp_callback_cpu_ = getInt(broker, "ctp_callback_cpu", -1);
+        ctp_thread_priority_ = getInt(broker, "ctp_thread_priority", 0);
+        ctp_order_rate_limit_ = getInt(broker, "ctp_order_rate_limit", 0);
+        ctp_order_queue_size_ = getInt(broker, "ctp_order_queue_size", 1000);
+        ctp_order_sessions_ = std::max(getInt(broker, "ctp_order_sessions", 1), (int64_t)1);
+        getStrings(&ctp_batch_action_exchanges_, broker, "ctp_batch_action_exchanges", true);
+        ctp_price_limit_check_ = broker["ctp_price_limit_check"] ? getBool(broker, "ctp_price_limit_check") : true;
+        ctp_trading_status_check_ = broker["ctp_trading_status_check"] ? getBool(broker, "ctp_trading_status_check") : true;
+        getStrings(&ctp_parked_order_time_strs_, broker, "ctp_parked_order_times", true);
+        for (auto& s : ctp_parked_order_time_strs_) {
+            // 08:55:00-09:00:00
+            vector<string> times;
+            boost::split(times, s, boost::is_any_of("-"));
+            if (times.size() != 2) {
+                throw std::runtime_error("not valid ctp_parked_order_times: " + s);
+            }
+            auto toInt = [&](string t) {
+                boost::erase_all(t, ":");
+                return atoll(x::Trim(t).c_str());
+            };
+            int64_t begin = toInt(times[0]);
+            int64_t end = toInt(times[1]);
+            if (begin >= end) {
+                throw std::runtime_error("not valid ctp_parked_order_times: " + s);
+            }
+            ctp_parked_order_times_.emplace_back(begin, end);
+        }
+        getStrings(&close_today_first_products_, broker, "close_today_first_products", true);
 
         auto risk = root["risk"];
         risk_forbid_closing_today_ = getBool(risk, "risk_forbid_closing_today");
@@ -84,14 +181,41 @@ namespace co {
         ss << endl;
         ss << "ctp:" << endl
             // << "  ctp_market_front: " << ctp_market_front_ << endl
-            << "  ctp_trade_front: " << ctp_trade_front_ << endl
+            << "  ctp_trade_front: " << boost::algorithm::join(ctp_trade_fronts_, ",") << endl
+            << "  ctp_md_front: " << boost::algorithm::join(ctp_md_fronts_, ",") << endl
             << "  ctp_broker_id: " << ctp_broker_id_ << endl
             << "  ctp_investor_id: " << ctp_investor_id_ << endl
             << "  ctp_password: " << string(ctp_password_.size(), '*') << endl
             << "  ctp_app_id: " << ctp_app_id_ << endl
             << "  ctp_product_info: " << ctp_product_info_ << endl
-            << "  ctp_auth_code: " << ctp_auth_code_ << endl
+            << "  ctp_auth_code: " << ctp_auth_code_ << endl;
+        for (auto& account : ctp_accounts_) {
+            ss << "  ctp_account: investor_id = " << account.investor_id
+                << ", broker_id = " << account.broker_id
+                << ", trade_front = " << boost::algorithm::join(account.trade_fronts, ",") << endl;
+        }
+        ss
             << "  disable_subscribe: " << (disable_subscribe_ ? "true" : "false") << endl
+            << "  journal_dir: " << journal_dir_ << endl
+            << "  journal_snapshot_interval: " << journal_snapshot_interval_ << endl
+            << "  reconcile_interval_ms: " << reconcile_interval_ms_ << endl
+            << "  reconcile_self_heal: " << (reconcile_self_heal_ ? "true" : "false") << endl
+            << "  query_reply_chunk_size: " << query_reply_chunk_size_ << endl
+            << "  event_log_dir: " << event_log_dir_ << endl
+            << "  event_log_text: " << (event_log_text_ ? "true" : "false") << endl
+            << "  metrics_dump_interval_ms: " << metrics_dump_interval_ms_ << endl
+            << "  ctp_record_dir: " << ctp_record_dir_ << endl
+            << "  ctp_api_cpus: " << boost::algorithm::join(api_cpus, ",") << endl
+            << "  ctp_callback_cpu: " << ctp_callback_cpu_ << endl
+            << "  ctp_thread_priority: " << ctp_thread_priority_ << endl
+            << "  ctp_order_rate_limit: " << ctp_order_rate_limit_ << endl
+            << "  ctp_order_queue_size: " << ctp_order_queue_size_ << endl
+            << "  ctp_order_sessions: " << ctp_order_sessions_ << endl
+            << "  ctp_batch_action_exchanges: " << boost::algorithm::join(ctp_batch_action_exchanges_, ",") << endl
+            << "  ctp_price_limit_check: " << (ctp_price_limit_check_ ? "true" : "false") << endl
+            << "  ctp_trading_status_check: " << (ctp_trading_status_check_ ? "true" : "false") << endl
+            << "  ctp_parked_order_times: " << boost::algorithm::join(ctp_parked_order_time_strs_, ",") << endl
+            << "  close_today_first_products: " << boost::algorithm::join(close_today_first_products_, ",") << endl
             << "risk:" << endl
             << "  risk_forbid_closing_today: " << (risk_forbid_closing_today_ ? "true" : "false") << endl
             << "  risk_max_today_opening_volume: " << risk_max_today_opening_volume_ << endl;
@@ -12,6 +12,19 @@ using namespace std;
 
 namespace co {
 
+    /**
+     * 资金账号的登录信息，ctp_accounts中没有配置的字段使用ctp节的同名配置
+     */
+    struct CTPAccount {
+        vector<string> trade_fronts;
+        string broker_id;
+        string investor_id;
+        string password;
+        string app_id;
+        string product_info;
+        string auth_code;
+    };
+
     class Config {
     public:
         static Config* Instance();
@@ -19,6 +32,17 @@ namespace co {
         inline string ctp_trade_front() {
             return ctp_trade_front_;
         }
+        inline const vector<string>& ctp_trade_fronts() {
+            return ctp_trade_fronts_;
+        }
+
+        inline const vector<string>& ctp_md_fronts() {
+            return ctp_md_fronts_;
+        }
+        // 本进程托管的全部资金账号，至少有一个（没有配置ctp_accounts时为ctp节的账号）
+        inline const vector<CTPAccount>& ctp_accounts() {
+            return ctp_accounts_;
+        }
         inline string ctp_broker_id() {
             return ctp_broker_id_;
         }
@@ -54,6 +78,86 @@ namespace co {
             return disable_subscribe_;
         }
 
+        inline string journal_dir() {
+            return journal_dir_;
+        }
+
+        inline int64_t journal_snapshot_interval() {
+            return journal_snapshot_interval_;
+        }
+
+        inline int64_t reconcile_interval_ms() {
+            return reconcile_interval_ms_;
+        }
+
+        inline bool reconcile_self_heal() {
+            return reconcile_self_heal_;
+        }
+
+        inline int64_t query_reply_chunk_size() {
+            return query_reply_chunk_size_;
+        }
+
+        inline string event_log_dir() {
+            return event_log_dir_;
+        }
+
+        inline bool event_log_text() {
+            return event_log_text_;
+        }
+
+        inline int64_t metrics_dump_interval_ms() {
+            return metrics_dump_interval_ms_;
+        }
+
+        inline string ctp_record_dir() {
+            return ctp_record_dir_;
+        }
+
+        inline const vector<int>& ctp_api_cpus() {
+            return ctp_api_cpus_;
+        }
+
+        inline int ctp_callback_cpu() {
+            return ctp_callback_cpu_;
+        }
+
+        inline int ctp_thread_priority() {
+            return ctp_thread_priority_;
+        }
+
+        inline int64_t ctp_order_rate_limit() {
+            return ctp_order_rate_limit_;
+        }
+
+        inline int64_t ctp_order_queue_size() {
+            return ctp_order_queue_size_;
+        }
+
+        inline int64_t ctp_order_sessions() {
+            return ctp_order_sessions_;
+        }
+
+        inline const vector<string>& ctp_batch_action_exchanges() {
+            return ctp_batch_action_exchanges_;
+        }
+
+        inline bool ctp_price_limit_check() {
+            return ctp_price_limit_check_;
+        }
+
+        inline bool ctp_trading_status_check() {
+            return ctp_trading_status_check_;
+        }
+
+        inline const vector<std::pair<int64_t, int64_t>>& ctp_parked_order_times() {
+            return ctp_parked_order_times_;
+        }
+
+        inline const vector<string>& close_today_first_products() {
+            return close_today_first_products_;
+        }
+
     protected:
         Config() = default;
         ~Config() = default;
@@ -67,7 +171,9 @@ namespace co {
 
         MemBrokerOptionsPtr options_;
 
-        string ctp_trade_front_;
+        string ctp_trade_front_;  // 第一个交易前置
+        vector<string> ctp_trade_fronts_;  // 全部交易前置，启动时按建连耗时排序，断线时切换到下一个
+        vector<string> ctp_md_fronts_;  // 行情前置，为空时不启动行情会话
 
         string ctp_broker_id_;
         string ctp_investor_id_;
@@ -75,9 +181,32 @@ namespace co {
         string ctp_app_id_;
         string ctp_product_info_;
         string ctp_auth_code_;
+        vector<CTPAccount> ctp_accounts_;
 
         bool disable_subscribe_ = false;
 
+        string journal_dir_;  // 内部持仓日志目录，为空时不写日志
+        int64_t journal_snapshot_interval_ = 0;  // 每写入多少条持仓变动写一次快照
+        int64_t reconcile_interval_ms_ = 0;  // 内部持仓与CTP持仓对账的间隔，0表示不对账
+        bool reconcile_self_heal_ = false;  // 对账差异连续两次相同时，是否用CTP持仓修正内部持仓
+        int64_t query_reply_chunk_size_ = 0;  // 持仓、成交查询结果分批推送时每批的条数，0表示一次推送
+        string event_log_dir_;  // 二进制事件日志目录，为空时不写文件
+        bool event_log_text_ = true;  // 事件是否同时输出到文本日志
+        int64_t metrics_dump_interval_ms_ = 0;  // 指标输出到文本日志的间隔，0表示不输出
+        string ctp_record_dir_;  // CTP回调录制目录，为空时不录制
+        vector<int> ctp_api_cpus_;  // CTP API线程及SDK内部线程绑定的CPU，为空时不绑定
+        int ctp_callback_cpu_ = -1;  // SPI回调线程绑定的CPU，-1表示不单独绑定
+        int ctp_thread_priority_ = 0;  // CTP线程的SCHED_FIFO优先级(1-99)，0表示不修改
+        int64_t ctp_order_rate_limit_ = 0;  // 每秒报单与撤单的总笔数限制，与前置的流控设置一致，0表示不做本地流控
+        int64_t ctp_order_queue_size_ = 0;  // 超出限制的请求最多排队的笔数
+        vector<string> ctp_batch_action_exchanges_;  // 支持ReqBatchOrderAction的交易所
+        int64_t ctp_order_sessions_ = 1;  // 每个资金账号用于报单的会话数（含主会话），报单和撤单在会话间轮流发送
+        bool ctp_price_limit_check_ = true;  // 启动后查询涨跌停价，超出涨跌停价的限价单直接拒绝
+        bool ctp_trading_status_check_ = true;  // 报单前检查合约交易状态，非交易阶段直接拒绝
+        vector<string> ctp_parked_order_time_strs_;
+        vector<std::pair<int64_t, int64_t>> ctp_parked_order_times_;  // 使用预埋单的时段[开始, 结束)，HHMMSS
+        vector<string> close_today_first_products_;  // 中金所以外先平今仓的品种，逐笔持仓明细按此规则平仓
+
         bool risk_forbid_closing_today_ = false;
         int risk_max_today_opening_volume_ = 0;
     };
@@ -1,71 +1,256 @@
+#include <boost/filesystem.hpp>
 #include "ctp_broker.h"
 #include "ctp_trade_spi.h"
+#include "ctp_front.h"
+#include "ctp_market_data.h"
 
 //using namespace autotrade;
 
 namespace co {
 
     CTPBroker::~CTPBroker() {
-        if (ctp_api_) {
-            ctp_api_->RegisterSpi(nullptr);
-            ctp_api_->Release();
-            ctp_api_ = nullptr;
+        StopReconcile();  // 对账线程会调用会话，必须在释放会话之前退出
+        for (auto& api : ctp_apis_) {
+            if (api) {
+                api->RegisterSpi(nullptr);
+                api->Release();
+                api = nullptr;
+            }
         }
-        if (ctp_spi_) {
-            delete ctp_spi_;
-            ctp_spi_ = nullptr;
+        for (auto& spi : ctp_spis_) {
+            delete spi;
         }
+        ctp_spis_.clear();
+        fund_spis_.clear();
     }
 
     void CTPBroker::OnInit() {
         LOG_INFO << "initialize CTPBroker ...";
-        string ctp_investor_id = Config::Instance()->ctp_investor_id();
-        MemTradeAccount acc {};
-        acc.type = kTradeTypeFuture;
-        strncpy(acc.fund_id, ctp_investor_id.c_str(), ctp_investor_id.length());
-        acc.batch_order_size = 0;
-        LOG_INFO << "aaaa: " << acc.fund_id << ", aaaa: " << ctp_investor_id;
-        AddAccount(acc);
-        ctp_spi_ = new CTPTradeSpi(this);
-        thread_ = std::make_shared<std::thread>(std::bind(&CTPBroker::RunCtp, this));
-        thread_->detach();
-        ctp_spi_->Wait();
+        CTPRecorder::Instance()->Start(Config::Instance()->ctp_record_dir());  // 必须在事件日志启动之前
+        CTPEventLog::Instance()->Start(Config::Instance()->event_log_dir(), Config::Instance()->event_log_text());
+        const vector<CTPAccount>& accounts = Config::Instance()->ctp_accounts();
+        // 多个资金账号时指标为各账号的合计，指标页按第一个账号命名
+        CTPMetrics::Instance()->Open(Config::Instance()->options()->mem_dir(), accounts.front().investor_id);
+        for (auto& account : accounts) {
+            string ctp_investor_id = account.investor_id;
+            MemTradeAccount acc {};
+            acc.type = kTradeTypeFuture;
+            strncpy(acc.fund_id, ctp_investor_id.c_str(), sizeof(acc.fund_id) - 1);
+            acc.batch_order_size = 0;
+            LOG_INFO << "add account: " << acc.fund_id;
+            AddAccount(acc);
+            CTPTradeSpi* spi = new CTPTradeSpi(this, account);
+            ctp_spis_.push_back(spi);
+            ctp_apis_.push_back(nullptr);
+            fund_spis_[ctp_investor_id] = spi;
+        }
+        threads_.resize(ctp_spis_.size());
+        // 第一个账号查询合约表，其他账号等合约表就绪后并行登录，直接使用已有的合约表
+        StartSession(0);
+        ctp_spis_[0]->Wait();
+        for (size_t i = 1; i < ctp_spis_.size(); ++i) {
+            StartSession(i);
+        }
+        for (size_t i = 1; i < ctp_spis_.size(); ++i) {
+            ctp_spis_[i]->Wait();
+        }
+        // 报单会话和行情会话的API与RunCtp一样在绑定了CPU和优先级的线程中创建，SDK的内部线程会继承
+        const vector<int>& api_cpus = Config::Instance()->ctp_api_cpus();
+        int priority = Config::Instance()->ctp_thread_priority();
+        RunPinned("ctp_order", api_cpus, priority, [this] {
+            for (auto spi : ctp_spis_) {
+                spi->StartOrderSessions();
+            }
+        });
+        // 合约表已就绪，启动时查询到的持仓合约已加入订阅列表
+        RunPinned("ctp_md", api_cpus, priority, [&accounts] {
+            CTPMarketData::Instance()->Start(Config::Instance()->ctp_md_fronts(), accounts.front());
+        });
+        CheckThreadLayout();
+        if (Config::Instance()->reconcile_interval_ms() > 0) {
+            reconcile_thread_ = std::make_shared<std::thread>(std::bind(&CTPBroker::RunReconcile, this));
+        }
+        if (Config::Instance()->metrics_dump_interval_ms() > 0) {
+            metrics_thread_ = std::make_shared<std::thread>(std::bind(&CTPBroker::RunMetrics, this));
+            metrics_thread_->detach();
+        }
         LOG_INFO << "initialize CTPBroker successfully";
     }
 
-    void CTPBroker::RunCtp() {
+    void CTPBroker::StartSession(size_t index) {
+        LOG_INFO << "start ctp session: investor_id = " << ctp_spis_[index]->account().investor_id;
+        threads_[index] = std::make_shared<std::thread>(std::bind(&CTPBroker::RunCtp, this, index));
+        threads_[index]->detach();
+    }
+
+    CTPTradeSpi* CTPBroker::GetSpi(const char* fund_id) {
+        if (ctp_spis_.size() == 1) {
+            return ctp_spis_.front();
+        }
+        auto it = fund_spis_.find(fund_id);
+        return it != fund_spis_.end() ? it->second : nullptr;
+    }
+
+    void CTPBroker::RunCtp(size_t index) {
+        // SDK的内部线程都由本线程创建，先绑定CPU和设置优先级，内部线程会继承
+        CTPTradeSpi* ctp_spi = ctp_spis_[index];
+        SetThreadName(ctp_spis_.size() > 1 ? "ctp_api_" + std::to_string(index) : "ctp_api");
+        SetThreadAffinity(Config::Instance()->ctp_api_cpus());
+        SetThreadFifo(Config::Instance()->ctp_thread_priority());
         bool disable_subscribe = Config::Instance()->disable_subscribe();
-        ctp_api_ = CThostFtdcTraderApi::CreateFtdcTraderApi("");
-        ctp_spi_->SetApi(ctp_api_);
-        ctp_api_->RegisterSpi(ctp_spi_);
-        string addr = Config::Instance()->ctp_trade_front();
-        ctp_api_->RegisterFront((char*)addr.c_str());
-        if (!disable_subscribe) {
-            ctp_api_->SubscribePublicTopic(THOST_TERT_RESTART);
-            ctp_api_->SubscribePrivateTopic(THOST_TERT_RESTART);
-        }
-        ctp_api_->Init();
-        ctp_api_->Join();
+        const vector<string>& addrs = ctp_spi->account().trade_fronts;
+        vector<CTPFrontProbe> fronts;
+        if (addrs.size() > 1) {
+            fronts = ProbeFronts(addrs, 3, 1000);
+        } else {
+            CTPFrontProbe probe;
+            probe.front = addrs.empty() ? "" : addrs.front();
+            fronts.push_back(probe);
+        }
+        // 同一进程的多个会话不能共用流文件目录，否则私有流的续传位置会互相覆盖
+        string flow_path;
+        if (ctp_spis_.size() > 1) {
+            flow_path = "ctp_flow_" + ctp_spi->account().investor_id + "/";
+            boost::filesystem::create_directories(flow_path);
+        }
+        size_t front_index = 0;
+        THOST_TE_RESUME_TYPE resume_type = THOST_TERT_RESTART;
+        while (true) {
+            string addr = fronts[front_index].front;
+            LOG_INFO << "use ctp trade front: " << addr << ", rtt = " << fronts[front_index].rtt_us << "us";
+            CThostFtdcTraderApi* api = CThostFtdcTraderApi::CreateFtdcTraderApi(flow_path.c_str());
+            CThostFtdcTraderApi* old_api = ctp_spi->SwapApi(api);  // 返回时已没有使用旧API发送的请求
+            api->RegisterSpi(ctp_spi);
+            api->RegisterFront((char*)addr.c_str());
+            if (!disable_subscribe) {
+                api->SubscribePublicTopic(resume_type);
+                api->SubscribePrivateTopic(resume_type);
+            }
+            ctp_apis_[index] = api;
+            api->Init();
+            if (old_api) {
+                old_api->Release();
+            }
+            if (fronts.size() <= 1) {
+                api->Join();  // 只有一个前置时由SDK自动重连
+                return;
+            }
+            ctp_spi->WaitDisconnected();
+            api->RegisterSpi(nullptr);  // 旧前置不再回调，避免SDK在后台重连成功后重复登录
+            CTPMetrics::Instance()->Add(&CTPMetricsPage::front_switches);
+            // 重新探测，优先选择当前断开的前置之外耗时最小的前置
+            fronts = ProbeFronts(addrs, 3, 1000);
+            front_index = fronts[0].front == addr ? 1 : 0;
+            // 新会话从本地流文件记录的位置续传私有流，不会重复推送已处理过的委托和成交
+            resume_type = THOST_TERT_RESUME;
+            LOG_WARN << "switch ctp trade front: " << addr << " -> " << fronts[front_index].front;
+        }
+    }
+
+    void CTPBroker::CheckThreadLayout() {
+        stringstream ss;
+        for (auto spi : ctp_spis_) {
+            ss << (ss.tellp() > 0 ? "," : "") << spi->callback_tid();
+        }
+        LOG_INFO << "thread layout: callback_tid = " << ss.str() << ThreadLayout();
+        int callback_cpu = Config::Instance()->ctp_callback_cpu();
+        if (callback_cpu >= 0) {
+            for (auto spi : ctp_spis_) {
+                vector<int> cpus = GetThreadAffinity(spi->callback_tid());
+                if (cpus.size() != 1 || cpus[0] != callback_cpu) {
+                    LOG_WARN << "ctp callback thread is not bound to cpu " << callback_cpu << ": investor_id = " << spi->account().investor_id;
+                }
+            }
+        }
+        const vector<int>& api_cpus = Config::Instance()->ctp_api_cpus();
+        if (!api_cpus.empty() && callback_cpu >= 0 && std::find(api_cpus.begin(), api_cpus.end(), callback_cpu) == api_cpus.end()) {
+            LOG_WARN << "ctp_callback_cpu " << callback_cpu << " is not in ctp_api_cpus";
+        }
+    }
+
+    void CTPBroker::RunReconcile() {
+        int64_t interval_ms = Config::Instance()->reconcile_interval_ms();
+        LOG_INFO << "start position reconcile, interval: " << interval_ms << "ms";
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(reconcile_mutex_);
+                if (reconcile_cv_.wait_for(lock, std::chrono::milliseconds(interval_ms), [this] { return reconcile_stopping_; })) {
+                    break;
+                }
+            }
+            for (auto spi : ctp_spis_) {
+                spi->ReqReconcilePosition();
+            }
+        }
+        LOG_INFO << "stop position reconcile";
+    }
+
+    void CTPBroker::StopReconcile() {
+        if (!reconcile_thread_) {
+            return;
+        }
+        {
+            std::unique_lock<std::mutex> lock(reconcile_mutex_);
+            reconcile_stopping_ = true;
+        }
+        reconcile_cv_.notify_all();
+        if (reconcile_thread_->joinable()) {
+            reconcile_thread_->join();
+        }
+        reconcile_thread_.reset();
+    }
+
+    void CTPBroker::RunMetrics() {
+        int64_t interval_ms = Config::Instance()->metrics_dump_interval_ms();
+        while (true) {
+            x::Sleep(interval_ms);
+            LOG_INFO << CTPMetrics::Instance()->ToString();
+        }
     }
 
 
     void CTPBroker::OnQueryTradeAsset(MemGetTradeAssetMessage* req) {
-        ctp_spi_->OnQueryTradeAsset(req);
+        CTPTradeSpi* spi = GetSpi(req->fund_id);
+        if (spi) {
+            spi->OnQueryTradeAsset(req);
+        } else {
+            RejectUnknownFund(req, sizeof(MemGetTradeAssetMessage), kMemTypeQueryTradeAssetRep);
+        }
     }
 
     void CTPBroker::OnQueryTradePosition(MemGetTradePositionMessage* req) {
-        ctp_spi_->OnQueryTradePosition(req);
+        CTPTradeSpi* spi = GetSpi(req->fund_id);
+        if (spi) {
+            spi->OnQueryTradePosition(req);
+        } else {
+            RejectUnknownFund(req, sizeof(MemGetTradePositionMessage), kMemTypeQueryTradePositionRep);
+        }
     }
 
     void CTPBroker::OnQueryTradeKnock(MemGetTradeKnockMessage* req) {
-        ctp_spi_->OnQueryTradeKnock(req);
+        CTPTradeSpi* spi = GetSpi(req->fund_id);
+        if (spi) {
+            spi->OnQueryTradeKnock(req);
+        } else {
+            RejectUnknownFund(req, sizeof(MemGetTradeKnockMessage), kMemTypeQueryTradeKnockRep);
+        }
     }
 
     void CTPBroker::OnTradeOrder(MemTradeOrderMessage* req) {
-        ctp_spi_->OnTradeOrder(req);
+        CTPTradeSpi* spi = GetSpi(req->fund_id);
+        if (spi) {
+            spi->OnTradeOrder(req);
+        } else {
+            RejectUnknownFund(req, sizeof(MemTradeOrderMessage) + sizeof(MemTradeOrder) * req->items_size, kMemTypeTradeOrderRep);
+        }
     }
 
     void CTPBroker::OnTradeWithdraw(MemTradeWithdrawMessage* req) {
-        ctp_spi_->OnTradeWithdraw(req);
+        CTPTradeSpi* spi = GetSpi(req->fund_id);
+        if (spi) {
+            spi->OnTradeWithdraw(req);
+        } else {
+            RejectUnknownFund(req, sizeof(MemTradeWithdrawMessage), kMemTypeTradeWithdrawRep);
+        }
     }
 }
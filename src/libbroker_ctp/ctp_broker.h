@@ -5,8 +5,10 @@
 #include <string>
 #include <vector>
 #include <thread>
+#include <condition_variable>
 #include <memory>
 #include <mutex>
+#include <unordered_map>
 
 #include "ctp_support.h"
 #include "mem_broker/mem_base_broker.h"
@@ -31,7 +33,22 @@ namespace co {
         
     protected:
         void OnInit();
-        void RunCtp();
+        void StartSession(size_t index);
+        void RunCtp(size_t index);
+        CTPTradeSpi* GetSpi(const char* fund_id);  // 按资金账号路由请求，只有一个账号时忽略fund_id
+
+        // 请求的资金账号不在本进程托管的账号中，直接回报错误
+        template<typename T>
+        void RejectUnknownFund(T* req, int64_t length, int64_t type) {
+            string error = "unknown fund_id: " + string(req->fund_id);
+            LOG_ERROR << error;
+            strncpy(req->error, error.c_str(), sizeof(req->error) - 1);
+            SendRtnMessage(string(reinterpret_cast<const char*>(req), length), type);
+        }
+        void CheckThreadLayout();  // 输出线程布局，检查回调线程是否绑定到了指定的CPU
+        void RunReconcile();
+        void StopReconcile();  // 通知对账线程退出并等待当前一轮对账结束
+        void RunMetrics();
 
         void OnQueryTradeAsset(MemGetTradeAssetMessage* req);
 
@@ -45,8 +62,15 @@ namespace co {
 
     private:
 
-        CThostFtdcTraderApi* ctp_api_ = nullptr;
-        CTPTradeSpi* ctp_spi_ = nullptr;
-        std::shared_ptr<std::thread> thread_; // 单独开一个线程供CTP使用，以免业务流程处理阻塞底层通信。
+        // 每个资金账号一个CTP会话，合约表和指标页由各会话共用
+        vector<CThostFtdcTraderApi*> ctp_apis_;
+        vector<CTPTradeSpi*> ctp_spis_;
+        std::unordered_map<string, CTPTradeSpi*> fund_spis_;  // fund_id -> 会话
+        vector<std::shared_ptr<std::thread>> threads_; // 每个会话单独开一个线程供CTP使用，以免业务流程处理阻塞底层通信。
+        std::shared_ptr<std::thread> reconcile_thread_;  // 定时与CTP持仓对账
+        std::mutex reconcile_mutex_;
+        std::condition_variable reconcile_cv_;
+        bool reconcile_stopping_ = false;
+        std::shared_ptr<std::thread> metrics_thread_;  // 定时输出指标
     };
 }
@@ -0,0 +1,252 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#include <boost/filesystem.hpp>
+#include "ctp_event_log.h"
+#include "ctp_support.h"
+
+namespace co {
+    static_assert(sizeof(CThostFtdcOrderField) + sizeof(CTPEventHeader) <= kCTPEventSlotSize, "event slot too small");
+    static_assert(sizeof(CThostFtdcTradeField) + sizeof(CTPEventHeader) <= kCTPEventSlotSize, "event slot too small");
+    static_assert(sizeof(InnerFuturePositionEvent) + sizeof(CTPEventHeader) <= kCTPEventSlotSize, "event slot too small");
+    static_assert((kCTPEventRingSize & (kCTPEventRingSize - 1)) == 0, "ring size must be power of 2");
+
+    CTPEventLog* CTPEventLog::instance_ = new CTPEventLog();
+
+    CTPEventLog* CTPEventLog::Instance() {
+        return instance_;
+    }
+
+    void CTPEventLog::Start(const string& dir, bool text) {
+        text_ = text;
+        if (!dir.empty()) {
+            boost::filesystem::create_directories(dir);
+            string file = dir + "/ctp_event_" + std::to_string(x::RawDate()) + ".dat";
+            fp_ = fopen(file.c_str(), "ab");
+            if (fp_) {
+                LOG_INFO << "open ctp event file ok: " << file;
+            } else {
+                LOG_ERROR << "open ctp event file failed: " << file;
+            }
+        }
+        thread_ = std::make_shared<std::thread>(std::bind(&CTPEventLog::Run, this));
+        thread_->detach();
+    }
+
+    CTPEventLog::Ring* CTPEventLog::NewRing() {
+        Ring* ring = new Ring();  // 线程退出后也不释放，后台线程可能还在读取
+        ring->slots.resize((size_t)kCTPEventSlotSize * kCTPEventRingSize);
+        std::unique_lock<std::mutex> lock(mutex_);
+        rings_.push_back(ring);
+        return ring;
+    }
+
+    void CTPEventLog::Write(int32_t type, const void* data, int32_t length) {
+        static thread_local Ring* ring = nullptr;
+        if (!ring) {
+            ring = NewRing();
+        }
+        CTPEventHeader header;
+        header.type = type;
+        header.length = length;
+        header.timestamp = x::RawDateTime();
+        uint64_t head = ring->head.load(std::memory_order_relaxed);
+        bool full = head - ring->tail.load(std::memory_order_acquire) >= (uint64_t)kCTPEventRingSize;
+        if (full || length + (int32_t)sizeof(CTPEventHeader) > kCTPEventSlotSize || ring->overflowing.load(std::memory_order_relaxed)) {
+            string event;
+            event.reserve(sizeof(CTPEventHeader) + length);
+            event.append(reinterpret_cast<const char*>(&header), sizeof(CTPEventHeader));
+            event.append(reinterpret_cast<const char*>(data), length);
+            std::unique_lock<std::mutex> lock(ring->overflow_mutex);
+            ring->overflow.emplace_back(std::move(event));
+            ring->overflowing.store(true, std::memory_order_release);
+            return;
+        }
+        char* slot = &ring->slots[(head & (kCTPEventRingSize - 1)) * kCTPEventSlotSize];
+        memcpy(slot, &header, sizeof(CTPEventHeader));
+        memcpy(slot + sizeof(CTPEventHeader), data, length);
+        ring->head.store(head + 1, std::memory_order_release);
+    }
+
+    void CTPEventLog::Run() {
+        vector<Ring*> rings;
+        while (true) {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                if (rings.size() != rings_.size()) {
+                    rings = rings_;
+                }
+            }
+            int64_t count = 0;
+            for (auto ring : rings) {
+                // 先读溢出标记再读缓冲区：溢出之前写入缓冲区的记录一定在本轮取完，之后再写溢出队列
+                bool overflowing = ring->overflowing.load(std::memory_order_acquire);
+                uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+                uint64_t head = ring->head.load(std::memory_order_acquire);
+                for (; tail < head; ++tail, ++count) {
+                    WriteEvent(&ring->slots[(tail & (kCTPEventRingSize - 1)) * kCTPEventSlotSize]);
+                }
+                ring->tail.store(tail, std::memory_order_release);
+                if (overflowing) {
+                    vector<string> overflow;
+                    {
+                        std::unique_lock<std::mutex> lock(ring->overflow_mutex);
+                        overflow.swap(ring->overflow);
+                        ring->overflowing.store(false, std::memory_order_relaxed);
+                    }
+                    for (auto& event : overflow) {
+                        WriteEvent(event.data());
+                    }
+                    count += overflow.size();
+                    LOG_WARN << "ctp event ring is full, overflow events: " << overflow.size();
+                }
+            }
+            if (count == 0) {
+                if (fp_) {
+                    fflush(fp_);
+                }
+                if (record_fp_) {
+                    fflush(record_fp_);
+                }
+                x::Sleep(1);
+            }
+        }
+    }
+
+    void CTPEventLog::WriteEvent(const char* event) {
+        const CTPEventHeader* header = reinterpret_cast<const CTPEventHeader*>(event);
+        if (header->type == kCTPEventCallback) {
+            WriteRecord(event + sizeof(CTPEventHeader), header->length);
+            return;
+        }
+        if (fp_) {
+            fwrite(event, sizeof(CTPEventHeader) + header->length, 1, fp_);
+        }
+        if (text_) {
+            LOG_INFO << Format(header->type, event + sizeof(CTPEventHeader));
+        }
+    }
+
+    void CTPEventLog::WriteRecord(const char* data, size_t length) {
+        if (record_fp_ && fwrite(data, length, 1, record_fp_) != 1) {
+            LOG_ERROR << "write ctp record file failed, length = " << length;
+        }
+    }
+
+    static string InnerPositionString(const char* code, int64_t bs_flag, const InnerFuturePositionSnapshot& snap) {
+        stringstream ss;
+        ss << "InnerPosition{";
+        ss << "code: " << code
+            << ", bs_flag: " << bs_flag
+            << ", yd_volume: " << snap.yd_volume
+            << ", yd_closing_volume: " << snap.yd_closing_volume
+            << ", yd_close_volume: " << snap.yd_close_volume
+            << ", td_volume: " << snap.td_volume
+            << ", td_closing_volume: " << snap.td_closing_volume
+            << ", td_close_volume: " << snap.td_close_volume
+            << ", td_opening_volume: " << snap.td_opening_volume
+            << ", td_open_volume: " << snap.td_open_volume
+            << "}";
+        return ss.str();
+    }
+
+    string CTPEventLog::Format(int32_t type, const void* data) {
+        stringstream ss;
+        switch (type) {
+        case kCTPEventRtnOrder: {
+            const CThostFtdcOrderField* p = reinterpret_cast<const CThostFtdcOrderField*>(data);
+            ss << "OnRtnOrder, InstrumentID: " << p->InstrumentID
+                << ", ExchangeID: " << p->ExchangeID
+                << ", FrontID: " << p->FrontID
+                << ", SessionID: " << p->SessionID
+                << ", OrderRef: " << p->OrderRef
+                << ", Direction: " << p->Direction
+                << ", CombOffsetFlag: " << p->CombOffsetFlag
+                << ", CombHedgeFlag: " << p->CombHedgeFlag
+                << ", RequestID: " << p->RequestID
+                << ", OrderSysID: " << p->OrderSysID
+                << ", OrderStatus: " << p->OrderStatus
+                << ", OrderSubmitStatus: " << p->OrderSubmitStatus
+                << ", TradingDay: " << p->TradingDay
+                << ", GTDDate: " << p->GTDDate
+                << ", InsertDate: " << p->InsertDate
+                << ", InsertTime: " << p->InsertTime
+                << ", CancelTime: " << p->CancelTime
+                << ", ActiveTime: " << p->ActiveTime
+                << ", SuspendTime: " << p->SuspendTime
+                << ", UpdateTime: " << p->UpdateTime
+                << ", LimitPrice: " << p->LimitPrice
+                << ", VolumeTraded: " << p->VolumeTraded
+                << ", VolumeTotal: " << p->VolumeTotal
+                << ", StatusMsg: " << CtpToUTF8(p->StatusMsg);
+            break;
+        }
+        case kCTPEventRtnTrade: {
+            const CThostFtdcTradeField* p = reinterpret_cast<const CThostFtdcTradeField*>(data);
+            ss << "OnRtnTrade, InstrumentID: " << p->InstrumentID
+                << ", OrderRef: " << p->OrderRef
+                << ", Direction: " << p->Direction
+                << ", CombOffsetFlag: " << p->OffsetFlag
+                << ", HedgeFlag: " << p->HedgeFlag
+                << ", TradeID: " << p->TradeID
+                << ", OrderSysID: " << p->OrderSysID
+                << ", Price: " << p->Price
+                << ", Volume: " << p->Volume
+                << ", TradeTime: " << p->TradeTime
+                << ", TradeDate: " << p->TradeDate
+                << ", TradingDay: " << p->TradingDay;
+            break;
+        }
+        case kCTPEventInputOrder: {
+            const CThostFtdcInputOrderField* p = reinterpret_cast<const CThostFtdcInputOrderField*>(data);
+            ss << "ReqOrderInsert, InstrumentID: " << p->InstrumentID
+                << ", OrderRef: " << p->OrderRef
+                << ", Direction: " << p->Direction
+                << ", CombOffsetFlag: " << p->CombOffsetFlag
+                << ", CombHedgeFlag: " << p->CombHedgeFlag
+                << ", OrderPriceType: " << p->OrderPriceType
+                << ", LimitPrice: " << p->LimitPrice
+                << ", VolumeTotalOriginal: " << p->VolumeTotalOriginal
+                << ", TimeCondition: " << p->TimeCondition
+                << ", VolumeCondition: " << p->VolumeCondition
+                << ", MinVolume: " << p->MinVolume;
+            break;
+        }
+        case kCTPEventInnerPosition: {
+            const InnerFuturePositionEvent* p = reinterpret_cast<const InnerFuturePositionEvent*>(data);
+            const InnerFuturePositionDelta& delta = p->delta;
+            // 买开、卖平更新买持仓，卖开、买平更新卖持仓
+            int64_t pos_bs_flag = (delta.bs_flag == kBsFlagBuy) == (delta.oc_flag == kOcFlagOpen) ? kBsFlagBuy : kBsFlagSell;
+            ss << "[InnerFuturePosition] Order{code=" << delta.code
+                << ", market=" << delta.market
+                << ", hedge_flag=" << delta.hedge_flag
+                << ", bs_flag=" << delta.bs_flag
+                << ", oc_flag=" << delta.oc_flag
+                << ", order_no=" << delta.order_no
+                << ", seq=" << delta.seq
+                << ", order_volume=+" << delta.order_volume
+                << ", match_volume=+" << delta.match_volume
+                << ", withdraw_volume=+" << delta.withdraw_volume
+                << "}, " << InnerPositionString(delta.code, pos_bs_flag, p->before)
+                << " -> " << InnerPositionString(delta.code, pos_bs_flag, p->after);
+            break;
+        }
+        case kCTPEventInnerOcFlag: {
+            const InnerFutureOcFlagEvent* p = reinterpret_cast<const InnerFutureOcFlagEvent*>(data);
+            int64_t r_bs_flag = p->bs_flag == kBsFlagBuy ? kBsFlagSell : kBsFlagBuy;
+            ss << (p->close_yesterday ? "GetCloseYestodayFlag" : "GetAutoOcFlag")
+                << ", code: " << p->code
+                << ", market: " << p->market
+                << ", hedge_flag: " << p->hedge_flag
+                << ", bs_flag: " << p->bs_flag
+                << ", oc_flag: " << p->oc_flag
+                << ", volume: " << p->volume
+                << ", auto_oc_flag: " << p->ret_oc_flag
+                << ", " << (p->has_position ? InnerPositionString(p->code, r_bs_flag, p->position) : "no position");
+            break;
+        }
+        default:
+            ss << "unknown ctp event: type = " << type;
+            break;
+        }
+        return ss.str();
+    }
+}  // namespace co
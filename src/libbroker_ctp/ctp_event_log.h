@@ -0,0 +1,114 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#pragma once
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <x/x.h>
+#include "inner_future_journal.h"
+
+using namespace std;
+
+namespace co {
+    constexpr int32_t kCTPEventRtnOrder = 1;  // CThostFtdcOrderField，委托回报
+    constexpr int32_t kCTPEventRtnTrade = 2;  // CThostFtdcTradeField，成交回报
+    constexpr int32_t kCTPEventInputOrder = 3;  // CThostFtdcInputOrderField，报单请求
+    constexpr int32_t kCTPEventInnerPosition = 4;  // InnerFuturePositionEvent，内部持仓变动
+    constexpr int32_t kCTPEventInnerOcFlag = 5;  // InnerFutureOcFlagEvent，自动开平仓计算
+    constexpr int32_t kCTPEventCallback = 6;  // CTPRecordHeader + 回调参数，只写入回放文件（见ctp_recorder.h）
+
+    constexpr int kCTPEventSlotSize = 1024;  // 每条事件（含头部）的最大字节数
+    constexpr int kCTPEventRingSize = 4096;  // 每个线程的环形缓冲区槽位数，必须为2的幂
+
+struct InnerFuturePositionEvent {
+    InnerFuturePositionDelta delta;
+    InnerFuturePositionSnapshot before;  // 变动前的持仓
+    InnerFuturePositionSnapshot after;  // 变动后的持仓
+};
+
+struct InnerFutureOcFlagEvent {
+    char code[32] = "";
+    int64_t market = 0;
+    int64_t hedge_flag = 0;
+    int64_t bs_flag = 0;
+    int64_t oc_flag = 0;  // 请求中的开平仓标记
+    int64_t volume = 0;
+    int64_t ret_oc_flag = 0;  // 计算出的开平仓标记
+    bool close_yesterday = false;  // 是否只平昨仓
+    bool has_position = false;  // 是否有反方向持仓
+    InnerFuturePositionSnapshot position;  // 反方向持仓
+};
+
+    /**
+     * 事件文件中每条事件的头部，后面紧跟length字节的原始结构体
+     */
+struct CTPEventHeader {
+    int32_t type = 0;
+    int32_t length = 0;
+    int64_t timestamp = 0;
+};
+
+    /**
+     * 异步二进制事件日志
+     * 1.回调线程与报单线程只把原始结构体复制到本线程的无锁环形缓冲区（单生产者单消费者），不做任何格式化；
+     * 2.后台线程依次取出事件，按CTPEventHeader + 结构体写入<dir>/ctp_event_<date>.dat，并按需格式化成文本日志；
+     * 3.缓冲区写满或事件超过槽位大小时不丢弃，带事件头转存到本线程的溢出队列，由后台线程输出告警，不会阻塞调用线程；
+     *   溢出期间的事件都进入溢出队列以保持顺序，后台线程取完缓冲区后再取溢出队列。
+     */
+class CTPEventLog {
+ public:
+    static CTPEventLog* Instance();
+
+    /**
+        * 启动后台线程
+        * @param dir: 二进制事件文件目录，为空时不写文件
+        * @param text: 是否同时输出文本日志
+        */
+    void Start(const string& dir, bool text);
+
+    void Write(int32_t type, const void* data, int32_t length);
+
+    template<typename T>
+    inline void Write(int32_t type, const T& data) {
+        Write(type, &data, sizeof(T));
+    }
+
+    static string Format(int32_t type, const void* data);  // 把一条事件格式化成文本
+
+    inline bool recording() const {
+        return record_fp_ != nullptr;
+    }
+
+    // 设置回放文件，kCTPEventCallback事件不带事件头写入该文件，必须在Start之前调用
+    inline void set_record_file(FILE* fp) {
+        record_fp_ = fp;
+    }
+
+ protected:
+    struct Ring {
+        alignas(64) std::atomic<uint64_t> head {0};  // 写入位置，只由生产线程修改
+        alignas(64) std::atomic<uint64_t> tail {0};  // 读取位置，只由后台线程修改
+        vector<char> slots;
+        std::atomic<bool> overflowing {false};  // 溢出队列不为空，由生产线程置位，后台线程取走溢出队列时清除
+        std::mutex overflow_mutex;
+        vector<string> overflow;  // 缓冲区写满时的事件，CTPEventHeader + 结构体
+    };
+    CTPEventLog() = default;
+    ~CTPEventLog() = default;
+    CTPEventLog(const CTPEventLog&) = delete;
+    const CTPEventLog& operator=(const CTPEventLog&) = delete;
+
+    Ring* NewRing();
+    void Run();
+    void WriteEvent(const char* event);  // 写出一条事件：CTPEventHeader + 结构体
+    void WriteRecord(const char* data, size_t length);
+
+ private:
+    static CTPEventLog* instance_;
+    std::mutex mutex_;  // 只保护rings_的注册
+    vector<Ring*> rings_;
+    std::shared_ptr<std::thread> thread_;
+    FILE* fp_ = nullptr;
+    FILE* record_fp_ = nullptr;
+    bool text_ = true;
+};
+}  // namespace co
@@ -0,0 +1,118 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#include <chrono>
+#include "ctp_flow_control.h"
+#include "ctp_support.h"
+#include "ctp_metrics.h"
+
+namespace co {
+    static int64_t NowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void CTPFlowControl::Init(int64_t rate, int64_t queue_size, Sender sender, Failure failure) {
+        rate_ = rate;
+        queue_size_ = queue_size;
+        sender_ = sender;
+        failure_ = failure;
+        if (rate_ > 0) {
+            used_.resize(rate_, 0);
+            thread_ = std::make_shared<std::thread>(std::bind(&CTPFlowControl::Run, this));
+            LOG_INFO << "start order flow control: rate = " << rate_ << "/s, queue_size = " << queue_size_;
+        }
+    }
+
+    CTPFlowControl::~CTPFlowControl() {
+        Stop();
+    }
+
+    void CTPFlowControl::Stop() {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            stopped_ = true;
+        }
+        cv_.notify_all();
+        if (thread_ && thread_->joinable()) {
+            thread_->join();
+        }
+    }
+
+    int64_t CTPFlowControl::NextTime() {
+        return used_[head_] + 1000000000LL;
+    }
+
+    void CTPFlowControl::Take(int64_t now) {
+        used_[head_] = now;
+        head_ = (head_ + 1) % used_.size();
+    }
+
+    int CTPFlowControl::Send(CTPFlowRequest& req) {
+        if (rate_ <= 0) {
+            return sender_(req);
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (stopped_) {
+            return kCTPFlowQueueFull;
+        }
+        // 撤单只需排在已排队的撤单之后，报单需要排在所有已排队的请求之后
+        bool queued_ahead = !withdraws_.empty() || (!req.withdraw && !orders_.empty());
+        int64_t now = NowNs();
+        if (!queued_ahead && now >= NextTime()) {
+            Take(now);
+            int ret = sender_(req);
+            if (!is_flow_control(ret)) {
+                return ret;
+            }
+        }
+        if ((int64_t)(withdraws_.size() + orders_.size()) >= queue_size_) {
+            return kCTPFlowQueueFull;
+        }
+        (req.withdraw ? withdraws_ : orders_).push_back(req);
+        CTPMetrics::Instance()->Add(&CTPMetricsPage::requests_queued);
+        cv_.notify_one();
+        return 0;
+    }
+
+    vector<CTPFlowRequest> CTPFlowControl::Remove(const std::function<bool(const CTPFlowRequest&)>& match) {
+        vector<CTPFlowRequest> removed;
+        std::unique_lock<std::mutex> lock(mutex_);
+        for (auto queue : {&withdraws_, &orders_}) {
+            for (auto it = queue->begin(); it != queue->end();) {
+                if (match(*it)) {
+                    removed.push_back(*it);
+                    it = queue->erase(it);
+                } else {
+                    ++it;
+                }
+            }
+        }
+        return removed;
+    }
+
+    void CTPFlowControl::Run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopped_) {
+            if (withdraws_.empty() && orders_.empty()) {
+                cv_.wait(lock);
+                continue;
+            }
+            int64_t now = NowNs();
+            int64_t next = NextTime();
+            if (now < next) {
+                cv_.wait_for(lock, std::chrono::nanoseconds(next - now));
+                continue;
+            }
+            std::deque<CTPFlowRequest>& queue = withdraws_.empty() ? orders_ : withdraws_;
+            CTPFlowRequest req = queue.front();
+            queue.pop_front();
+            Take(now);
+            int ret = sender_(req);
+            if (is_flow_control(ret)) {
+                queue.push_front(req);  // 前置的计数与本地不同步，等下一个令牌重试
+            } else if (ret != 0) {
+                lock.unlock();
+                failure_(req, ret);
+                lock.lock();
+            }
+        }
+    }
+}  // namespace co
@@ -0,0 +1,93 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <x/x.h>
+#include <coral/coral.h>
+#include "ThostFtdcTraderApi.h"
+
+using namespace std;
+
+namespace co {
+    /**
+     * 等待流控的报单或撤单请求
+     */
+struct CTPFlowRequest {
+    bool withdraw = false;
+    bool batch = false;  // 批量撤单（ReqBatchOrderAction），按撤单排队
+    bool mass = false;  // 批量撤单中的一笔，没有对应的客户端请求，失败时不单独回报
+    bool parked = false;  // 预埋单（ReqParkedOrderInsert）或预埋撤单（ReqParkedOrderAction），由CTP在交易时段开始时报出
+    string parked_order_id;  // 不为空时删除尚未报出的预埋单（ReqRemoveParkedOrder），按撤单排队
+    int request_id = 0;
+    string order_no;
+    CThostFtdcInputOrderField order;  // withdraw为false时有效
+    CThostFtdcInputOrderActionField action;  // withdraw为true时有效
+    CThostFtdcInputBatchOrderActionField batch_action;  // batch为true时有效
+    co::fbs::TradeOrderT inner_order;  // 已计入内部持仓的委托，发送失败时撤回
+};
+
+    /**
+     * 报单流控
+     * CTP前置按会话限制每秒的报单与撤单总笔数，超出时返回-2/-3。这里在本地按同样的限制放行：
+     * 1.令牌数等于每秒限制笔数，每个令牌在使用1秒后归还，任意1秒内发出的请求不会超过限制；
+     * 2.没有令牌时请求进入有界队列，撤单排在报单之前，同类请求先进先出（保证OrderRef递增）；
+     * 3.后台线程在下一个令牌归还的时刻立即发送队首请求，CTP仍返回流控时放回队首重试；
+     * 4.rate为0时不做本地流控，直接发送；
+     * 5.撤销仍在排队的报单时由调用方用Remove从队列中取出并在本地撤单，不向CTP发送撤单；
+     * 6.所有者析构前调用Stop，后台线程退出后不再调用Sender。
+     */
+class CTPFlowControl {
+ public:
+    typedef std::function<int(CTPFlowRequest&)> Sender;  // 发送请求，返回ReqOrderInsert/ReqOrderAction的返回值；报出时可能改写委托合同号
+    typedef std::function<void(const CTPFlowRequest&, int)> Failure;  // 排队后发送失败时调用
+
+    CTPFlowControl() = default;
+    ~CTPFlowControl();
+    CTPFlowControl(const CTPFlowControl&) = delete;
+    const CTPFlowControl& operator=(const CTPFlowControl&) = delete;
+
+    void Init(int64_t rate, int64_t queue_size, Sender sender, Failure failure);
+
+    /**
+        * 发送或排队
+        * @param req: 直接发送时由Sender改写的委托合同号会写回req，调用方回报错误时使用
+        * @return 0表示已发送或已排队；否则为发送失败的返回值（队列已满时为kCTPFlowQueueFull），由调用方回报错误
+        */
+    int Send(CTPFlowRequest& req);
+
+    /**
+        * 从队列中取出尚未发出的请求
+        * @param match: 返回true的报单或撤单被取出
+        * @return 取出的请求，撤单在前，同类按排队顺序
+        */
+    vector<CTPFlowRequest> Remove(const std::function<bool(const CTPFlowRequest&)>& match);
+
+    void Stop();  // 停止后台线程并等待退出，队列中的请求不再发送
+
+    inline int64_t rate() const {
+        return rate_;
+    }
+
+ protected:
+    int64_t NextTime();  // 下一个令牌可用的时间，纳秒
+    void Take(int64_t now);
+    void Run();
+
+ private:
+    int64_t rate_ = 0;
+    int64_t queue_size_ = 0;
+    Sender sender_;
+    Failure failure_;
+    std::mutex mutex_;  // 同时串行化发送，保证排队请求与新请求的先后顺序
+    std::condition_variable cv_;
+    bool stopped_ = false;  // mutex_保护
+    vector<int64_t> used_;  // 环形缓冲区，每个令牌最近一次使用的时间
+    size_t head_ = 0;  // 最早归还的令牌
+    std::deque<CTPFlowRequest> withdraws_;
+    std::deque<CTPFlowRequest> orders_;
+    std::shared_ptr<std::thread> thread_;
+};
+}  // namespace co
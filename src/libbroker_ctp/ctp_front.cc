@@ -0,0 +1,79 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <x/x.h>
+#include "ctp_front.h"
+
+namespace co {
+    // 一次TCP建连的耗时，微秒，失败返回-1
+    static int64_t ConnectRtt(const string& host, const string& port, int64_t timeout_ms) {
+        addrinfo hints {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        addrinfo* res = nullptr;
+        if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0 || !res) {
+            return -1;
+        }
+        int64_t rtt = -1;
+        int fd = socket(res->ai_family, res->ai_socktype, res->ai_protocol);
+        if (fd >= 0) {
+            fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+            auto start = std::chrono::steady_clock::now();
+            int rc = connect(fd, res->ai_addr, res->ai_addrlen);
+            if (rc != 0 && errno == EINPROGRESS) {
+                pollfd pfd {fd, POLLOUT, 0};
+                if (poll(&pfd, 1, (int)timeout_ms) == 1) {
+                    int error = 0;
+                    socklen_t len = sizeof(error);
+                    getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len);
+                    rc = error == 0 ? 0 : -1;
+                }
+            }
+            if (rc == 0) {
+                rtt = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+            }
+            close(fd);
+        }
+        freeaddrinfo(res);
+        return rtt;
+    }
+
+    vector<CTPFrontProbe> ProbeFronts(const vector<string>& fronts, int times, int64_t timeout_ms) {
+        vector<CTPFrontProbe> probes;
+        for (auto& front : fronts) {
+            CTPFrontProbe probe;
+            probe.front = front;
+            // tcp://180.169.50.131:42205
+            string addr = front;
+            size_t pos = addr.find("://");
+            if (pos != string::npos) {
+                addr = addr.substr(pos + 3);
+            }
+            pos = addr.rfind(':');
+            if (pos != string::npos) {
+                string host = addr.substr(0, pos);
+                string port = addr.substr(pos + 1);
+                for (int i = 0; i < times; ++i) {
+                    int64_t rtt = ConnectRtt(host, port, timeout_ms);
+                    if (rtt >= 0 && (probe.rtt_us < 0 || rtt < probe.rtt_us)) {
+                        probe.rtt_us = rtt;
+                    }
+                }
+            }
+            LOG_INFO << "probe ctp front: " << front << ", rtt = " << probe.rtt_us << "us";
+            probes.push_back(probe);
+        }
+        std::stable_sort(probes.begin(), probes.end(), [](const CTPFrontProbe& a, const CTPFrontProbe& b) {
+            if ((a.rtt_us < 0) != (b.rtt_us < 0)) {
+                return b.rtt_us < 0;
+            }
+            return a.rtt_us < b.rtt_us;
+        });
+        return probes;
+    }
+}  // namespace co
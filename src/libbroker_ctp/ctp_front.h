@@ -0,0 +1,20 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#pragma once
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace co {
+struct CTPFrontProbe {
+    string front;  // tcp://host:port
+    int64_t rtt_us = -1;  // TCP建连耗时（多次取最小值），-1表示连接失败
+};
+
+    /**
+     * 探测各前置的TCP建连耗时并按耗时从小到大排序，连接失败的排在最后
+     * @param times: 每个前置探测的次数
+     * @param timeout_ms: 每次建连的超时时间
+     */
+    vector<CTPFrontProbe> ProbeFronts(const vector<string>& fronts, int times, int64_t timeout_ms);
+}  // namespace co
@@ -0,0 +1,142 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+#include "ctp_instrument.h"
+#include <x/x.h>
+
+namespace co {
+    constexpr char kCTPInstrumentMagic[8] = "CTPINST";
+
+    CTPInstrumentCatalog* CTPInstrumentCatalog::instance_ = new CTPInstrumentCatalog();
+
+    CTPInstrumentCatalog* CTPInstrumentCatalog::Instance() {
+        return instance_;
+    }
+
+    string CTPInstrumentCatalog::GetFile(const string& mem_dir, int64_t trading_day) {
+        return mem_dir + "/ctp_instruments_" + std::to_string(trading_day) + ".dat";
+    }
+
+    const char* CTPInstrumentCatalog::MapFile(const string& file) {
+        int fd = ::open(file.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return nullptr;
+        }
+        struct stat st;
+        void* p = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(CTPInstrumentFileHeader)) {
+            p = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            return nullptr;
+        }
+        const CTPInstrumentFileHeader* header = (const CTPInstrumentFileHeader*)p;
+        int64_t size = sizeof(CTPInstrumentFileHeader) + header->count * (int64_t)sizeof(CTPInstrumentRecord);
+        if (strcmp(header->magic, kCTPInstrumentMagic) != 0 || header->version != kCTPInstrumentVersion ||
+            header->record_size != (int64_t)sizeof(CTPInstrumentRecord) || st.st_size < size) {
+            LOG_WARN << "ignore incompatible instrument file: " << file;
+            munmap(p, st.st_size);
+            return nullptr;
+        }
+        return (const char*)p;  // 进程退出前一直使用，不解除映射
+    }
+
+    bool CTPInstrumentCatalog::Attach(const string& mem_dir, int64_t trading_day) {
+        if (mem_dir.empty()) {
+            return false;
+        }
+        string file = GetFile(mem_dir, trading_day);
+        const char* p = MapFile(file);
+        if (!p) {
+            return false;
+        }
+        const CTPInstrumentFileHeader* header = (const CTPInstrumentFileHeader*)p;
+        if (header->trading_day != trading_day) {
+            return false;
+        }
+        Load((const CTPInstrumentRecord*)(p + sizeof(CTPInstrumentFileHeader)), header->count);
+        LOG_INFO << "attach instrument file ok: " << file << ", contracts = " << header->count;
+        return true;
+    }
+
+    void CTPInstrumentCatalog::Add(const CTPInstrumentRecord& record) {
+        local_.push_back(record);
+    }
+
+    void CTPInstrumentCatalog::Publish(const string& mem_dir, int64_t trading_day) {
+        if (!mem_dir.empty()) {
+            boost::filesystem::create_directories(mem_dir);
+            string file = GetFile(mem_dir, trading_day);
+            string tmp_file = file + "." + std::to_string(getpid()) + ".tmp";
+            CTPInstrumentFileHeader header {};
+            strcpy(header.magic, kCTPInstrumentMagic);
+            header.version = kCTPInstrumentVersion;
+            header.record_size = sizeof(CTPInstrumentRecord);
+            header.trading_day = trading_day;
+            header.count = local_.size();
+            FILE* fp = fopen(tmp_file.c_str(), "wb");
+            bool ok = fp != nullptr;
+            if (fp) {
+                ok = fwrite(&header, sizeof(header), 1, fp) == 1;
+                if (ok && !local_.empty()) {
+                    ok = fwrite(local_.data(), sizeof(CTPInstrumentRecord), local_.size(), fp) == local_.size();
+                }
+                ok = fclose(fp) == 0 && ok;
+            }
+            // 改名是原子的，同时启动的多个进程都查询并发布时，内容相同，后发布的覆盖先发布的
+            if (ok && rename(tmp_file.c_str(), file.c_str()) == 0) {
+                const char* p = MapFile(file);
+                if (p) {
+                    Load((const CTPInstrumentRecord*)(p + sizeof(CTPInstrumentFileHeader)), header.count);
+                    local_.clear();
+                    local_.shrink_to_fit();
+                    LOG_INFO << "publish instrument file ok: " << file << ", contracts = " << header.count;
+                    return;
+                }
+            } else {
+                remove(tmp_file.c_str());
+            }
+            LOG_ERROR << "publish instrument file failed: " << file;
+        }
+        Load(local_.data(), local_.size());
+    }
+
+    void CTPInstrumentCatalog::Load(const CTPInstrumentRecord* records, int64_t count) {
+        base_ = records;
+        count_ = count;
+        price_limits_.reset(new CTPPriceLimit[count > 0 ? count : 1]);
+        for (int64_t i = 0; i < count; ++i) {
+            const CTPInstrumentRecord* record = records + i;
+            items_[record->code] = std::make_pair(string(record->name), (int)record->multiple);
+            records_[record->code] = record;
+        }
+        ready_.store(true);
+    }
+
+    const CTPInstrumentRecord* CTPInstrumentCatalog::Find(const string& code) const {
+        auto it = records_.find(code);
+        return it != records_.end() ? it->second : nullptr;
+    }
+
+    void CTPInstrumentCatalog::SetPriceLimit(const CTPInstrumentRecord* record, double upper, double lower) {
+        int64_t index = IndexOf(record);
+        if (index >= 0) {
+            price_limits_[index].upper.store(upper, std::memory_order_relaxed);
+            price_limits_[index].lower.store(lower, std::memory_order_relaxed);
+        }
+    }
+
+    bool CTPInstrumentCatalog::GetPriceLimit(const CTPInstrumentRecord* record, double* upper, double* lower) const {
+        int64_t index = IndexOf(record);
+        if (index < 0) {
+            return false;
+        }
+        *upper = price_limits_[index].upper.load(std::memory_order_relaxed);
+        *lower = price_limits_[index].lower.load(std::memory_order_relaxed);
+        return *upper > 0;
+    }
+}  // namespace co
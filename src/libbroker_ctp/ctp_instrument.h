@@ -0,0 +1,139 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#pragma once
+#include <atomic>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace co {
+    constexpr int64_t kCTPInstrumentVersion = 2;
+
+    /**
+     * 合约信息，共享内存中的定长记录
+     */
+struct CTPInstrumentRecord {
+    char code[32];  // 带市场后缀的代码，如rb2110.SHFE
+    char instrument_id[32];  // CTP合约代码
+    char exchange_id[16];
+    char name[64];  // 合约名称，已转换为UTF-8
+    int64_t market;
+    int64_t multiple;  // 合约乘数
+    double price_tick;  // 最小变动价位
+    int64_t max_limit_order_volume;  // 限价单最大下单量
+    int64_t min_limit_order_volume;  // 限价单最小下单量
+    int64_t max_market_order_volume;  // 市价单最大下单量
+    int64_t min_market_order_volume;  // 市价单最小下单量
+    int64_t expire_date;  // 到期日，YYYYMMDD
+    char product_id[32];  // 品种代码，查找交易状态时使用
+};
+
+    /**
+     * 当日涨跌停价，启动后查询行情得到，只在进程内使用，0表示未知
+     */
+struct CTPPriceLimit {
+    std::atomic<double> upper {0};
+    std::atomic<double> lower {0};
+};
+
+    /**
+     * 合约文件头，文件为<mem_dir>/ctp_instruments_<交易日>.dat，头之后紧跟count条CTPInstrumentRecord
+     */
+struct CTPInstrumentFileHeader {
+    char magic[8];  // CTPINST
+    int64_t version;
+    int64_t record_size;
+    int64_t trading_day;
+    int64_t count;
+};
+
+    /**
+     * 合约表，同一进程内的所有资金账号共用，同一主机上的多个broker进程通过只读映射共用
+     * 1.登录后先按交易日映射<mem_dir>/ctp_instruments_<交易日>.dat，存在时直接使用，不再查询CTP，也不再转换GBK名称；
+     * 2.不存在时由查询合约的账号逐条Add，查询结束后Publish：写入临时文件后改名，其他进程只会看到完整的文件；
+     * 3.就绪之后只读。
+     */
+class CTPInstrumentCatalog {
+ public:
+    typedef std::unordered_map<std::string, std::pair<std::string, int>> Items;  // code -> (合约名称, 乘数)
+
+    static CTPInstrumentCatalog* Instance();
+
+    /**
+     * 映射其他进程已发布的合约文件
+     * @return 文件存在且完整时返回true，合约表就绪
+     */
+    bool Attach(const string& mem_dir, int64_t trading_day);
+
+    void Add(const CTPInstrumentRecord& record);  // 查询合约时逐条加入
+
+    /**
+     * 查询结束后发布合约文件并就绪，mem_dir为空或写入失败时只在进程内使用
+     */
+    void Publish(const string& mem_dir, int64_t trading_day);
+
+    const CTPInstrumentRecord* Find(const string& code) const;  // 没有找到时返回nullptr
+
+    // 就绪后的合约数和第i条记录，记录的下标在进程内不变，可以用作其他数组的下标
+    inline int64_t size() const {
+        return count_;
+    }
+
+    inline const CTPInstrumentRecord* at(int64_t i) const {
+        return base_ + i;
+    }
+
+    // record必须来自Find或at，否则返回-1
+    inline int64_t IndexOf(const CTPInstrumentRecord* record) const {
+        int64_t index = record - base_;
+        return index >= 0 && index < count_ ? index : -1;
+    }
+
+    // 设置合约的涨跌停价，record必须来自Find
+    void SetPriceLimit(const CTPInstrumentRecord* record, double upper, double lower);
+
+    /**
+     * 取合约的涨跌停价，只有两次原子读
+     * @return 还没有涨跌停价时返回false
+     */
+    bool GetPriceLimit(const CTPInstrumentRecord* record, double* upper, double* lower) const;
+
+    // 只有第一次调用返回true，多个资金账号只由一个账号查询涨跌停价
+    inline bool TryRequestPriceLimits() {
+        return !price_limits_requested_.exchange(true);
+    }
+
+    // code -> (合约名称, 乘数)，就绪后只读
+    inline Items& items() {
+        return items_;
+    }
+
+    inline bool ready() const {
+        return ready_.load();
+    }
+
+ protected:
+    CTPInstrumentCatalog() = default;
+    ~CTPInstrumentCatalog() = default;
+    CTPInstrumentCatalog(const CTPInstrumentCatalog&) = delete;
+    const CTPInstrumentCatalog& operator=(const CTPInstrumentCatalog&) = delete;
+
+    string GetFile(const string& mem_dir, int64_t trading_day);
+    const char* MapFile(const string& file);
+    void Load(const CTPInstrumentRecord* records, int64_t count);
+
+ private:
+    static CTPInstrumentCatalog* instance_;
+    Items items_;
+    std::unordered_map<std::string, const CTPInstrumentRecord*> records_;  // 指向映射的文件或local_
+    vector<CTPInstrumentRecord> local_;  // 查询到的合约
+    const CTPInstrumentRecord* base_ = nullptr;  // Load的第一条记录，按记录的下标访问price_limits_
+    int64_t count_ = 0;
+    std::unique_ptr<CTPPriceLimit[]> price_limits_;
+    std::atomic_bool price_limits_requested_ {false};
+    std::atomic_bool ready_ {false};
+};
+}  // namespace co
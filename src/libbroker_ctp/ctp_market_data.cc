@@ -0,0 +1,177 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#include <boost/filesystem.hpp>
+#include <x/x.h>
+#include "ctp_market_data.h"
+#include "ctp_support.h"
+
+namespace co {
+    CTPMarketData* CTPMarketData::instance_ = new CTPMarketData();
+
+    CTPMarketData* CTPMarketData::Instance() {
+        return instance_;
+    }
+
+    bool CTPMarketData::Start(const vector<string>& fronts, const CTPAccount& account) {
+        if (fronts.empty()) {
+            return false;
+        }
+        account_ = account;
+        CTPInstrumentCatalog* catalog = CTPInstrumentCatalog::Instance();
+        count_ = catalog->size();
+        prices_.reset(new CTPLastPrice[count_ > 0 ? count_ : 1]);
+        for (int64_t i = 0; i < count_; ++i) {
+            indexes_[catalog->at(i)->instrument_id] = i;
+        }
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (auto& code : pending_codes_) {
+                const CTPInstrumentRecord* record = catalog->Find(code);
+                if (record) {
+                    subscribed_.insert(record->instrument_id);
+                } else {
+                    LOG_WARN << "market data contract not found: " << code;
+                }
+            }
+            pending_codes_.clear();
+        }
+        enabled_ = true;
+        string flow_path = "ctp_md_flow/";
+        boost::filesystem::create_directories(flow_path);
+        api_ = CThostFtdcMdApi::CreateFtdcMdApi(flow_path.c_str());
+        api_->RegisterSpi(this);
+        for (auto& front : fronts) {
+            api_->RegisterFront((char*)front.c_str());
+        }
+        api_->Init();
+        LOG_INFO << "start ctp market data session: fronts = " << fronts.size() << ", contracts = " << count_;
+        return true;
+    }
+
+    void CTPMarketData::Subscribe(const string& code) {
+        const CTPInstrumentRecord* record = CTPInstrumentCatalog::Instance()->Find(code);
+        string instrument_id = record ? record->instrument_id : "";
+        bool logined = false;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (!record) {
+                pending_codes_.insert(code);  // 合约表还没有就绪，Start时再查找
+                return;
+            }
+            if (!subscribed_.insert(instrument_id).second) {
+                return;
+            }
+            logined = logined_;  // 还没有登录时，登录后统一订阅
+        }
+        if (logined) {
+            DoSubscribe({instrument_id});
+        }
+    }
+
+    void CTPMarketData::DoSubscribe(const vector<string>& instrument_ids) {
+        if (instrument_ids.empty()) {
+            return;
+        }
+        vector<char*> ids;
+        for (auto& id : instrument_ids) {
+            ids.push_back((char*)id.c_str());
+        }
+        int rc = api_->SubscribeMarketData(ids.data(), (int)ids.size());
+        if (rc != 0) {
+            LOG_ERROR << "subscribe market data failed: " << CtpApiError(rc) << ", contracts = " << ids.size();
+        }
+    }
+
+    bool CTPMarketData::GetLastPrice(const CTPInstrumentRecord* record, double* price) const {
+        double last_price = 0;
+        double pre_settlement_price = 0;
+        if (!GetPrices(record, &last_price, &pre_settlement_price)) {
+            return false;
+        }
+        *price = last_price > 0 ? last_price : pre_settlement_price;
+        return *price > 0;
+    }
+
+    bool CTPMarketData::GetPrices(const CTPInstrumentRecord* record, double* last_price, double* pre_settlement_price) const {
+        int64_t index = CTPInstrumentCatalog::Instance()->IndexOf(record);
+        if (!enabled_ || index < 0 || index >= count_) {
+            return false;
+        }
+        const CTPLastPrice& item = prices_[index];
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        do {
+            begin = item.seq.load(std::memory_order_acquire);
+            *last_price = item.last_price.load(std::memory_order_relaxed);
+            *pre_settlement_price = item.pre_settlement_price.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            end = item.seq.load(std::memory_order_relaxed);
+        } while ((begin & 1) || begin != end);
+        return *last_price > 0 || *pre_settlement_price > 0;
+    }
+
+    void CTPMarketData::OnFrontConnected() {
+        LOG_INFO << "connect to CTP market data server ok";
+        ReqUserLogin();
+    }
+
+    void CTPMarketData::OnFrontDisconnected(int nReason) {
+        logined_ = false;
+        LOG_WARN << "market data connection is broken: ret=" << nReason;
+    }
+
+    void CTPMarketData::ReqUserLogin() {
+        CThostFtdcReqUserLoginField req;
+        memset(&req, 0, sizeof(req));
+        strcpy(req.BrokerID, account_.broker_id.c_str());
+        strcpy(req.UserID, account_.investor_id.c_str());
+        strcpy(req.Password, account_.password.c_str());
+        int rc = 0;
+        while ((rc = api_->ReqUserLogin(&req, 0)) != 0) {
+            LOG_WARN << "market data ReqUserLogin failed: " << CtpApiError(rc) << ", retring ...";
+            x::Sleep(CTP_FLOW_CONTROL_MS);
+        }
+    }
+
+    void CTPMarketData::OnRspUserLogin(CThostFtdcRspUserLoginField* pRspUserLogin, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        if (pRspInfo && pRspInfo->ErrorID != 0) {
+            LOG_ERROR << "market data login failed: " << CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
+            return;
+        }
+        vector<string> instrument_ids;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            instrument_ids.assign(subscribed_.begin(), subscribed_.end());
+            logined_ = true;  // 在锁内设置，之后加入的合约由Subscribe直接订阅
+        }
+        LOG_INFO << "market data login ok, subscribe contracts: " << instrument_ids.size();
+        DoSubscribe(instrument_ids);  // 重新登录后需要重新订阅
+    }
+
+    void CTPMarketData::OnRspSubMarketData(CThostFtdcSpecificInstrumentField* pSpecificInstrument, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        if (pRspInfo && pRspInfo->ErrorID != 0) {
+            LOG_ERROR << "subscribe market data failed: " << (pSpecificInstrument ? pSpecificInstrument->InstrumentID : "")
+                << ", " << CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
+        }
+    }
+
+    void CTPMarketData::OnRtnDepthMarketData(CThostFtdcDepthMarketDataField* p) {
+        if (!p) {
+            return;
+        }
+        auto it = indexes_.find(p->InstrumentID);
+        if (it == indexes_.end()) {
+            return;
+        }
+        // 没有成交时最新价为DBL_MAX
+        double last_price = p->LastPrice > 0 && p->LastPrice < 1e300 ? p->LastPrice : 0;
+        double pre_settlement_price = p->PreSettlementPrice > 0 && p->PreSettlementPrice < 1e300 ? p->PreSettlementPrice : 0;
+        CTPLastPrice& item = prices_[it->second];
+        uint64_t seq = item.seq.load(std::memory_order_relaxed);
+        item.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        item.last_price.store(last_price, std::memory_order_relaxed);
+        item.pre_settlement_price.store(pre_settlement_price, std::memory_order_relaxed);
+        item.timestamp.store(x::RawDateTime(), std::memory_order_relaxed);
+        item.seq.store(seq + 2, std::memory_order_release);
+    }
+}  // namespace co
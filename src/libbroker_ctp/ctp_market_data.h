@@ -0,0 +1,88 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#pragma once
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include "ThostFtdcMdApi.h"
+#include "config.h"
+#include "ctp_instrument.h"
+
+using namespace std;
+
+namespace co {
+    /**
+     * 合约最新价，顺序锁保护：写入时seq为奇数，读取前后seq相同且为偶数时结果一致
+     */
+struct CTPLastPrice {
+    std::atomic<uint64_t> seq {0};
+    std::atomic<double> last_price {0};
+    std::atomic<double> pre_settlement_price {0};
+    std::atomic<int64_t> timestamp {0};  // 收到行情的时间，YYYYMMDDHHMMSSsss
+};
+
+    /**
+     * 行情会话，同一进程内的所有资金账号共用
+     * 1.配置了ctp_md_front时启动，使用第一个资金账号登录行情前置；
+     * 2.订阅持仓涉及的合约（查询持仓和成交时加入），启动前加入的合约先记下，登录后统一订阅，断线重新登录后重新订阅；
+     * 3.OnRtnDepthMarketData是唯一的写入方，按合约表的下标写入最新价数组，读取方不加锁。
+     */
+class CTPMarketData : public CThostFtdcMdSpi {
+ public:
+    static CTPMarketData* Instance();
+
+    /**
+     * 启动行情会话，合约表就绪后调用
+     * @return 没有配置行情前置时返回false
+     */
+    bool Start(const vector<string>& fronts, const CTPAccount& account);
+
+    void Subscribe(const string& code);  // 带市场后缀的代码，重复订阅时忽略；还没有登录时只记下，登录后订阅
+
+    /**
+     * 取合约的最新价，没有最新价时使用昨结算价
+     * @return 还没有收到行情时返回false
+     */
+    bool GetLastPrice(const CTPInstrumentRecord* record, double* price) const;
+
+    /**
+     * 取合约的最新价和昨结算价，计算盯市盈亏时使用
+     * @return 还没有收到行情时返回false；没有成交时last_price为0
+     */
+    bool GetPrices(const CTPInstrumentRecord* record, double* last_price, double* pre_settlement_price) const;
+
+    inline bool enabled() const {
+        return enabled_.load();
+    }
+
+    virtual void OnFrontConnected();
+    virtual void OnFrontDisconnected(int nReason);
+    virtual void OnRspUserLogin(CThostFtdcRspUserLoginField *pRspUserLogin, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
+    virtual void OnRspSubMarketData(CThostFtdcSpecificInstrumentField *pSpecificInstrument, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
+    virtual void OnRtnDepthMarketData(CThostFtdcDepthMarketDataField *pDepthMarketData);
+
+ protected:
+    CTPMarketData() = default;
+    ~CTPMarketData() = default;
+    CTPMarketData(const CTPMarketData&) = delete;
+    const CTPMarketData& operator=(const CTPMarketData&) = delete;
+
+    void ReqUserLogin();
+    void DoSubscribe(const vector<string>& instrument_ids);
+
+ private:
+    static CTPMarketData* instance_;
+    CThostFtdcMdApi* api_ = nullptr;
+    CTPAccount account_;
+    std::atomic_bool enabled_ {false};
+    std::atomic_bool logined_ {false};
+    std::mutex mutex_;
+    std::set<std::string> subscribed_;  // 已订阅的CTP合约代码
+    std::set<std::string> pending_codes_;  // 合约表中还找不到的代码，Start时转换为CTP合约代码
+    std::unordered_map<std::string, int64_t> indexes_;  // CTP合约代码 -> 合约表下标，启动后只读
+    std::unique_ptr<CTPLastPrice[]> prices_;
+    int64_t count_ = 0;
+};
+}  // namespace co
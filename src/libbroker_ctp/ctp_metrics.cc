@@ -0,0 +1,98 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+#include "ctp_metrics.h"
+
+namespace co {
+    static_assert(std::atomic<int64_t>::is_always_lock_free, "metrics counters must be lock free");
+    static_assert(sizeof(std::atomic<int64_t>) == sizeof(int64_t), "metrics counters must be plain int64");
+
+    constexpr char kCTPMetricsMagic[8] = "CTPMETR";
+
+    CTPMetrics* CTPMetrics::instance_ = new CTPMetrics();
+
+    CTPMetrics* CTPMetrics::Instance() {
+        return instance_;
+    }
+
+    CTPMetrics::CTPMetrics() {
+        page_ = &local_page_;
+        Reset();
+    }
+
+    void CTPMetrics::Reset() {
+        memset(static_cast<void*>(page_), 0, sizeof(CTPMetricsPage));
+        strcpy(page_->magic, kCTPMetricsMagic);
+        page_->version = kCTPMetricsVersion;
+        page_->size = sizeof(CTPMetricsPage);
+        page_->pid = getpid();
+        page_->start_time = x::RawDateTime();
+    }
+
+    bool CTPMetrics::Open(const string& mem_dir, const string& investor_id) {
+        if (mem_dir.empty()) {
+            return false;
+        }
+        boost::filesystem::create_directories(mem_dir);
+        string file = mem_dir + "/ctp_metrics_" + investor_id + ".dat";
+        int fd = ::open(file.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd < 0) {
+            LOG_ERROR << "open metrics file failed: " << file;
+            return false;
+        }
+        if (ftruncate(fd, sizeof(CTPMetricsPage)) != 0) {
+            LOG_ERROR << "resize metrics file failed: " << file;
+            ::close(fd);
+            return false;
+        }
+        void* p = mmap(nullptr, sizeof(CTPMetricsPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            LOG_ERROR << "mmap metrics file failed: " << file;
+            return false;
+        }
+        page_ = reinterpret_cast<CTPMetricsPage*>(p);
+        Reset();  // 每次启动重新计数
+        LOG_INFO << "open metrics file ok: " << file;
+        return true;
+    }
+
+    void CTPMetrics::AddCallback(int64_t ns) {
+        page_->callbacks.fetch_add(1, std::memory_order_relaxed);
+        page_->callback_ns_total.fetch_add(ns, std::memory_order_relaxed);
+        int64_t max_ns = page_->callback_ns_max.load(std::memory_order_relaxed);
+        while (ns > max_ns && !page_->callback_ns_max.compare_exchange_weak(max_ns, ns, std::memory_order_relaxed)) {
+        }
+        page_->update_time.store(x::RawDateTime(), std::memory_order_relaxed);
+    }
+
+    string CTPMetrics::ToString() {
+        auto v = [&](std::atomic<int64_t> CTPMetricsPage::*counter) {
+            return (page_->*counter).load(std::memory_order_relaxed);
+        };
+        int64_t callbacks = v(&CTPMetricsPage::callbacks);
+        stringstream ss;
+        ss << "[CTPMetrics] orders_sent=" << v(&CTPMetricsPage::orders_sent)
+            << ", order_send_failures=" << v(&CTPMetricsPage::order_send_failures)
+            << ", order_rejects=" << v(&CTPMetricsPage::order_rejects)
+            << ", withdraws_sent=" << v(&CTPMetricsPage::withdraws_sent)
+            << ", withdraw_failures=" << v(&CTPMetricsPage::withdraw_failures)
+            << ", withdraw_rejects=" << v(&CTPMetricsPage::withdraw_rejects)
+            << ", order_updates=" << v(&CTPMetricsPage::order_updates)
+            << ", knocks=" << v(&CTPMetricsPage::knocks)
+            << ", flow_control_hits=" << v(&CTPMetricsPage::flow_control_hits)
+            << ", front_connects=" << v(&CTPMetricsPage::front_connects)
+            << ", front_disconnects=" << v(&CTPMetricsPage::front_disconnects)
+            << ", queries_sent=" << v(&CTPMetricsPage::queries_sent)
+            << ", queries_pending=" << v(&CTPMetricsPage::queries_sent) - v(&CTPMetricsPage::queries_done)
+            << ", query_waiting=" << v(&CTPMetricsPage::query_waiting)
+            << ", callbacks=" << callbacks
+            << ", callback_avg_ns=" << (callbacks > 0 ? v(&CTPMetricsPage::callback_ns_total) / callbacks : 0)
+            << ", callback_max_ns=" << v(&CTPMetricsPage::callback_ns_max)
+            << ", requests_queued=" << v(&CTPMetricsPage::requests_queued)
+            << ", front_switches=" << v(&CTPMetricsPage::front_switches);
+        return ss.str();
+    }
+}  // namespace co
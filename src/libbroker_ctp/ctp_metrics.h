@@ -0,0 +1,95 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <x/x.h>
+
+using namespace std;
+
+namespace co {
+    constexpr int64_t kCTPMetricsVersion = 3;
+
+    /**
+     * 指标页，固定布局，所有计数器均为int64，外部程序按偏移直接读取
+     * 计数器只增不减；标记为gauge的是当前值
+     */
+struct CTPMetricsPage {
+    char magic[8];  // "CTPMETR"
+    int64_t version;
+    int64_t size;  // sizeof(CTPMetricsPage)
+    int64_t pid;
+    int64_t start_time;  // 启动时间，YYYYMMDDhhmmssSSS
+    std::atomic<int64_t> update_time;  // 最近一次更新计数器的时间，YYYYMMDDhhmmssSSS
+    std::atomic<int64_t> orders_sent;  // ReqOrderInsert成功发送的委托数
+    std::atomic<int64_t> order_send_failures;  // ReqOrderInsert返回失败的委托数
+    std::atomic<int64_t> order_rejects;  // CTP或交易所拒绝的委托数（OnRspOrderInsert、OnErrRtnOrderInsert）
+    std::atomic<int64_t> withdraws_sent;  // ReqOrderAction成功发送的撤单数
+    std::atomic<int64_t> withdraw_failures;  // ReqOrderAction返回失败的撤单数
+    std::atomic<int64_t> withdraw_rejects;  // CTP或交易所拒绝的撤单数（OnRspOrderAction、OnErrRtnOrderAction）
+    std::atomic<int64_t> order_updates;  // OnRtnOrder次数
+    std::atomic<int64_t> knocks;  // OnRtnTrade次数
+    std::atomic<int64_t> flow_control_hits;  // 请求返回-2、-3（流控）的次数
+    std::atomic<int64_t> front_connects;  // OnFrontConnected次数，大于1表示发生过重连
+    std::atomic<int64_t> front_disconnects;  // OnFrontDisconnected次数
+    std::atomic<int64_t> queries_sent;  // 发出的查询数
+    std::atomic<int64_t> queries_done;  // 已完成的查询数，queries_sent - queries_done为在途查询数
+    std::atomic<int64_t> query_waiting;  // gauge，正在等待查询流控的线程数
+    std::atomic<int64_t> callbacks;  // 计时的回调次数（OnRtnOrder、OnRtnTrade）
+    std::atomic<int64_t> callback_ns_total;  // 回调处理总耗时，纳秒
+    std::atomic<int64_t> callback_ns_max;  // 回调处理最大耗时，纳秒
+    std::atomic<int64_t> requests_queued;  // 因本地流控排队的报单与撤单数（version 2）
+    std::atomic<int64_t> front_switches;  // 断线后切换到其他交易前置的次数（version 3）
+};
+
+    /**
+     * 柜台指标
+     * 指标页映射到<mem_dir>/ctp_metrics_<investor_id>.dat，由各线程用relaxed原子操作更新，外部采集程序只读映射，不影响交易路径；
+     * 没有配置mem_dir或映射失败时使用进程内的指标页。
+     */
+class CTPMetrics {
+ public:
+    static CTPMetrics* Instance();
+
+    bool Open(const string& mem_dir, const string& investor_id);
+
+    inline CTPMetricsPage* page() {
+        return page_;
+    }
+
+    inline void Add(std::atomic<int64_t> CTPMetricsPage::*counter, int64_t value = 1) {
+        (page_->*counter).fetch_add(value, std::memory_order_relaxed);
+    }
+
+    void AddCallback(int64_t ns);  // 记录一次回调耗时
+
+    string ToString();  // 文本格式，供运维查看
+
+ protected:
+    CTPMetrics();
+    ~CTPMetrics() = default;
+    CTPMetrics(const CTPMetrics&) = delete;
+    const CTPMetrics& operator=(const CTPMetrics&) = delete;
+
+    void Reset();
+
+ private:
+    static CTPMetrics* instance_;
+    CTPMetricsPage local_page_;
+    CTPMetricsPage* page_ = nullptr;
+};
+
+    /**
+     * 回调计时，析构时记录耗时
+     */
+class CTPCallbackTimer {
+ public:
+    CTPCallbackTimer(): start_(std::chrono::steady_clock::now()) {}
+    ~CTPCallbackTimer() {
+        int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_).count();
+        CTPMetrics::Instance()->AddCallback(ns);
+    }
+
+ private:
+    std::chrono::steady_clock::time_point start_;
+};
+}  // namespace co
@@ -0,0 +1,224 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#include <boost/filesystem.hpp>
+#include "ctp_order_session.h"
+#include "ctp_front.h"
+#include "ctp_trade_spi.h"
+
+namespace co {
+    CTPOrderSession::CTPOrderSession(CTPTradeSpi* owner, const CTPAccount& account, int index)
+        : CThostFtdcTraderSpi(), owner_(owner), account_(account), index_(index) {
+        recent_.resize(kCTPOrderSessionRecentSize);
+        flow_control_.Init(Config::Instance()->ctp_order_rate_limit(), Config::Instance()->ctp_order_queue_size(),
+            [this](CTPFlowRequest& req) {
+                Remember(req);  // 发送前记下，OnRspError可能先于发送返回到达
+                std::shared_lock<std::shared_mutex> lock(api_mutex_);
+                return owner_->SendFlowRequest(req, api_.load(), front_id_, session_id_);
+            },
+            std::bind(&CTPTradeSpi::OnFlowRequestFailed, owner_, std::placeholders::_1, std::placeholders::_2));
+    }
+
+    CTPOrderSession::~CTPOrderSession() {
+        flow_control_.Stop();  // 先停止发送线程，之后不再使用api_
+        {
+            std::unique_lock<std::mutex> lock(front_mutex_);
+            stopping_ = true;
+        }
+        front_cv_.notify_all();
+        if (thread_ && thread_->joinable()) {
+            thread_->join();
+        }
+        CThostFtdcTraderApi* api = api_.exchange(nullptr);
+        if (api) {
+            api->RegisterSpi(nullptr);
+            api->Release();
+        }
+    }
+
+    void CTPOrderSession::Start() {
+        // 在调用线程中创建，SDK的内部线程继承调用线程的CPU绑定和优先级
+        thread_ = std::make_shared<std::thread>(std::bind(&CTPOrderSession::Run, this));
+        LOG_INFO << "start ctp order session: investor_id = " << account_.investor_id << ", index = " << index_;
+    }
+
+    void CTPOrderSession::Run() {
+        const vector<string>& addrs = account_.trade_fronts;
+        vector<CTPFrontProbe> fronts;
+        if (addrs.size() > 1) {
+            fronts = ProbeFronts(addrs, 3, 1000);
+        } else {
+            CTPFrontProbe probe;
+            probe.front = addrs.empty() ? "" : addrs.front();
+            fronts.push_back(probe);
+        }
+        // 每个会话使用单独的流文件目录
+        string flow_path = "ctp_flow_" + account_.investor_id + "_" + std::to_string(index_) + "/";
+        boost::filesystem::create_directories(flow_path);
+        size_t front_index = 0;
+        while (true) {
+            string addr = fronts[front_index].front;
+            LOG_INFO << "[order session " << index_ << "] use ctp trade front: " << addr << ", rtt = " << fronts[front_index].rtt_us << "us";
+            CThostFtdcTraderApi* api = CThostFtdcTraderApi::CreateFtdcTraderApi(flow_path.c_str());
+            CThostFtdcTraderApi* old_api = nullptr;
+            {
+                std::unique_lock<std::shared_mutex> lock(api_mutex_);  // 返回时已没有使用旧API发送的请求
+                old_api = api_.exchange(api);
+            }
+            {
+                std::unique_lock<std::mutex> lock(front_mutex_);
+                front_disconnected_ = false;
+            }
+            api->RegisterSpi(this);
+            api->RegisterFront((char*)addr.c_str());
+            api->SubscribePublicTopic(THOST_TERT_NONE);
+            api->SubscribePrivateTopic(THOST_TERT_NONE);
+            api->Init();
+            if (old_api) {
+                old_api->Release();
+            }
+            {
+                // 只有一个前置时由SDK自动重连，这里只等待退出
+                std::unique_lock<std::mutex> lock(front_mutex_);
+                front_cv_.wait(lock, [&] { return stopping_ || (fronts.size() > 1 && front_disconnected_); });
+                if (stopping_) {
+                    return;
+                }
+            }
+            api->RegisterSpi(nullptr);  // 旧前置不再回调，避免SDK在后台重连成功后重复登录
+            // 重新探测，优先选择当前断开的前置之外耗时最小的前置
+            fronts = ProbeFronts(addrs, 3, 1000);
+            front_index = fronts[0].front == addr ? 1 : 0;
+            LOG_WARN << "[order session " << index_ << "] switch ctp trade front: " << addr << " -> " << fronts[front_index].front;
+        }
+    }
+
+    int CTPOrderSession::Send(CTPFlowRequest& req) {
+        return flow_control_.Send(req);
+    }
+
+    vector<CTPFlowRequest> CTPOrderSession::Remove(const std::function<bool(const CTPFlowRequest&)>& match) {
+        return flow_control_.Remove(match);
+    }
+
+    void CTPOrderSession::Remember(const CTPFlowRequest& req) {
+        std::unique_lock<std::mutex> lock(recent_mutex_);
+        recent_[(unsigned int)req.request_id % kCTPOrderSessionRecentSize] = req;
+    }
+
+    bool CTPOrderSession::FindRecent(int request_id, CTPFlowRequest* req) {
+        std::unique_lock<std::mutex> lock(recent_mutex_);
+        const CTPFlowRequest& r = recent_[(unsigned int)request_id % kCTPOrderSessionRecentSize];
+        if (request_id == 0 || r.request_id != request_id) {
+            return false;
+        }
+        *req = r;
+        return true;
+    }
+
+    void CTPOrderSession::OnFrontConnected() {
+        LOG_INFO << "[order session " << index_ << "] connect to CTP trade server ok";
+        if (!account_.app_id.empty()) {
+            ReqAuthenticate();
+        } else {
+            ReqUserLogin();
+        }
+    }
+
+    void CTPOrderSession::OnFrontDisconnected(int nReason) {
+        ready_ = false;
+        LOG_WARN << "[order session " << index_ << "] connection is broken: ret=" << nReason;
+        {
+            std::unique_lock<std::mutex> lock(front_mutex_);
+            front_disconnected_ = true;
+        }
+        front_cv_.notify_all();
+    }
+
+    void CTPOrderSession::ReqAuthenticate() {
+        CThostFtdcReqAuthenticateField req;
+        memset(&req, 0, sizeof(req));
+        strcpy(req.BrokerID, account_.broker_id.c_str());
+        strcpy(req.UserID, account_.investor_id.c_str());
+        strcpy(req.AppID, account_.app_id.c_str());
+        strcpy(req.UserProductInfo, account_.product_info.c_str());
+        strcpy(req.AuthCode, account_.auth_code.c_str());
+        int rc = 0;
+        while ((rc = api_.load()->ReqAuthenticate(&req, auth_request_id_ = owner_->GetRequestID())) != 0) {
+            LOG_WARN << "[order session " << index_ << "] ReqAuthenticate failed: " << CtpApiError(rc) << ", retring ...";
+            x::Sleep(CTP_FLOW_CONTROL_MS);
+        }
+    }
+
+    void CTPOrderSession::ReqUserLogin() {
+        CThostFtdcReqUserLoginField req;
+        memset(&req, 0, sizeof(req));
+        strcpy(req.BrokerID, account_.broker_id.c_str());
+        strcpy(req.UserID, account_.investor_id.c_str());
+        strcpy(req.Password, account_.password.c_str());
+        int rc = 0;
+        while ((rc = api_.load()->ReqUserLogin(&req, login_request_id_ = owner_->GetRequestID())) != 0) {
+            LOG_WARN << "[order session " << index_ << "] ReqUserLogin failed: " << CtpApiError(rc) << ", retring ...";
+            x::Sleep(CTP_FLOW_CONTROL_MS);
+        }
+    }
+
+    void CTPOrderSession::OnRspAuthenticate(CThostFtdcRspAuthenticateField* pRspAuthenticateField, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        if (pRspInfo == NULL || pRspInfo->ErrorID == 0) {
+            ReqUserLogin();
+        } else {
+            LOG_ERROR << "[order session " << index_ << "] authenticate failed: " << CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
+        }
+    }
+
+    void CTPOrderSession::OnRspUserLogin(CThostFtdcRspUserLoginField* pRspUserLogin, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        if (pRspInfo == NULL || pRspInfo->ErrorID == 0) {
+            front_id_ = pRspUserLogin->FrontID;
+            session_id_ = pRspUserLogin->SessionID;
+            ready_ = true;
+            LOG_INFO << "[order session " << index_ << "] login ok: front_id = " << front_id_ << ", session_id = " << session_id_;
+        } else {
+            LOG_ERROR << "[order session " << index_ << "] login failed: " << CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
+        }
+    }
+
+    void CTPOrderSession::OnRspOrderInsert(CThostFtdcInputOrderField* pInputOrder, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        owner_->OnRspOrderInsert(pInputOrder, pRspInfo, nRequestID, bIsLast);
+    }
+
+    void CTPOrderSession::OnRspOrderAction(CThostFtdcInputOrderActionField* pInputOrderAction, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        owner_->OnRspOrderAction(pInputOrderAction, pRspInfo, nRequestID, bIsLast);
+    }
+
+    void CTPOrderSession::OnRspBatchOrderAction(CThostFtdcInputBatchOrderActionField* pInputBatchOrderAction, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        owner_->OnRspBatchOrderAction(pInputBatchOrderAction, pRspInfo, nRequestID, bIsLast);
+    }
+
+    void CTPOrderSession::OnRspError(CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        if (!pRspInfo) {
+            return;
+        }
+        LOG_ERROR << "[order session " << index_ << "] OnRspError: request_id = " << nRequestID
+            << ", ret=" << pRspInfo->ErrorID << ", msg=" << CtpToUTF8(pRspInfo->ErrorMsg);
+        if (nRequestID != 0 && (nRequestID == auth_request_id_ || nRequestID == login_request_id_)) {
+            // 认证或登录出错时重试，与主会话启动时的处理相同
+            x::Sleep(CTP_FLOW_CONTROL_MS);
+            if (nRequestID == auth_request_id_) {
+                ReqAuthenticate();
+            } else {
+                ReqUserLogin();
+            }
+            return;
+        }
+        // 报单、撤单的错误按对应的响应转交主会话，回报错误并撤回内部持仓的冻结
+        CTPFlowRequest req;
+        if (!FindRecent(nRequestID, &req)) {
+            return;
+        }
+        if (req.batch) {
+            owner_->OnRspBatchOrderAction(&req.batch_action, pRspInfo, nRequestID, bIsLast);
+        } else if (req.withdraw) {
+            owner_->OnRspOrderAction(&req.action, pRspInfo, nRequestID, bIsLast);
+        } else {
+            owner_->OnRspOrderInsert(&req.order, pRspInfo, nRequestID, bIsLast);
+        }
+    }
+}  // namespace co
@@ -0,0 +1,88 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <shared_mutex>
+#include <string>
+#include "ctp_support.h"
+#include "config.h"
+#include "ctp_flow_control.h"
+
+using namespace std;
+
+namespace co {
+class CTPTradeSpi;
+
+    constexpr int kCTPOrderSessionRecentSize = 256;  // 报单会话保存的最近发出请求数，按request_id取模存放
+
+    /**
+     * 报单会话
+     * 同一资金账号的额外会话，只用于分担报单和撤单（CTP按会话限制每秒的报单笔数）：
+     * 1.不订阅私有流和公共流，委托和成交回报仍由主会话的私有流统一处理，内部持仓只在主会话中维护；
+     * 2.每个会话有自己的本地流控，报单引用使用主会话的请求编号，在各会话内同样递增；
+     * 3.本会话返回的OnRspOrderInsert、OnRspOrderAction、OnRspBatchOrderAction转交主会话处理，
+     *   OnRspError按request_id找回最近发出的请求后按对应的响应转交，主会话持有callback_mutex_串行处理；
+     * 4.前置与主会话一样按建连耗时排序，只连接耗时最小的前置，断线时重新探测并切换到下一个前置，只有一个前置时由SDK自动重连；
+     * 5.断线期间不参与分配，重新登录后恢复。
+     */
+class CTPOrderSession : public CThostFtdcTraderSpi {
+ public:
+    CTPOrderSession(CTPTradeSpi* owner, const CTPAccount& account, int index);
+    virtual ~CTPOrderSession();
+    CTPOrderSession(const CTPOrderSession&) = delete;
+    const CTPOrderSession& operator=(const CTPOrderSession&) = delete;
+
+    void Start();
+
+    int Send(CTPFlowRequest& req);  // 经本会话的流控发送
+    vector<CTPFlowRequest> Remove(const std::function<bool(const CTPFlowRequest&)>& match);  // 取出本会话仍在排队的请求
+
+    inline bool ready() const {
+        return ready_.load();
+    }
+
+    inline int64_t front_id() const {
+        return front_id_.load();
+    }
+
+    inline int64_t session_id() const {
+        return session_id_.load();
+    }
+
+    virtual void OnFrontConnected();
+    virtual void OnFrontDisconnected(int nReason);
+    virtual void OnRspAuthenticate(CThostFtdcRspAuthenticateField *pRspAuthenticateField, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
+    virtual void OnRspUserLogin(CThostFtdcRspUserLoginField *pRspUserLogin, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
+    virtual void OnRspOrderInsert(CThostFtdcInputOrderField *pInputOrder, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
+    virtual void OnRspOrderAction(CThostFtdcInputOrderActionField *pInputOrderAction, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
+    virtual void OnRspBatchOrderAction(CThostFtdcInputBatchOrderActionField *pInputBatchOrderAction, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
+    virtual void OnRspError(CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
+
+ protected:
+    void Run();  // 按建连耗时依次连接前置，断线时切换
+    void ReqAuthenticate();
+    void ReqUserLogin();
+    void Remember(const CTPFlowRequest& req);  // 记下要发出的请求，OnRspError时找回
+    bool FindRecent(int request_id, CTPFlowRequest* req);
+
+ private:
+    CTPTradeSpi* owner_ = nullptr;
+    CTPAccount account_;
+    int index_ = 0;
+    std::atomic<CThostFtdcTraderApi*> api_ {nullptr};
+    std::shared_mutex api_mutex_;  // 流控线程发送时持有共享锁，切换前置时持有独占锁
+    CTPFlowControl flow_control_;
+    std::shared_ptr<std::thread> thread_;
+    std::mutex front_mutex_;
+    std::condition_variable front_cv_;
+    bool front_disconnected_ = false;  // front_mutex_保护
+    bool stopping_ = false;  // front_mutex_保护
+    std::atomic_bool ready_ {false};
+    std::atomic<int64_t> front_id_ {0};
+    std::atomic<int64_t> session_id_ {0};
+    std::atomic<int> auth_request_id_ {0};
+    std::atomic<int> login_request_id_ {0};
+    std::mutex recent_mutex_;
+    vector<CTPFlowRequest> recent_;  // 最近发出的请求，recent_mutex_保护
+};
+}  // namespace co
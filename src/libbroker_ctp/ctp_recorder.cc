@@ -0,0 +1,289 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#include <algorithm>
+#include <chrono>
+#include <set>
+#include <thread>
+#include <boost/filesystem.hpp>
+#include "ctp_recorder.h"
+#include "ctp_trade_spi.h"
+
+namespace co {
+    static_assert(sizeof(CTPRecordHeader) % 8 == 0, "record header must be 8 bytes aligned");
+    static_assert(sizeof(CTPEventHeader) + sizeof(CTPRecordHeader) + sizeof(CThostFtdcRspInfoField) + sizeof(CThostFtdcOrderField) <= kCTPEventSlotSize, "event slot too small");
+
+    static const char* kCTPCallbackNames[] = {
+        "", "OnFrontConnected", "OnFrontDisconnected", "OnRspAuthenticate", "OnRspUserLogin", "OnRspUserLogout",
+        "OnRspSettlementInfoConfirm", "OnRspQryInstrument", "OnRspQryTradingAccount", "OnRspQryInvestorPosition",
+        "OnRspQryInvestorPositionDetail", "OnRspQryOrder", "OnRspQryTrade", "OnRspOrderInsert", "OnErrRtnOrderInsert",
+        "OnRspOrderAction", "OnErrRtnOrderAction", "OnRtnOrder", "OnRtnTrade", "OnRspError",
+        "OnRspBatchOrderAction", "OnErrRtnBatchOrderAction", "OnRspParkedOrderInsert", "OnRspParkedOrderAction",
+        "OnRspRemoveParkedOrder", "OnRtnInstrumentStatus", "OnRspQryDepthMarketData"
+    };
+
+    static int64_t NowNs() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    CTPRecorder* CTPRecorder::instance_ = new CTPRecorder();
+
+    CTPRecorder* CTPRecorder::Instance() {
+        return instance_;
+    }
+
+    bool CTPRecorder::Start(const string& dir) {
+        if (dir.empty()) {
+            return false;
+        }
+        boost::filesystem::create_directories(dir);
+        string file = dir + "/ctp_record_" + std::to_string(x::RawDateTime()) + ".dat";
+        FILE* fp = fopen(file.c_str(), "wb");
+        if (!fp) {
+            LOG_ERROR << "open ctp record file failed: " << file;
+            return false;
+        }
+        CTPRecordFileHeader header;
+        header.order_field_size = sizeof(CThostFtdcOrderField);
+        header.trade_field_size = sizeof(CThostFtdcTradeField);
+        strncpy(header.api_version, CThostFtdcTraderApi::GetApiVersion(), sizeof(header.api_version) - 1);
+        fwrite(&header, sizeof(header), 1, fp);
+        CTPEventLog::Instance()->set_record_file(fp);
+        LOG_INFO << "open ctp record file ok: " << file;
+        return true;
+    }
+
+    void CTPRecorder::Write(const string& investor_id, int32_t callback, const void* data, int32_t length, const CThostFtdcRspInfoField* rsp_info, int request_id, bool is_last, int reason) {
+        char buffer[kCTPEventSlotSize];
+        CTPRecordHeader* header = new (buffer) CTPRecordHeader();
+        strncpy(header->investor_id, investor_id.c_str(), sizeof(header->investor_id) - 1);
+        header->callback = callback;
+        header->request_id = request_id;
+        header->reason = reason;
+        header->is_last = is_last ? 1 : 0;
+        header->has_rsp_info = rsp_info ? 1 : 0;
+        header->data_length = length;
+        header->reserved = 0;
+        header->timestamp = NowNs();
+        char* p = buffer + sizeof(CTPRecordHeader);
+        if (rsp_info) {
+            memcpy(p, rsp_info, sizeof(CThostFtdcRspInfoField));
+            p += sizeof(CThostFtdcRspInfoField);
+        }
+        if (length > 0) {
+            memcpy(p, data, length);
+            p += length;
+        }
+        CTPEventLog::Instance()->Write(kCTPEventCallback, buffer, (int32_t)(p - buffer));
+    }
+
+    void CTPReplayer::AddSpi(const string& investor_id, CTPTradeSpi* spi) {
+        spis_[investor_id] = spi;
+    }
+
+    CTPTradeSpi* CTPReplayer::GetSpi(const CTPRecordHeader& header) {
+        auto it = spis_.find(header.investor_id);
+        return it != spis_.end() ? it->second : nullptr;
+    }
+
+    bool CTPReplayer::Open(const string& file) {
+        FILE* fp = fopen(file.c_str(), "rb");
+        if (!fp) {
+            LOG_ERROR << "open ctp record file failed: " << file;
+            return false;
+        }
+        fseek(fp, 0, SEEK_END);
+        int64_t size = ftell(fp);
+        fseek(fp, 0, SEEK_SET);
+        data_.resize(size > 0 ? size : 0);
+        size_t n = size > 0 ? fread(data_.data(), 1, size, fp) : 0;
+        fclose(fp);
+        if ((int64_t)n != size || size < (int64_t)sizeof(CTPRecordFileHeader)) {
+            LOG_ERROR << "read ctp record file failed: " << file;
+            return false;
+        }
+        const CTPRecordFileHeader* header = reinterpret_cast<const CTPRecordFileHeader*>(data_.data());
+        if (strcmp(header->magic, "CTPREC") != 0 || header->version != kCTPRecordVersion) {
+            LOG_ERROR << "illegal ctp record file: " << file;
+            return false;
+        }
+        if (header->order_field_size != (int32_t)sizeof(CThostFtdcOrderField) || header->trade_field_size != (int32_t)sizeof(CThostFtdcTradeField)) {
+            LOG_ERROR << "ctp version mismatch: recorded by " << header->api_version << ", replay with " << CThostFtdcTraderApi::GetApiVersion();
+            return false;
+        }
+        // 各线程的记录由后台线程按线程分别取出，按到达时间稳定排序后还原回调顺序，同一线程的记录保持原有顺序
+        records_.clear();
+        std::set<string> investor_ids;
+        size_t pos = sizeof(CTPRecordFileHeader);
+        while (pos + sizeof(CTPRecordHeader) <= data_.size()) {
+            const CTPRecordHeader* record = reinterpret_cast<const CTPRecordHeader*>(&data_[pos]);
+            size_t length = sizeof(CTPRecordHeader) + (record->has_rsp_info ? sizeof(CThostFtdcRspInfoField) : 0) + record->data_length;
+            if (record->data_length < 0 || pos + length > data_.size()) {
+                LOG_ERROR << "ctp record file is truncated at: " << pos;
+                return false;
+            }
+            records_.push_back(pos);
+            investor_ids.insert(record->investor_id);
+            pos += length;
+        }
+        if (pos != data_.size()) {
+            LOG_ERROR << "ctp record file is truncated at: " << pos;
+            return false;
+        }
+        std::stable_sort(records_.begin(), records_.end(), [this](size_t a, size_t b) {
+            return reinterpret_cast<const CTPRecordHeader*>(&data_[a])->timestamp < reinterpret_cast<const CTPRecordHeader*>(&data_[b])->timestamp;
+        });
+        investor_ids_.assign(investor_ids.begin(), investor_ids.end());
+        LOG_INFO << "open ctp record file ok: " << file << ", size = " << size << ", records = " << records_.size()
+            << ", investors = " << investor_ids_.size() << ", api_version = " << header->api_version;
+        return true;
+    }
+
+    int64_t CTPReplayer::Run(bool realtime) {
+        int64_t count = 0;
+        int64_t first_timestamp = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t pos : records_) {
+            CTPRecordHeader* header = reinterpret_cast<CTPRecordHeader*>(&data_[pos]);
+            CTPTradeSpi* spi = GetSpi(*header);
+            if (!spi) {
+                ++skipped_;
+                continue;
+            }
+            char* p = &data_[pos] + sizeof(CTPRecordHeader);
+            CThostFtdcRspInfoField* rsp_info = nullptr;
+            if (header->has_rsp_info) {
+                rsp_info = reinterpret_cast<CThostFtdcRspInfoField*>(p);
+                p += sizeof(CThostFtdcRspInfoField);
+            }
+            if (realtime) {
+                if (first_timestamp == 0) {
+                    first_timestamp = header->timestamp;
+                }
+                std::this_thread::sleep_until(start + std::chrono::nanoseconds(header->timestamp - first_timestamp));
+            }
+            auto begin = std::chrono::steady_clock::now();
+            Dispatch(spi, *header, rsp_info, header->data_length > 0 ? p : nullptr);
+            int64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+            CTPReplayStat& stat = stats_[header->callback];
+            ++stat.count;
+            stat.total_ns += ns;
+            stat.max_ns = std::max(stat.max_ns, ns);
+            total_ns_ += ns;
+            ++count;
+        }
+        LOG_INFO << "replay ctp callbacks ok: count = " << count << ", skipped = " << skipped_;
+        return count;
+    }
+
+    template<typename T>
+    static T* RecordData(const CTPRecordHeader& header, char* data) {
+        if (!data || header.data_length != (int32_t)sizeof(T)) {
+            return nullptr;
+        }
+        return reinterpret_cast<T*>(data);
+    }
+
+    void CTPReplayer::Dispatch(CTPTradeSpi* spi, const CTPRecordHeader& header, CThostFtdcRspInfoField* rsp_info, char* data) {
+        int id = header.request_id;
+        bool last = header.is_last != 0;
+        switch (header.callback) {
+        case kCTPCallbackFrontConnected:
+            spi->OnFrontConnected();
+            break;
+        case kCTPCallbackFrontDisconnected:
+            spi->OnFrontDisconnected(header.reason);
+            break;
+        case kCTPCallbackRspAuthenticate:
+            spi->OnRspAuthenticate(RecordData<CThostFtdcRspAuthenticateField>(header, data), rsp_info, id, last);
+            break;
+        case kCTPCallbackRspUserLogin:
+            spi->OnRspUserLogin(RecordData<CThostFtdcRspUserLoginField>(header, data), rsp_info, id, last);
+            break;
+        case kCTPCallbackRspUserLogout:
+            spi->OnRspUserLogout(RecordData<CThostFtdcUserLogoutField>(header, data), rsp_info, id, last);
+            break;
+        case kCTPCallbackRspSettlementInfoConfirm:
+            spi->OnRspSettlementInfoConfirm(RecordData<CThostFtdcSettlementInfoConfirmField>(header, data), rsp_info, id, last);
+            break;
+        case kCTPCallbackRspQryInstrument:
+            spi->OnRspQryInstrument(RecordData<CThostFtdcInstrumentField>(header, data), rsp_info, id, last);
+            break;
+        case kCTPCallbackRspQryTradingAccount:
+            spi->OnRspQryTradingAccount(RecordData<CThostFtdcTradingAccountField>(header, data), rsp_info, id, last);
+            break;
+        case kCTPCallbackRspQryInvestorPosition:
+            spi->OnRspQryInvestorPosition(RecordData<CThostFtdcInvestorPositionField>(header, data), rsp_info, id, last);
+            break;
+        case kCTPCallbackRspQryInvestorPositionDetail:
+            spi->OnRspQryInvestorPositionDetail(RecordData<CThostFtdcInvestorPositionDetailField>(header, data), rsp_info, id, last);
+            break;
+        case kCTPCallbackRspQryOrder:
+            spi->OnRspQryOrder(RecordData<CThostFtdcOrderField>(header, data), rsp_info, id, last);
+            break;
+        case kCTPCallbackRspQryTrade:
+            spi->OnRspQryTrade(RecordData<CThostFtdcTradeField>(header, data), rsp_info, id, last);
+            break;
+        case kCTPCallbackRspOrderInsert:
+            spi->OnRspOrderInsert(RecordData<CThostFtdcInputOrderField>(header, data), rsp_info, id, last);
+            break;
+        case kCTPCallbackErrRtnOrderInsert:
+            spi->OnErrRtnOrderInsert(RecordData<CThostFtdcInputOrderField>(header, data), rsp_info);
+            break;
+        case kCTPCallbackRspOrderAction:
+            spi->OnRspOrderAction(RecordData<CThostFtdcInputOrderActionField>(header, data), rsp_info, id, last);
+            break;
+        case kCTPCallbackErrRtnOrderAction:
+            spi->OnErrRtnOrderAction(RecordData<CThostFtdcOrderActionField>(header, data), rsp_info);
+            break;
+        case kCTPCallbackRtnOrder:
+            spi->OnRtnOrder(RecordData<CThostFtdcOrderField>(header, data));
+            break;
+        case kCTPCallbackRtnTrade:
+            spi->OnRtnTrade(RecordData<CThostFtdcTradeField>(header, data));
+            break;
+        case kCTPCallbackRspError:
+            spi->OnRspError(rsp_info, id, last);
+            break;
+        case kCTPCallbackRspBatchOrderAction:
+            spi->OnRspBatchOrderAction(RecordData<CThostFtdcInputBatchOrderActionField>(header, data), rsp_info, id, last);
+            break;
+        case kCTPCallbackErrRtnBatchOrderAction:
+            spi->OnErrRtnBatchOrderAction(RecordData<CThostFtdcBatchOrderActionField>(header, data), rsp_info);
+            break;
+        case kCTPCallbackRspParkedOrderInsert:
+            spi->OnRspParkedOrderInsert(RecordData<CThostFtdcParkedOrderField>(header, data), rsp_info, id, last);
+            break;
+        case kCTPCallbackRspParkedOrderAction:
+            spi->OnRspParkedOrderAction(RecordData<CThostFtdcParkedOrderActionField>(header, data), rsp_info, id, last);
+            break;
+        case kCTPCallbackRspRemoveParkedOrder:
+            spi->OnRspRemoveParkedOrder(RecordData<CThostFtdcRemoveParkedOrderField>(header, data), rsp_info, id, last);
+            break;
+        case kCTPCallbackRtnInstrumentStatus:
+            spi->OnRtnInstrumentStatus(RecordData<CThostFtdcInstrumentStatusField>(header, data));
+            break;
+        case kCTPCallbackRspQryDepthMarketData:
+            spi->OnRspQryDepthMarketData(RecordData<CThostFtdcDepthMarketDataField>(header, data), rsp_info, id, last);
+            break;
+        default:
+            LOG_WARN << "unknown ctp callback in record file: " << header.callback;
+            break;
+        }
+    }
+
+    string CTPReplayer::ToString() {
+        stringstream ss;
+        int64_t count = 0;
+        for (auto& it : stats_) {
+            const CTPReplayStat& stat = it.second;
+            int32_t callback = it.first;
+            const char* name = callback > 0 && callback < (int32_t)(sizeof(kCTPCallbackNames) / sizeof(kCTPCallbackNames[0])) ? kCTPCallbackNames[callback] : "Unknown";
+            ss << name << ": count = " << stat.count
+                << ", avg_ns = " << (stat.count > 0 ? stat.total_ns / stat.count : 0)
+                << ", max_ns = " << stat.max_ns << endl;
+            count += stat.count;
+        }
+        ss << "total: count = " << count << ", skipped = " << skipped_ << ", total_ns = " << total_ns_
+            << ", callbacks_per_second = " << (total_ns_ > 0 ? count * 1000000000LL / total_ns_ : 0);
+        return ss.str();
+    }
+}  // namespace co
@@ -0,0 +1,158 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#pragma once
+#include <map>
+#include <unordered_map>
+#include <x/x.h>
+#include "ThostFtdcTraderApi.h"
+#include "ctp_event_log.h"
+
+using namespace std;
+
+namespace co {
+    class CTPTradeSpi;
+
+    // CTPTradeSpi的回调编号，与回放文件中的CTPRecordHeader::callback对应，只能追加不能修改
+    constexpr int32_t kCTPCallbackFrontConnected = 1;
+    constexpr int32_t kCTPCallbackFrontDisconnected = 2;
+    constexpr int32_t kCTPCallbackRspAuthenticate = 3;
+    constexpr int32_t kCTPCallbackRspUserLogin = 4;
+    constexpr int32_t kCTPCallbackRspUserLogout = 5;
+    constexpr int32_t kCTPCallbackRspSettlementInfoConfirm = 6;
+    constexpr int32_t kCTPCallbackRspQryInstrument = 7;
+    constexpr int32_t kCTPCallbackRspQryTradingAccount = 8;
+    constexpr int32_t kCTPCallbackRspQryInvestorPosition = 9;
+    constexpr int32_t kCTPCallbackRspQryInvestorPositionDetail = 10;
+    constexpr int32_t kCTPCallbackRspQryOrder = 11;
+    constexpr int32_t kCTPCallbackRspQryTrade = 12;
+    constexpr int32_t kCTPCallbackRspOrderInsert = 13;
+    constexpr int32_t kCTPCallbackErrRtnOrderInsert = 14;
+    constexpr int32_t kCTPCallbackRspOrderAction = 15;
+    constexpr int32_t kCTPCallbackErrRtnOrderAction = 16;
+    constexpr int32_t kCTPCallbackRtnOrder = 17;
+    constexpr int32_t kCTPCallbackRtnTrade = 18;
+    constexpr int32_t kCTPCallbackRspError = 19;
+    constexpr int32_t kCTPCallbackRspBatchOrderAction = 20;
+    constexpr int32_t kCTPCallbackErrRtnBatchOrderAction = 21;
+    constexpr int32_t kCTPCallbackRspParkedOrderInsert = 22;
+    constexpr int32_t kCTPCallbackRspParkedOrderAction = 23;
+    constexpr int32_t kCTPCallbackRspRemoveParkedOrder = 24;
+    constexpr int32_t kCTPCallbackRtnInstrumentStatus = 25;
+    constexpr int32_t kCTPCallbackRspQryDepthMarketData = 26;
+
+    constexpr int32_t kCTPRecordVersion = 2;  // 2: CTPRecordHeader增加investor_id
+
+    /**
+     * 回放文件头，结构体按当前CTP版本的内存布局原样保存，回放时必须使用同一版本的CTP头文件
+     */
+struct CTPRecordFileHeader {
+    char magic[8] = "CTPREC";
+    int32_t version = kCTPRecordVersion;
+    int32_t order_field_size = 0;  // sizeof(CThostFtdcOrderField)，用于检查CTP版本是否一致
+    int32_t trade_field_size = 0;  // sizeof(CThostFtdcTradeField)
+    int32_t reserved = 0;
+    char api_version[64] = "";  // CThostFtdcTraderApi::GetApiVersion()
+};
+
+    /**
+     * 每个回调一条记录：CTPRecordHeader + [CThostFtdcRspInfoField] + [data_length字节的回调结构体]
+     */
+struct CTPRecordHeader {
+    int32_t callback = 0;  // kCTPCallbackXXX
+    int32_t request_id = 0;
+    int32_t reason = 0;  // OnFrontDisconnected的断线原因
+    int16_t is_last = 0;
+    int16_t has_rsp_info = 0;  // 是否带有CThostFtdcRspInfoField
+    int32_t data_length = 0;  // 回调结构体长度，0表示回调参数为空指针
+    int32_t reserved = 0;
+    int64_t timestamp = 0;  // 回调到达时间，纳秒（system_clock）
+    TThostFtdcInvestorIDType investor_id = "";  // 回调所属的资金账号，回放时按账号分发
+    char padding[3] = "";
+};
+
+    /**
+     * 回调录制
+     * 各回调入口把资金账号、原始结构体、请求编号和到达时间写入事件日志的环形缓冲区，由事件日志的后台线程写入
+     * <dir>/ctp_record_<datetime>.dat，不阻塞回调线程；缓冲区写满时转存到溢出队列，不会丢失记录；
+     * 没有配置ctp_record_dir时只多一次判断。
+     * 各线程的记录按线程分别取出，文件中不同线程的记录不保证按时间排序，回放时按到达时间重新排序。
+     */
+class CTPRecorder {
+ public:
+    static CTPRecorder* Instance();
+
+    bool Start(const string& dir);
+
+    inline bool recording() {
+        return CTPEventLog::Instance()->recording();
+    }
+
+    template<typename T>
+    inline void Record(const string& investor_id, int32_t callback, const T* data, const CThostFtdcRspInfoField* rsp_info = nullptr, int request_id = 0, bool is_last = true) {
+        if (recording()) {
+            Write(investor_id, callback, data, data ? (int32_t)sizeof(T) : 0, rsp_info, request_id, is_last, 0);
+        }
+    }
+
+    inline void RecordFront(const string& investor_id, int32_t callback, int reason = 0) {
+        if (recording()) {
+            Write(investor_id, callback, nullptr, 0, nullptr, 0, true, reason);
+        }
+    }
+
+ protected:
+    CTPRecorder() = default;
+    ~CTPRecorder() = default;
+    CTPRecorder(const CTPRecorder&) = delete;
+    const CTPRecorder& operator=(const CTPRecorder&) = delete;
+
+    void Write(const string& investor_id, int32_t callback, const void* data, int32_t length, const CThostFtdcRspInfoField* rsp_info, int request_id, bool is_last, int reason);
+
+ private:
+    static CTPRecorder* instance_;
+};
+
+struct CTPReplayStat {
+    int64_t count = 0;
+    int64_t total_ns = 0;
+    int64_t max_ns = 0;
+};
+
+    /**
+     * 离线回放
+     * 把回放文件整个读入内存，按到达时间排序后逐条调用记录中资金账号对应的CTPTradeSpi的回调，统计每种回调的次数与耗时；
+     * spi需要设置为回放模式，不向CTP发送请求，也不向客户端推送回报；没有对应spi的记录跳过。
+     */
+class CTPReplayer {
+ public:
+    bool Open(const string& file);
+
+    inline const vector<string>& investor_ids() const {  // 回放文件中出现的资金账号，Open之后有效
+        return investor_ids_;
+    }
+
+    void AddSpi(const string& investor_id, CTPTradeSpi* spi);
+
+    /**
+        * 回放全部记录
+        * @param realtime: true按录制时的时间间隔回放，false以最快速度回放
+        * @return 回放的回调数
+        */
+    int64_t Run(bool realtime);
+
+    string ToString();  // 各回调的次数、平均耗时、最大耗时
+
+ protected:
+    void Dispatch(CTPTradeSpi* spi, const CTPRecordHeader& header, CThostFtdcRspInfoField* rsp_info, char* data);
+
+    CTPTradeSpi* GetSpi(const CTPRecordHeader& header);
+
+ private:
+    std::unordered_map<string, CTPTradeSpi*> spis_;  // investor_id -> spi
+    vector<string> investor_ids_;
+    vector<char> data_;
+    vector<size_t> records_;  // 按到达时间排序的记录偏移
+    map<int32_t, CTPReplayStat> stats_;
+    int64_t total_ns_ = 0;
+    int64_t skipped_ = 0;  // 没有对应spi的记录数
+};
+}  // namespace co
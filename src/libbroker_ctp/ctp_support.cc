@@ -37,6 +37,10 @@ namespace co {
             ss << rc << "-flow control error";
             ret = ss.str();
             break;
+        case kCTPFlowQueueFull:
+            ss << rc << "-local flow control queue is full";
+            ret = ss.str();
+            break;
         default:
             ss << rc << "-unknown error";
             ret = ss.str();
@@ -68,6 +72,16 @@ namespace co {
         return Timestamp;
     }
 
+    string CtpOrderNo(TThostFtdcFrontIDType front_id, TThostFtdcSessionIDType session_id, int64_t order_ref, const char* instrument_id) {
+        string order_no;
+        order_no.reserve(64);
+        order_no.append(std::to_string(front_id)).append(1, '_')
+            .append(std::to_string(session_id)).append(1, '_')
+            .append(std::to_string(order_ref)).append(1, '_')
+            .append(instrument_id);
+        return order_no;
+    }
+
     int64_t ctp_time2std(TThostFtdcTimeType v) {
         string s = v;  // 15:00:01
         boost::algorithm::replace_all(s, ":", "");
@@ -436,7 +450,7 @@ namespace co {
     }
 
     TThostFtdcTimeConditionType order_time_condition2ctp(string v) {
-        TThostFtdcTimeConditionType ret;
+        TThostFtdcTimeConditionType ret = THOST_FTDC_TC_GFD;
         if (v.empty() || v == "General_Order") {  // ������Ч
             ret = THOST_FTDC_TC_GFD;
         } else if (v == "Automatically_Withdraw") {
@@ -447,6 +461,127 @@ namespace co {
         return ret;
     }
 
+    TThostFtdcTimeConditionType order_time_condition2ctp(int64_t v) {
+        TThostFtdcTimeConditionType ret = THOST_FTDC_TC_GFD;
+        switch (v) {
+        case kCTPTimeConditionGFD:
+            ret = THOST_FTDC_TC_GFD;
+            break;
+        case kCTPTimeConditionFAK:
+        case kCTPTimeConditionFOK:
+            ret = THOST_FTDC_TC_IOC;
+            break;
+        default:
+            LOG_ERROR << "unknown order_time_condition: " << v;
+            break;
+        }
+        return ret;
+    }
+
+    void parked_order2ctp(const CThostFtdcInputOrderField& order, CThostFtdcParkedOrderField* parked) {
+        memset(parked, 0, sizeof(*parked));
+        strcpy(parked->BrokerID, order.BrokerID);
+        strcpy(parked->InvestorID, order.InvestorID);
+        strcpy(parked->InstrumentID, order.InstrumentID);
+        strcpy(parked->OrderRef, order.OrderRef);
+        strcpy(parked->UserID, order.UserID);
+        strcpy(parked->ExchangeID, order.ExchangeID);
+        parked->OrderPriceType = order.OrderPriceType;
+        parked->Direction = order.Direction;
+        strcpy(parked->CombOffsetFlag, order.CombOffsetFlag);
+        strcpy(parked->CombHedgeFlag, order.CombHedgeFlag);
+        parked->LimitPrice = order.LimitPrice;
+        parked->VolumeTotalOriginal = order.VolumeTotalOriginal;
+        parked->TimeCondition = order.TimeCondition;
+        parked->VolumeCondition = order.VolumeCondition;
+        parked->MinVolume = order.MinVolume;
+        parked->ContingentCondition = order.ContingentCondition;
+        parked->StopPrice = order.StopPrice;
+        parked->ForceCloseReason = order.ForceCloseReason;
+        parked->IsAutoSuspend = order.IsAutoSuspend;
+        parked->UserForceClose = order.UserForceClose;
+        parked->IsSwapOrder = order.IsSwapOrder;
+        parked->RequestID = order.RequestID;
+    }
+
+    void parked_action2ctp(const CThostFtdcInputOrderActionField& action, CThostFtdcParkedOrderActionField* parked) {
+        memset(parked, 0, sizeof(*parked));
+        strcpy(parked->BrokerID, action.BrokerID);
+        strcpy(parked->InvestorID, action.InvestorID);
+        strcpy(parked->InstrumentID, action.InstrumentID);
+        strcpy(parked->OrderRef, action.OrderRef);
+        strcpy(parked->ExchangeID, action.ExchangeID);
+        strcpy(parked->OrderSysID, action.OrderSysID);
+        parked->OrderActionRef = action.OrderActionRef;
+        parked->RequestID = action.RequestID;
+        parked->FrontID = action.FrontID;
+        parked->SessionID = action.SessionID;
+        parked->ActionFlag = action.ActionFlag;
+    }
+
+    bool ParseOrderCondition(int64_t price_type, int64_t volume, CTPOrderCondition* cond, string* error) {
+        if (price_type < 0) {
+            *error = "not valid price_type: " + std::to_string(price_type);
+            return false;
+        }
+        cond->price_type = price_type % 100;
+        cond->time_condition = (price_type / 100) % 10;
+        cond->min_volume = price_type / 1000;
+        if (cond->price_type > kCTPPriceTypeMax) {
+            *error = "not valid price_type: " + std::to_string(price_type) + ", unknown price type " + std::to_string(cond->price_type);
+        } else if (cond->time_condition != kCTPTimeConditionGFD && cond->time_condition != kCTPTimeConditionFAK
+            && cond->time_condition != kCTPTimeConditionFOK) {
+            *error = "not valid price_type: " + std::to_string(price_type) + ", unknown time condition " + std::to_string(cond->time_condition);
+        } else if (cond->min_volume > 0 && cond->time_condition != kCTPTimeConditionFAK) {
+            *error = "not valid price_type: " + std::to_string(price_type) + ", min volume is only for FAK";
+        } else if (cond->min_volume > volume) {
+            *error = "not valid price_type: " + std::to_string(price_type) + ", min volume is more than volume " + std::to_string(volume);
+        } else {
+            return true;
+        }
+        return false;
+    }
+
+    void order_condition2ctp(const CTPOrderCondition& cond, CThostFtdcInputOrderField* req) {
+        req->OrderPriceType = order_price_type2ctp(cond.price_type);
+        req->TimeCondition = order_time_condition2ctp(cond.time_condition);
+        req->VolumeCondition = THOST_FTDC_VC_AV;  // 任何数量
+        req->MinVolume = 1;
+        if (cond.time_condition == kCTPTimeConditionFOK) {
+            req->VolumeCondition = THOST_FTDC_VC_CV;  // 全部数量
+            req->MinVolume = req->VolumeTotalOriginal;
+        } else if (cond.time_condition == kCTPTimeConditionFAK && cond.min_volume > 0) {
+            req->VolumeCondition = THOST_FTDC_VC_MV;  // 最小数量
+            req->MinVolume = cond.min_volume;
+        }
+    }
+
+    bool IsBatchCancel(const string& order_no) {
+        size_t n = strlen(kCTPBatchCancelMarker);
+        return order_no.compare(0, n, kCTPBatchCancelMarker) == 0 && (order_no.size() == n || order_no[n] == ':');
+    }
+
+    bool ParseBatchCancel(const string& order_no, CTPBatchCancel* filter, string* error) {
+        if (!IsBatchCancel(order_no)) {
+            *error = "not valid batch cancel: " + order_no;
+            return false;
+        }
+        vector<string> filters;
+        boost::split(filters, order_no, boost::is_any_of(":"));
+        if (filters.size() > 3) {
+            *error = "not valid batch cancel: " + order_no;
+            return false;
+        }
+        filter->code = filters.size() > 1 ? filters[1] : "";
+        string side = filters.size() > 2 ? filters[2] : "";
+        filter->bs_flag = side == "B" ? kBsFlagBuy : (side == "S" ? kBsFlagSell : 0);
+        if (!side.empty() && filter->bs_flag == 0) {
+            *error = "not valid batch cancel: " + order_no + ", unknown side " + side;
+            return false;
+        }
+        return true;
+    }
+
     double ctp_equity(CThostFtdcTradingAccountField *p) {
         /*
         ==========================================
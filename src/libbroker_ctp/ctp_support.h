@@ -16,12 +16,15 @@
 namespace co {
     // CTP�Բ�ѯ������������������, ÿ��������һ�β�ѯ����
     constexpr int64_t CTP_FLOW_CONTROL_MS = 1000;
+    constexpr int kCTPFlowQueueFull = -100;  // 本地报单流控队列已满
 
     string CtpApiError(int rc);
     string CtpToUTF8(const char* str);
     string CtpError(int code, const char* msg);
     string CtpError(TThostFtdcErrorIDType code, TThostFtdcErrorMsgType msg);
     int64_t CtpTimestamp(int64_t date, TThostFtdcTimeType time);
+    // 委托合同号: <前置编号>_<会话编号>_<报单引用>_<代码>
+    string CtpOrderNo(TThostFtdcFrontIDType front_id, TThostFtdcSessionIDType session_id, int64_t order_ref, const char* instrument_id);
 
     bool is_flow_control(int ret_code);
     int64_t ctp_time2std(TThostFtdcTimeType v);
@@ -38,6 +41,57 @@ namespace co {
     TThostFtdcOrderPriceTypeType order_price_type2ctp(int64_t v);
     int64_t ctp_order_price_type2std(TThostFtdcOrderPriceTypeType v);
     TThostFtdcTimeConditionType order_time_condition2ctp(string v);
+    TThostFtdcTimeConditionType order_time_condition2ctp(int64_t v);
+
+    // MemTradeOrder没有有效期和成交量条件字段，附加在price_type的高位：price_type = 价格类型 + 有效期 * 100 + 最小成交量 * 1000
+    // 只能经ParseOrderCondition解析：价格类型0-16，有效期0-2，最小成交量只用于FAK且不超过委托数量，任何一部分不合法都拒绝报单
+    constexpr int64_t kCTPTimeConditionGFD = 0;  // 当日有效
+    constexpr int64_t kCTPTimeConditionFAK = 1;  // 立即成交剩余撤销（IOC），指定最小成交量时至少成交该数量，否则全部撤销
+    constexpr int64_t kCTPTimeConditionFOK = 2;  // 立即全部成交否则撤销（IOC + 全部数量）
+    constexpr int64_t kCTPPriceTypeMax = 16;  // 最大的价格类型，见order_price_type2ctp
+
+    /**
+     * 从price_type解析出的报单条件
+     */
+struct CTPOrderCondition {
+    int64_t price_type = 0;  // 价格类型
+    int64_t time_condition = 0;  // 有效期，kCTPTimeConditionXXX
+    int64_t min_volume = 0;  // FAK的最小成交量，0为不限
+};
+
+    /**
+     * 解析并校验price_type
+     * @param volume: 委托数量，最小成交量不能超过委托数量
+     * @return 不合法时返回false，error为拒绝原因
+     */
+    bool ParseOrderCondition(int64_t price_type, int64_t volume, CTPOrderCondition* cond, string* error);
+    // 按解析后的报单条件设置报单的价格类型、有效期、成交量条件和最小成交量
+    void order_condition2ctp(const CTPOrderCondition& cond, CThostFtdcInputOrderField* req);
+
+    // 批量撤单：MemTradeWithdrawMessage由外部库定义，不能增加消息类型和字段，以order_no中的保留标记显式区分
+    // 格式: "*BATCH"撤销全部, "*BATCH:<代码>"按合约, "*BATCH:<代码>:<B|S>"按合约和方向, "*BATCH::<B|S>"按方向
+    // CtpOrderNo以数字前置编号开头，不会与该标记冲突；以标记开头但格式不合法的请求直接拒绝，不会当作普通委托撤单
+    // 回报：每个被撤销的委托回报一条kMemTypeTradeWithdrawRep（order_no为该委托的合同号），最后回报原请求（order_no为批量撤单标记）作为结束
+    constexpr char kCTPBatchCancelMarker[] = "*BATCH";
+
+    /**
+     * 批量撤单的过滤条件
+     */
+struct CTPBatchCancel {
+    string code;  // 带市场后缀的代码，为空时不限合约
+    int64_t bs_flag = 0;  // 为0时不限方向
+};
+
+    // order_no是否为批量撤单请求：以kCTPBatchCancelMarker开头，其后为结尾或':'
+    bool IsBatchCancel(const string& order_no);
+    /**
+     * 解析批量撤单请求
+     * @return 格式不合法时返回false并设置error
+     */
+    bool ParseBatchCancel(const string& order_no, CTPBatchCancel* filter, string* error);
+    // 报单、撤单请求转为预埋单、预埋撤单
+    void parked_order2ctp(const CThostFtdcInputOrderField& order, CThostFtdcParkedOrderField* parked);
+    void parked_action2ctp(const CThostFtdcInputOrderActionField& action, CThostFtdcParkedOrderActionField* parked);
 
     double ctp_equity(CThostFtdcTradingAccountField* p);
     void DeleteCzceCode(string& code);
@@ -0,0 +1,109 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <fstream>
+#include <thread>
+#include <boost/filesystem.hpp>
+#include <x/x.h>
+#include "ctp_thread.h"
+
+namespace co {
+    static string CpusToString(const vector<int>& cpus) {
+        stringstream ss;
+        for (size_t i = 0; i < cpus.size(); ++i) {
+            ss << (i > 0 ? "," : "") << cpus[i];
+        }
+        return ss.str();
+    }
+
+    bool SetThreadAffinity(const vector<int>& cpus) {
+        if (cpus.empty()) {
+            return true;
+        }
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        for (auto cpu : cpus) {
+            CPU_SET(cpu, &mask);
+        }
+        if (sched_setaffinity(0, sizeof(mask), &mask) != 0) {
+            LOG_ERROR << "bind thread to cpu failed: tid = " << GetThreadID() << ", cpus = " << CpusToString(cpus) << ", error = " << strerror(errno);
+            return false;
+        }
+        LOG_INFO << "bind thread to cpu ok: tid = " << GetThreadID() << ", cpus = " << CpusToString(cpus);
+        return true;
+    }
+
+    bool SetThreadFifo(int priority) {
+        if (priority <= 0) {
+            return true;
+        }
+        sched_param param {};
+        param.sched_priority = priority;
+        int rc = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (rc != 0) {
+            LOG_ERROR << "set thread SCHED_FIFO failed: tid = " << GetThreadID() << ", priority = " << priority << ", error = " << strerror(rc);
+            return false;
+        }
+        LOG_INFO << "set thread SCHED_FIFO ok: tid = " << GetThreadID() << ", priority = " << priority;
+        return true;
+    }
+
+    void SetThreadName(const string& name) {
+        pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+    }
+
+    void RunPinned(const string& name, const vector<int>& cpus, int priority, const std::function<void()>& fn) {
+        std::thread thread([&] {
+            SetThreadName(name);
+            SetThreadAffinity(cpus);
+            SetThreadFifo(priority);
+            fn();
+        });
+        thread.join();
+    }
+
+    int64_t GetThreadID() {
+        return syscall(SYS_gettid);
+    }
+
+    vector<int> GetThreadAffinity(int64_t tid) {
+        vector<int> cpus;
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        if (sched_getaffinity(tid, sizeof(mask), &mask) == 0) {
+            for (int i = 0; i < CPU_SETSIZE; ++i) {
+                if (CPU_ISSET(i, &mask)) {
+                    cpus.push_back(i);
+                }
+            }
+        }
+        return cpus;
+    }
+
+    string ThreadLayout() {
+        stringstream ss;
+        boost::filesystem::path dir("/proc/self/task");
+        if (!boost::filesystem::exists(dir)) {
+            return "";
+        }
+        int64_t cpu_count = sysconf(_SC_NPROCESSORS_ONLN);
+        for (auto& it : boost::filesystem::directory_iterator(dir)) {
+            int64_t tid = atoll(it.path().filename().string().c_str());
+            string name;
+            std::ifstream comm(it.path().string() + "/comm");
+            std::getline(comm, name);
+            vector<int> cpus = GetThreadAffinity(tid);
+            int policy = sched_getscheduler(tid);
+            sched_param param {};
+            sched_getparam(tid, &param);
+            ss << endl << "  tid: " << tid
+                << ", name: " << name
+                << ", cpus: " << ((int64_t)cpus.size() == cpu_count ? "all" : CpusToString(cpus))
+                << ", policy: " << (policy == SCHED_FIFO ? "SCHED_FIFO" : (policy == SCHED_RR ? "SCHED_RR" : "SCHED_OTHER"))
+                << ", priority: " << param.sched_priority;
+        }
+        return ss.str();
+    }
+}  // namespace co
@@ -0,0 +1,38 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#pragma once
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+namespace co {
+    /**
+     * 把当前线程绑定到指定的CPU，cpus为空时不修改
+     * 之后由当前线程创建的线程（包括CTP SDK的内部线程）会继承绑定关系
+     */
+    bool SetThreadAffinity(const vector<int>& cpus);
+
+    /**
+     * 把当前线程设置为SCHED_FIFO实时调度，priority为1-99，0表示不修改
+     * 需要CAP_SYS_NICE权限，之后创建的线程同样继承调度策略
+     */
+    bool SetThreadFifo(int priority);
+
+    void SetThreadName(const string& name);  // 最多15个字符
+
+    /**
+     * 在新线程中按指定的名称、CPU和优先级执行fn并等待结束
+     * 用于创建CTP API：SDK的内部线程由创建API的线程派生，会继承名称、绑定关系和调度策略
+     */
+    void RunPinned(const string& name, const vector<int>& cpus, int priority, const std::function<void()>& fn);
+
+    int64_t GetThreadID();  // 内核线程号
+
+    vector<int> GetThreadAffinity(int64_t tid);
+
+    /**
+     * 进程内全部线程的布局：线程号、名称、绑定的CPU、调度策略与优先级，用于启动时核对
+     */
+    string ThreadLayout();
+}  // namespace co
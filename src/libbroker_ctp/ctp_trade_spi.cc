@@ -1,22 +1,49 @@
+#include <cmath>
 #include <boost/algorithm/string.hpp>
 #include "ctp_trade_spi.h"
 #include "ctp_broker.h"
 
 namespace co {
-    CTPTradeSpi::CTPTradeSpi(CTPBroker* broker) : CThostFtdcTraderSpi(), broker_(broker) {
+    thread_local std::string CTPTradeSpi::reply_buffer_;
+
+    CTPTradeSpi::CTPTradeSpi(CTPBroker* broker) : CTPTradeSpi(broker, Config::Instance()->ctp_accounts().front()) {
+    }
+
+    CTPTradeSpi::CTPTradeSpi(CTPBroker* broker, const CTPAccount& account) : CThostFtdcTraderSpi(),
+        account_(account), broker_(broker), all_instruments_(CTPInstrumentCatalog::Instance()->items()) {
         start_index_ = x::RawTime();
         query_instruments_finish_.store(false);
-        broker_id_ = Config::Instance()->ctp_broker_id();
-        investor_id_ = Config::Instance()->ctp_investor_id();
+        broker_id_ = account_.broker_id;
+        investor_id_ = account_.investor_id;
         future_position_master_.set_risk_forbid_closing_today(Config::Instance()->risk_forbid_closing_today());
         future_position_master_.set_risk_max_today_opening_volume(Config::Instance()->risk_max_today_opening_volume());
+        future_position_master_.set_lot_book(&future_lot_book_);
+        flow_control_.Init(Config::Instance()->ctp_order_rate_limit(), Config::Instance()->ctp_order_queue_size(),
+            [this](CTPFlowRequest& req) {
+                std::shared_lock<std::shared_mutex> lock(api_mutex_);
+                return SendFlowRequest(req, api_.load(), front_id_, session_id_);
+            },
+            std::bind(&CTPTradeSpi::OnFlowRequestFailed, this, std::placeholders::_1, std::placeholders::_2));
+    }
+
+    CTPTradeSpi::~CTPTradeSpi() {
+        // 先停止查询线程、报单会话和本会话的发送线程，它们会回调本对象的成员
+        stopping_ = true;
+        if (price_limit_thread_ && price_limit_thread_->joinable()) {
+            price_limit_thread_->join();
+        }
+        order_sessions_.clear();
+        flow_control_.Stop();
     }
 
     void CTPTradeSpi::ReqAuthenticate() {
+        if (replay_) {  // 回放时不向CTP发送请求，响应来自回放文件
+            return;
+        }
         LOG_INFO << "authenticate ...";
-        string app_id = Config::Instance()->ctp_app_id();
-        string product_info = Config::Instance()->ctp_product_info();
-        string auth_code = Config::Instance()->ctp_auth_code();
+        string app_id = account_.app_id;
+        string product_info = account_.product_info;
+        string auth_code = account_.auth_code;
 
         CThostFtdcReqAuthenticateField req;
         memset(&req, 0, sizeof(req));
@@ -26,47 +53,57 @@ namespace co {
         strcpy(req.UserProductInfo, product_info.c_str());
         strcpy(req.AuthCode, auth_code.c_str());
         int rc = 0;
-        while ((rc = api_->ReqAuthenticate(&req, GetRequestID())) != 0) {
+        while ((rc = api_.load()->ReqAuthenticate(&req, GetRequestID())) != 0) {
             LOG_WARN << "ReqAuthenticate failed: " << CtpApiError(rc) << ", retring ...";
             x::Sleep(CTP_FLOW_CONTROL_MS);
         }
     }
 
     void CTPTradeSpi::ReqUserLogin() {
+        if (replay_) {  // 回放时不向CTP发送请求，响应来自回放文件
+            return;
+        }
         LOG_INFO << "login ...";
-        string pwd = Config::Instance()->ctp_password();
+        string pwd = account_.password;
         CThostFtdcReqUserLoginField req;
         memset(&req, 0, sizeof(req));
         strcpy(req.BrokerID, broker_id_.c_str());
         strcpy(req.UserID, investor_id_.c_str());
         strcpy(req.Password, pwd.c_str());
         int ret = 0;
-        while ((ret = api_->ReqUserLogin(&req, GetRequestID())) != 0) {
+        while ((ret = api_.load()->ReqUserLogin(&req, GetRequestID())) != 0) {
             LOG_WARN << "ReqUserLogin failed: " << CtpApiError(ret) << ", retring ...";
             x::Sleep(CTP_FLOW_CONTROL_MS);
         }
     }
 
     void CTPTradeSpi::ReqSettlementInfoConfirm() {
+        if (replay_) {  // 回放时不向CTP发送请求，响应来自回放文件
+            return;
+        }
         LOG_INFO << "confirm settlement info ...";
         CThostFtdcSettlementInfoConfirmField req;
         memset(&req, 0, sizeof(req));
         strcpy(req.BrokerID, broker_id_.c_str());
         strcpy(req.InvestorID, investor_id_.c_str());
-        int ret = api_->ReqSettlementInfoConfirm(&req, GetRequestID());
+        int ret = api_.load()->ReqSettlementInfoConfirm(&req, GetRequestID());
         if (ret != 0) {
             LOG_ERROR << "ReqSettlementInfoConfirm failed: " << CtpApiError(ret);
         }
     }
 
     void CTPTradeSpi::ReqQryInstrument() {
+        if (replay_) {  // 回放时不向CTP发送请求，响应来自回放文件
+            return;
+        }
         LOG_INFO << "query all future contracts ...";
         PrepareQuery();
         CThostFtdcQryInstrumentField req;
         memset(&req, 0, sizeof(req));
         int ret = 0;
-        while ((ret = api_->ReqQryInstrument(&req, GetRequestID())) != 0) {
+        while ((ret = api_.load()->ReqQryInstrument(&req, GetRequestID())) != 0) {
             if (is_flow_control(ret)) {
+                CTPMetrics::Instance()->Add(&CTPMetricsPage::flow_control_hits);
                 LOG_WARN << "ReqQryInstrument failed: " << CtpApiError(ret)
                     << ", retry in " << CTP_FLOW_CONTROL_MS << "ms ...";
                 x::Sleep(CTP_FLOW_CONTROL_MS);
@@ -79,6 +116,9 @@ namespace co {
     }
 
     void CTPTradeSpi::ReqQryInvestorPosition() {
+        if (replay_) {  // 回放时不向CTP发送请求，响应来自回放文件
+            return;
+        }
         PrepareQuery();
         string id = x::UUID();
         MemGetTradePositionMessage msg {};
@@ -88,6 +128,72 @@ namespace co {
         OnQueryTradePosition(&msg);
     }
 
+    void CTPTradeSpi::ReqQryPriceLimits() {
+        if (replay_) {  // 回放时不向CTP发送请求，响应来自回放文件
+            return;
+        }
+        LOG_INFO << "query price limits ...";
+        PrepareQuery();
+        CThostFtdcQryDepthMarketDataField req;
+        memset(&req, 0, sizeof(req));  // 不指定合约时返回全部合约，一次查询
+        int ret = 0;
+        while (!stopping_.load()) {
+            {
+                // 与报单、查询同样持有共享锁，切换前置时不会使用已释放的API
+                std::shared_lock<std::shared_mutex> lock(api_mutex_);
+                ret = api_.load()->ReqQryDepthMarketData(&req, GetRequestID());
+            }
+            if (ret == 0) {
+                break;
+            }
+            if (is_flow_control(ret)) {
+                CTPMetrics::Instance()->Add(&CTPMetricsPage::flow_control_hits);
+                LOG_WARN << "ReqQryDepthMarketData failed: " << CtpApiError(ret)
+                    << ", retry in " << CTP_FLOW_CONTROL_MS << "ms ...";
+                x::Sleep(CTP_FLOW_CONTROL_MS);
+                continue;
+            } else {
+                LOG_ERROR << "ReqQryDepthMarketData failed: " << CtpApiError(ret);
+                break;
+            }
+        }
+    }
+
+    void CTPTradeSpi::ReqReconcilePosition() {
+        string id = x::UUID();
+        MemGetTradePositionMessage msg {};
+        strncpy(msg.id, id.c_str(), id.length());
+        strcpy(msg.fund_id, investor_id_.c_str());
+        msg.timestamp = x::RawDateTime();
+        QueryTradePosition(&msg, true);
+    }
+
+    void CTPTradeSpi::ReqQryInvestorPositionDetail() {
+        if (replay_) {  // 回放时不向CTP发送请求，响应来自回放文件
+            return;
+        }
+        LOG_INFO << "query position details ...";
+        PrepareQuery();
+        all_pos_details_.clear();
+        CThostFtdcQryInvestorPositionDetailField req;
+        memset(&req, 0, sizeof(req));
+        strcpy(req.BrokerID, broker_id_.c_str());
+        strcpy(req.InvestorID, investor_id_.c_str());
+        int ret = 0;
+        while ((ret = api_.load()->ReqQryInvestorPositionDetail(&req, GetRequestID())) != 0) {
+            if (is_flow_control(ret)) {
+                CTPMetrics::Instance()->Add(&CTPMetricsPage::flow_control_hits);
+                LOG_WARN << "ReqQryInvestorPositionDetail failed: " << CtpApiError(ret)
+                    << ", retry in " << CTP_FLOW_CONTROL_MS << "ms ...";
+                x::Sleep(CTP_FLOW_CONTROL_MS);
+                continue;
+            } else {
+                LOG_ERROR << "ReqQryInvestorPositionDetail failed: " << CtpApiError(ret);
+                break;
+            }
+        }
+    }
+
     void CTPTradeSpi::OnQueryTradeAsset(MemGetTradeAssetMessage* req) {
         PrepareQuery();
         rsp_query_msg_.clear();
@@ -101,22 +207,30 @@ namespace co {
             std::unique_lock<std::mutex> lock(mutex_);
             query_msg_.emplace(std::make_pair(request_id, string(reinterpret_cast<const char*>(req), sizeof(MemGetTradeAssetMessage))));
         }
-        int ret = api_->ReqQryTradingAccount(&field, request_id);
+        int ret = 0;
+        {
+            std::shared_lock<std::shared_mutex> lock(api_mutex_);
+            ret = api_.load()->ReqQryTradingAccount(&field, request_id);
+        }
+        CountRequest(ret, &CTPMetricsPage::queries_sent, nullptr);
         LOG_INFO << "ReqQryTradingAccount, ret: " << ret;
         if (ret != 0) {
             LOG_ERROR << "query asset error: " << ret;
             string error = "query asset error:" + std::to_string(ret);
             strcpy(req->error, error.c_str());
-            broker_->SendRtnMessage(string(reinterpret_cast<const char*>(req), sizeof(MemGetTradeAssetMessage)), kMemTypeQueryTradeAssetRep);
+            memcpy(NewReply<MemGetTradeAssetMessage>(), req, sizeof(MemGetTradeAssetMessage));
+            SendReply(kMemTypeQueryTradeAssetRep);
             std::unique_lock<std::mutex> lock(mutex_);
             query_msg_.erase(request_id);
         }
     }
 
     void CTPTradeSpi::OnQueryTradePosition(MemGetTradePositionMessage* req) {
+        QueryTradePosition(req, false);
+    }
+
+    void CTPTradeSpi::QueryTradePosition(MemGetTradePositionMessage* req, bool reconcile) {
         PrepareQuery();
-        rsp_query_msg_.clear();
-        all_pos_.clear();
         CThostFtdcQryInvestorPositionField field;
         memset(&field, 0, sizeof(field));
         strcpy(field.BrokerID, broker_id_.c_str());
@@ -124,26 +238,37 @@ namespace co {
         int request_id = GetRequestID();
         {
             std::unique_lock<std::mutex> lock(mutex_);
-            query_msg_.emplace(std::make_pair(request_id, string(reinterpret_cast<const char*>(req), sizeof(MemGetTradePositionMessage))));
+            CTPPositionQuery& query = position_queries_[request_id];
+            query.req_message = string(reinterpret_cast<const char*>(req), sizeof(MemGetTradePositionMessage));
+            query.reconcile = reconcile;
+        }
+        int ret = 0;
+        {
+            std::shared_lock<std::shared_mutex> lock(api_mutex_);
+            ret = api_.load()->ReqQryInvestorPosition(&field, request_id);
         }
-        int ret = api_->ReqQryInvestorPosition(&field, request_id);
+        CountRequest(ret, &CTPMetricsPage::queries_sent, nullptr);
         if (ret != 0) {
             LOG_ERROR << "query positon error: " << ret;
             string error = "query positon error:" + std::to_string(ret);
             strcpy(req->error, error.c_str());
-            broker_->SendRtnMessage(string(reinterpret_cast<const char*>(req), sizeof(MemGetTradePositionMessage)), kMemTypeQueryTradePositionRep);
-            std::unique_lock<std::mutex> lock(mutex_);
-            query_msg_.erase(request_id);
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                position_queries_.erase(request_id);
+            }
+            if (!reconcile) {
+                memcpy(NewReply<MemGetTradePositionMessage>(), req, sizeof(MemGetTradePositionMessage));
+                SendReply(kMemTypeQueryTradePositionRep);
+            }
         }
     }
 
     void CTPTradeSpi::OnQueryTradeKnock(MemGetTradeKnockMessage* req) {
         PrepareQuery();
         rsp_query_msg_.clear();
-        rsp_query_msg_.clear();
         all_knock_.clear();
         CThostFtdcQryTradeField field;
-        memset(&field, 0, sizeof(req));
+        memset(&field, 0, sizeof(field));
         strcpy(field.BrokerID, broker_id_.c_str());
         strcpy(field.InvestorID, investor_id_.c_str());
         strcpy(field.TradeTimeStart, req->cursor);
@@ -153,12 +278,18 @@ namespace co {
             std::unique_lock<std::mutex> lock(mutex_);
             query_msg_.emplace(std::make_pair(request_id, string(reinterpret_cast<const char*>(req), sizeof(MemGetTradeKnockMessage))));
         }
-        int ret = api_->ReqQryTrade(&field, request_id);
+        int ret = 0;
+        {
+            std::shared_lock<std::shared_mutex> lock(api_mutex_);
+            ret = api_.load()->ReqQryTrade(&field, request_id);
+        }
+        CountRequest(ret, &CTPMetricsPage::queries_sent, nullptr);
         if (ret != 0) {
             LOG_ERROR << "query kock error: " << ret;
             string error = "query knock error:" + std::to_string(ret);
             strcpy(req->error, error.c_str());
-            broker_->SendRtnMessage(string(reinterpret_cast<const char*>(req), sizeof(MemGetTradeKnockMessage)), kMemTypeQueryTradeKnockRep);
+            memcpy(NewReply<MemGetTradeKnockMessage>(), req, sizeof(MemGetTradeKnockMessage));
+            SendReply(kMemTypeQueryTradeKnockRep);
             std::unique_lock<std::mutex> lock(mutex_);
             query_msg_.erase(request_id);
         }
@@ -176,17 +307,15 @@ namespace co {
 
         string _error_msg;
         int _item_size = req->items_size;
-        if (_item_size == 1) {
+        if (_item_size == 1 && CheckOrder(req, &_error_msg)) {
             MemTradeOrder* order = (MemTradeOrder*)((char*)req + sizeof(MemTradeOrderMessage));
             int64_t auto_oc_flag = order->oc_flag;
-            LOG_INFO << "order, code: " << order->code
-                << ", bs_flag: " << req->bs_flag
-                << ", oc_flag: " << order->oc_flag
-                << ", volume: " << order->volume;
 
             co::fbs::TradeOrderT fb_order;
             fb_order.code = order->code;
+            fb_order.market = order->market;
             fb_order.bs_flag = req->bs_flag;
+            fb_order.hedge_flag = order->hedge_flag > 0 ? order->hedge_flag : kHedgeFlagSpeculate;  // 未指定时按投机处理
             fb_order.oc_flag = order->oc_flag;
             fb_order.volume = order->volume;
             fb_order.price = order->price;
@@ -196,16 +325,9 @@ namespace co {
                 auto_oc_flag = future_position_master_.GetCloseYestodayFlag(fb_order);
             }
 
-            LOG_INFO << "auto_oc_flag: " << auto_oc_flag;
-            string ctp_code;
-            for (size_t i = 0; i < strlen(order->code); ++i) {
-                if (order->code[i] != '.') {
-                    ctp_code[i] = order->code[i];
-                } else {
-                    break;
-                }
-            }
-          if (order->market == co::kMarketCZCE) {
+            string ctp_code = order->code;
+            ctp_code = ctp_code.substr(0, ctp_code.find('.'));  // 去掉市场后缀
+            if (order->market == co::kMarketCZCE) {
                 DeleteCzceCode(ctp_code);
             }
             CThostFtdcInputOrderField _req;
@@ -214,48 +336,67 @@ namespace co {
             strcpy(_req.InvestorID, investor_id_.c_str());
             strcpy(_req.InstrumentID, ctp_code.c_str());
             int request_id = GetRequestID();
-            sprintf(_req.OrderRef, "%d", request_id);
+            sprintf(_req.OrderRef, "%d", request_id);  // 报单引用全局递增，在每个会话内同样递增
             _req.Direction = bs_flag2ctp(req->bs_flag);
             _req.CombOffsetFlag[0] = oc_flag2ctp(auto_oc_flag);
-            _req.CombHedgeFlag[0] = THOST_FTDC_CIDT_Speculation;
+            _req.CombHedgeFlag[0] = hedge_flag2ctp(fb_order.hedge_flag);
             _req.VolumeTotalOriginal = order->volume;
-            _req.VolumeCondition = THOST_FTDC_VC_AV;  /// 成交量类型：任何数量
-            _req.MinVolume = 1;  // 最小成交量
             _req.IsAutoSuspend = 0;  /// 自动挂起标志: 否
             _req.UserForceClose = 0;  /// 用户强评标志: 否
             _req.ForceCloseReason = THOST_FTDC_FCC_NotForceClose;  /// 强平原因: 非强平
             _req.IsSwapOrder = 0;  // 互换单标志
-            _req.OrderPriceType = order_price_type2ctp(order->price_type);  // 报单价格条件
+            // 价格类型、有效期类型（FAK/FOK为IOC）、成交量类型和最小成交量
+            // FAK/FOK未成交的部分由交易所立即撤销，在OnRtnOrder中按撤单撤回内部持仓的冻结
+            CTPOrderCondition cond;
+            ParseOrderCondition(order->price_type, order->volume, &cond, &_error_msg);  // CheckOrder已校验
+            order_condition2ctp(cond, &_req);
             _req.LimitPrice = order->price;  /// 价格
-            _req.TimeCondition = THOST_FTDC_TC_GFD; ///有效期类型
             _req.ContingentCondition = THOST_FTDC_CC_Immediately; // 触发条件：立即
 
+            bool parked = IsParkedOrderTime(CTPInstrumentCatalog::Instance()->Find(order->code));
+            CTPOrderSession* session = parked ? nullptr : PickOrderSession();  // 预埋单只从主会话发出
+            // 按当前会话编号生成委托合同号；排队期间会话重连时，报出时在SendFlowRequest中改用新的编号
+            string order_no = session ? CtpOrderNo(session->front_id(), session->session_id(), request_id, _req.InstrumentID)
+                : CtpOrderNo(front_id_, session_id_, request_id, _req.InstrumentID);
             {
+                // 保存的请求中记下委托合同号，报单被拒绝时按发送会话的编号撤回内部持仓
+                string req_message(reinterpret_cast<const char*>(req), sizeof(MemTradeOrderMessage) + sizeof(MemTradeOrder));
+                MemTradeOrder* saved = (MemTradeOrder*)(&req_message[0] + sizeof(MemTradeOrderMessage));
+                strncpy(saved->order_no, order_no.c_str(), sizeof(saved->order_no) - 1);
                 std::unique_lock<std::mutex> lock(mutex_);
-                req_msg_.emplace(std::make_pair(request_id, string(reinterpret_cast<const char*>(req), sizeof(MemTradeOrderMessage) + sizeof(MemTradeOrder))));
+                req_msg_.emplace(std::make_pair(request_id, req_message));
             }
-            int ret = api_->ReqOrderInsert(&_req, request_id);
-            LOG_INFO << "ReqOrderInsert, request_id: " << request_id;
-            if (ret != 0) {
-                _error_msg = "order faild, ret: " + std::to_string(ret) + ", " + CtpApiError(ret);
+            fb_order.order_no = order_no;
+            fb_order.oc_flag = auto_oc_flag;
+            // 排队期间内部持仓也要冻结，否则后续委托会算出同样的自动开平仓标记；发送失败时在FailOrderRequest中撤回
+            future_position_master_.Update(fb_order);
+            if (parked) {
                 std::unique_lock<std::mutex> lock(mutex_);
-                req_msg_.erase(request_id);
-            } else {
-                stringstream ss;
-                ss << front_id_ << "_" << session_id_ << "_" << _req.OrderRef << "_" << _req.InstrumentID;
-                string order_no = ss.str();
-                fb_order.order_no = order_no;
-                fb_order.oc_flag = auto_oc_flag;
-                future_position_master_.Update(fb_order);
+                CTPParkedOrder& parked_order = parked_orders_[string(_req.OrderRef) + "_" + _req.InstrumentID];
+                parked_order.order_no = order_no;
+                parked_order.inner_order = fb_order;
+                parked_order.inner_order.market = order->market;
             }
-        } else {
+            CTPFlowRequest flow_req;
+            flow_req.parked = parked;
+            flow_req.request_id = request_id;
+            flow_req.order_no = order_no;
+            flow_req.order = _req;
+            flow_req.inner_order = fb_order;
+            int ret = session ? session->Send(flow_req) : flow_control_.Send(flow_req);
+            if (ret != 0) {
+                FailOrderRequest(flow_req, ret);
+                return;
+            }
+        } else if (_error_msg.empty()) {
             _error_msg = "order item is not valid.";
         }
 
         if (_error_msg.length() > 0) {
             strcpy(req->error, _error_msg.c_str());
             req->rep_time = x::RawDateTime();
-            broker_->SendRtnMessage(string(reinterpret_cast<const char*>(req), sizeof(MemTradeOrderMessage)), kMemTypeTradeOrderRep);
+            memcpy(NewReply<MemTradeOrderMessage>(), req, sizeof(MemTradeOrderMessage));
+            SendReply(kMemTypeTradeOrderRep);
         }
     }
 
@@ -266,36 +407,100 @@ namespace co {
         // 交易所收到撤单后, 通过校验, 执行了撤单操作. 用户会收到OnRtnOrder
         // 如果交易所认为报单错误, 用户就会收到OnErrRtnOrderAction
         string _error_msg;
+        string order_no = req->order_no;
+        if (IsBatchCancel(order_no)) {
+            // 批量撤单，格式和回报见kCTPBatchCancelMarker
+            CTPBatchCancel filter;
+            if (ParseBatchCancel(order_no, &filter, &_error_msg)) {
+                vector<string> order_nos = CancelOrders(filter.code, filter.bs_flag);
+                LOG_INFO << "cancel orders: filter = " << order_no << ", orders = " << order_nos.size();
+                for (auto& no : order_nos) {
+                    MemTradeWithdrawMessage* rep = NewReply<MemTradeWithdrawMessage>();
+                    memcpy(rep, req, sizeof(MemTradeWithdrawMessage));
+                    memset(rep->order_no, 0, sizeof(rep->order_no));
+                    strncpy(rep->order_no, no.c_str(), sizeof(rep->order_no) - 1);
+                    rep->error[0] = '\0';
+                    rep->rep_time = x::RawDateTime();
+                    SendReply(kMemTypeTradeWithdrawRep);
+                }
+            }
+            strcpy(req->error, _error_msg.c_str());
+            req->rep_time = x::RawDateTime();
+            memcpy(NewReply<MemTradeWithdrawMessage>(), req, sizeof(MemTradeWithdrawMessage));
+            SendReply(kMemTypeTradeWithdrawRep);
+            return;
+        }
 
         CThostFtdcInputOrderActionField field;
         memset(&field, 0, sizeof(field));
         strcpy(field.BrokerID, broker_id_.c_str());
         strcpy(field.InvestorID, investor_id_.c_str());
         field.ActionFlag = THOST_FTDC_AF_Delete;  // 操作标志: 删除
-        string order_no = req->order_no;
         vector<string> vec_info;
         boost::split(vec_info, order_no, boost::is_any_of("_"), boost::token_compress_on);
         if (vec_info.size() == 4) {
+            // 报单仍在流控队列中时从未报出，直接取出并在本地撤单，不向CTP发送撤单
+            vector<CTPFlowRequest> queued = RemoveQueuedOrders([&order_no](const CTPFlowRequest& r) { return r.order_no == order_no; });
+            if (!queued.empty()) {
+                req->rep_time = x::RawDateTime();
+                memcpy(NewReply<MemTradeWithdrawMessage>(), req, sizeof(MemTradeWithdrawMessage));
+                SendReply(kMemTypeTradeWithdrawRep);
+                for (auto& r : queued) {
+                    CancelQueuedOrder(r);
+                }
+                return;
+            }
             int front_id = atoi(vec_info[0].c_str());
             int session_id = atoi(vec_info[1].c_str());
             field.FrontID = front_id;
             field.SessionID = session_id;
             strncpy(field.OrderRef, vec_info[2].c_str(), vec_info[2].length());
             strncpy(field.InstrumentID, vec_info[3].c_str(), vec_info[3].length());
-            int _request_id = GetRequestID();
-            // 撤单错误使用withdraw_msg_, 正确时使用req_msg_
+            // 预埋单：尚未报出时删除预埋单，已报出时按报出后的前置和会话编号撤单
+            bool parked_order = false;
+            string parked_order_id;
+            string code;  // 带市场后缀的代码，用于判断交易状态
             {
                 std::unique_lock<std::mutex> lock(mutex_);
-                req_msg_.emplace(std::make_pair(_request_id, string(reinterpret_cast<const char*>(req), sizeof(MemTradeWithdrawMessage))));
-                withdraw_msg_.emplace(std::make_pair(order_no, string(reinterpret_cast<const char*>(req), sizeof(MemTradeWithdrawMessage))));
+                auto live = live_orders_.find(order_no);
+                if (live != live_orders_.end()) {
+                    code = live->second.code;
+                }
+                auto it = parked_orders_.find(vec_info[2] + "_" + vec_info[3]);
+                if (it != parked_orders_.end() && it->second.order_no == order_no) {
+                    if (it->second.sent) {
+                        field.FrontID = it->second.front_id;
+                        field.SessionID = it->second.session_id;
+                    } else {
+                        parked_order = true;
+                        parked_order_id = it->second.parked_order_id;
+                    }
+                }
             }
-            LOG_INFO << "ReqOrderAction, request_id: " << _request_id;
-            int _ret = api_->ReqOrderAction(&field, _request_id);
-            if (_ret != 0) {
-                _error_msg = "withdraw faild, ret: " + std::to_string(_ret) + ", " + CtpApiError(_ret);
-                std::unique_lock<std::mutex> lock(mutex_);
-                req_msg_.erase(_request_id);
-                withdraw_msg_.erase(order_no);
+            if (parked_order && parked_order_id.empty()) {
+                _error_msg = "parked order is not accepted yet: " + order_no;
+            } else {
+                int _request_id = GetRequestID();
+                // 撤单错误使用withdraw_msg_, 正确时使用req_msg_
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    req_msg_.emplace(std::make_pair(_request_id, string(reinterpret_cast<const char*>(req), sizeof(MemTradeWithdrawMessage))));
+                    withdraw_msg_.emplace(std::make_pair(order_no, string(reinterpret_cast<const char*>(req), sizeof(MemTradeWithdrawMessage))));
+                }
+                CTPFlowRequest flow_req;
+                flow_req.withdraw = true;
+                flow_req.parked = !parked_order && IsParkedOrderTime(CTPInstrumentCatalog::Instance()->Find(code));
+                flow_req.parked_order_id = parked_order_id;
+                flow_req.request_id = _request_id;
+                flow_req.order_no = order_no;
+                flow_req.action = field;
+                // 撤单指定了原委托的前置和会话编号，可以从任意会话发出；预埋撤单和删除预埋单只从主会话发出
+                CTPOrderSession* session = (parked_order || flow_req.parked) ? nullptr : PickOrderSession();
+                int _ret = session ? session->Send(flow_req) : flow_control_.Send(flow_req);
+                if (_ret != 0) {
+                    FailWithdrawRequest(flow_req, _ret);
+                    return;
+                }
             }
         } else {
             _error_msg = "not valid order_no: " + order_no;
@@ -304,19 +509,25 @@ namespace co {
         if (_error_msg.length() > 0) {
             strcpy(req->error, _error_msg.c_str());
             req->rep_time = x::RawDateTime();
-            broker_->SendRtnMessage(string(reinterpret_cast<const char*>(req), sizeof(MemTradeWithdrawMessage)), kMemTypeTradeWithdrawRep);
+            memcpy(NewReply<MemTradeWithdrawMessage>(), req, sizeof(MemTradeWithdrawMessage));
+            SendReply(kMemTypeTradeWithdrawRep);
         }
     }
 
     // ------------------------------------------------------------------------
     /// 当客户端与交易后台建立起通信连接时(还未登录前), 该方法被调用
     void CTPTradeSpi::OnFrontConnected() {
+        CTPRecorder::Instance()->RecordFront(investor_id_, kCTPCallbackFrontConnected);
+        BindCallbackThread();
+        CTPMetrics::Instance()->Add(&CTPMetricsPage::front_connects);
         LOG_INFO << "connect to CTP trade server ok";
         Start();
     }
 
     /// 当客户端与交易后台通信连接断开时, 该方法被调用. 当发生这个情况后,  API会自动重新连接, 客户端可不做处理.
     void CTPTradeSpi::OnFrontDisconnected(int nReason) {
+        CTPRecorder::Instance()->RecordFront(investor_id_, kCTPCallbackFrontDisconnected, nReason);
+        CTPMetrics::Instance()->Add(&CTPMetricsPage::front_disconnects);
         stringstream ss;
         ss << "ret=" << nReason << ", msg=";
         switch (nReason) {
@@ -340,10 +551,18 @@ namespace co {
                 break;
         }
         LOG_INFO << "connection is broken: " << ss.str();
-        x::Sleep(2000);
+        {
+            std::unique_lock<std::mutex> lock(front_mutex_);
+            front_disconnected_ = true;
+        }
+        front_cv_.notify_all();
+        if (!replay_) {
+            x::Sleep(2000);
+        }
     }
 
     void CTPTradeSpi::OnRspUserLogout(CThostFtdcUserLogoutField* pUserLogout, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspUserLogout, pUserLogout, pRspInfo, nRequestID, bIsLast);
         if (pRspInfo == NULL || pRspInfo->ErrorID == 0) {
             LOG_INFO << "logout ok";
         } else {
@@ -353,6 +572,7 @@ namespace co {
 
     /// 客户端认证响应//
     void CTPTradeSpi::OnRspAuthenticate(CThostFtdcRspAuthenticateField* pRspAuthenticateField, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspAuthenticate, pRspAuthenticateField, pRspInfo, nRequestID, bIsLast);
         if (pRspInfo == NULL || pRspInfo->ErrorID == 0) {
             LOG_INFO << "authenticate ok";
             ReqUserLogin();
@@ -363,11 +583,11 @@ namespace co {
 
     /// 登录请求响应//
     void CTPTradeSpi::OnRspUserLogin(CThostFtdcRspUserLoginField* pRspUserLogin, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspUserLogin, pRspUserLogin, pRspInfo, nRequestID, bIsLast);
         if (pRspInfo == NULL || pRspInfo->ErrorID == 0) {
-            date_ = atoi(api_->GetTradingDay());
+            date_ = atoi(replay_ ? pRspUserLogin->TradingDay : api_.load()->GetTradingDay());
             front_id_ = pRspUserLogin->FrontID;
             session_id_ = pRspUserLogin->SessionID;
-            // order_ref_ = x::ToInt64(x::Trim(pRspUserLogin->MaxOrderRef));
             LOG_INFO << "login ok: trading_day = " << date_ << ", front_id = " << front_id_ << ", session_id = " << session_id_ << ", max_order_ref = " << pRspUserLogin->MaxOrderRef;
             if (IsMonday(date_)) {
                 pre_trading_day_ = x::PreDay(date_, 3);
@@ -389,17 +609,31 @@ namespace co {
     }
 
     void CTPTradeSpi::OnRspSettlementInfoConfirm(CThostFtdcSettlementInfoConfirmField* pSettlementInfoConfirm, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspSettlementInfoConfirm, pSettlementInfoConfirm, pRspInfo, nRequestID, bIsLast);
         if (pRspInfo == NULL || pRspInfo->ErrorID == 0) {
             string date = pSettlementInfoConfirm ? pSettlementInfoConfirm->ConfirmDate : "";
             LOG_INFO << "confirm settlement info ok: confirm_date = " << date;
         } else {
             LOG_WARN << "confirm settlement info failed: " << CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
         }
+        if (ready_) {
+            // 断线重连（或切换前置）后的重新登录：合约、内部持仓、委托映射都已在内存中，回报从断点续传，不再重新初始化
+            state_ = kStartupStepGetInitPositionDetailsOver;
+            LOG_INFO << "relogin ok, keep inner positions: front_id = " << front_id_ << ", session_id = " << session_id_;
+            return;
+        }
         state_ = kStartupStepConfirmSettlementOver;
-        ReqQryInstrument();
+        if (CTPInstrumentCatalog::Instance()->ready()) {
+            OnInstrumentsReady();  // 其他资金账号已查询过合约
+        } else if (!replay_ && CTPInstrumentCatalog::Instance()->Attach(Config::Instance()->options()->mem_dir(), date_)) {
+            OnInstrumentsReady();  // 同一主机上的其他broker已发布当日的合约文件
+        } else {
+            ReqQryInstrument();
+        }
     }
 
     void CTPTradeSpi::OnRspQryInstrument(CThostFtdcInstrumentField* p, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspQryInstrument, p, pRspInfo, nRequestID, bIsLast);
         if (pRspInfo == NULL || pRspInfo->ErrorID == 0) {
             if (p) {
                 string ctp_code = p->InstrumentID;
@@ -410,19 +644,28 @@ namespace co {
                 if (market) {
                     string suffix = MarketToSuffix(market).data();
                     string code = ctp_code + suffix;
-                    int _multiple = p->VolumeMultiple > 0 ? p->VolumeMultiple : 1;
-                    all_instruments_.insert(make_pair(code, make_pair(x::GBKToUTF8(x::Trim(p->InstrumentName)), _multiple)));
+                    CTPInstrumentRecord record {};
+                    strncpy(record.code, code.c_str(), sizeof(record.code) - 1);
+                    strncpy(record.instrument_id, p->InstrumentID, sizeof(record.instrument_id) - 1);
+                    strncpy(record.exchange_id, p->ExchangeID, sizeof(record.exchange_id) - 1);
+                    strncpy(record.name, x::GBKToUTF8(x::Trim(p->InstrumentName)).c_str(), sizeof(record.name) - 1);
+                    record.market = market;
+                    record.multiple = p->VolumeMultiple > 0 ? p->VolumeMultiple : 1;
+                    record.price_tick = p->PriceTick;
+                    record.max_limit_order_volume = p->MaxLimitOrderVolume;
+                    record.min_limit_order_volume = p->MinLimitOrderVolume;
+                    record.max_market_order_volume = p->MaxMarketOrderVolume;
+                    record.min_market_order_volume = p->MinMarketOrderVolume;
+                    record.expire_date = atoll(p->ExpireDate);
+                    strncpy(record.product_id, p->ProductID, sizeof(record.product_id) - 1);
+                    CTPInstrumentCatalog::Instance()->Add(record);
                 }
             }
             if (bIsLast) {
+                // 回放时不发布，以免覆盖实盘的合约文件
+                CTPInstrumentCatalog::Instance()->Publish(replay_ ? "" : Config::Instance()->options()->mem_dir(), date_);
                 LOG_INFO << "query all future contracts ok: contracts = " << all_instruments_.size();
-                query_instruments_finish_.store(true);
-                for (auto& it : all_ftdc_trades_) {
-                    OnRtnTrade(&it);
-                }
-                all_ftdc_trades_.clear();
-                state_ = kStartupStepGetContractsOver;
-                ReqQryInvestorPosition();
+                OnInstrumentsReady();
             }
         } else {
             LOG_ERROR << "query all future contracts failed: " << CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
@@ -430,8 +673,10 @@ namespace co {
     }
 
     void CTPTradeSpi::OnRspQryTradingAccount(CThostFtdcTradingAccountField* pTradingAccount, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspQryTradingAccount, pTradingAccount, pRspInfo, nRequestID, bIsLast);
         try {
             if (bIsLast) {
+                CTPMetrics::Instance()->Add(&CTPMetricsPage::queries_done);
                 string req_message;
                 {
                     std::unique_lock<std::mutex> lock(mutex_);
@@ -457,6 +702,7 @@ namespace co {
                     item.usable = pTradingAccount->Available;
                     item.margin = pTradingAccount->CurrMargin;
                     item.equity = ctp_equity(pTradingAccount);
+                    FillLiveEquity(&item, pTradingAccount);
                     strcpy(item.fund_id, investor_id_.c_str());
                 }
                 if (pRspInfo && pRspInfo->ErrorID != 0) {
@@ -464,7 +710,7 @@ namespace co {
                 }
                 MemGetTradeAssetMessage* req = (MemGetTradeAssetMessage*)(req_message.data());
                 int length = sizeof(MemGetTradeAssetMessage) + sizeof(MemTradeAsset) * total_num;
-                char buffer[length] = "";
+                char* buffer = NewReply<char>(length);
                 MemGetTradeAssetMessage* rep = (MemGetTradeAssetMessage*)buffer;
                 memcpy(rep, req, sizeof(MemGetTradeAssetMessage));
                 rep->items_size = total_num;
@@ -474,7 +720,7 @@ namespace co {
                     MemTradeAsset* first = (MemTradeAsset*)((char*)buffer + sizeof(MemGetTradeAssetMessage));
                     memcpy(first, &item, sizeof(MemTradeAsset));
                 }
-                broker_->SendRtnMessage(string(buffer, length), kMemTypeQueryTradeAssetRep);
+                SendReply(kMemTypeQueryTradeAssetRep);
             }
         } catch (std::exception& e) {
             LOG_ERROR << "OnRspQryTradingAccount: " << e.what();
@@ -482,7 +728,14 @@ namespace co {
     }
 
     void CTPTradeSpi::OnRspQryInvestorPosition(CThostFtdcInvestorPositionField* pInvestorPosition, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspQryInvestorPosition, pInvestorPosition, pRspInfo, nRequestID, bIsLast);
         try {
+            CTPPositionQuery* query = nullptr;
+            {
+                // 回放时没有对应的请求，按nRequestID新建；unordered_map中元素的地址在删除之前不变，只有回调线程会删除
+                std::unique_lock<std::mutex> lock(mutex_);
+                query = &position_queries_[nRequestID];
+            }
             if (pRspInfo == NULL || pRspInfo->ErrorID == 0) {
                 if (pInvestorPosition) {
                     LOG_INFO << "OnRspQryInvestorPosition, InstrumentID: " << pInvestorPosition->InstrumentID
@@ -498,38 +751,53 @@ namespace co {
                     }
                     string suffix = MarketToSuffix(market).data();
                     string code = ctp_code + suffix;
-                    // int64_t hedge_flag = ctp_hedge_flag2std(pInvestorPosition->HedgeFlag);
+                    if (pInvestorPosition->Position > 0) {
+                        CTPMarketData::Instance()->Subscribe(code);  // 持仓市值使用行情会话的最新价
+                    }
+                    int64_t hedge_flag = ctp_hedge_flag2std(pInvestorPosition->HedgeFlag);
                     int64_t bs_flag = ctp_ls_flag2std(pInvestorPosition->PosiDirection);
-                    auto it = all_pos_.find(code);
-                    if (it == all_pos_.end()) {
-                        MemTradePosition item {};
-                        strcpy(item.fund_id, investor_id_.c_str());
-                        item.market = market;
-                        strcpy(item.code, code.c_str());
-                        auto itor = all_instruments_.find(code);
-                        if (itor != all_instruments_.end()) {
-                            string& name = itor->second.first;
-                            strcpy(item.name, name.c_str());
+                    // 推送给客户端的持仓按合约汇总，内部持仓再按套保标记区分
+                    auto add = [&](std::unordered_map<std::string, MemTradePosition>* positions) {
+                        auto it = positions->find(code);
+                        if (it == positions->end()) {
+                            MemTradePosition item {};
+                            strcpy(item.fund_id, investor_id_.c_str());
+                            item.market = market;
+                            strcpy(item.code, code.c_str());
+                            auto itor = all_instruments_.find(code);
+                            if (itor != all_instruments_.end()) {
+                                string& name = itor->second.first;
+                                strcpy(item.name, name.c_str());
+                            }
+                            it = positions->insert(std::make_pair(code, item)).first;
                         }
-                        all_pos_.insert(std::make_pair(code, item));
-                        it = all_pos_.find(code);
-                    }
-                    // YdPositionYdPositionYdPositionYdPosition YdPosition 表示昨日收盘时持仓数量(静态数值, 日间不随着开平而变化)//
-                    // 当前的昨持仓 = 当前持仓数量 - 今开仓数量//
-                    if (bs_flag == kBsFlagBuy) {
-                        it->second.long_pre_volume = it->second.long_pre_volume + pInvestorPosition->YdPosition;
-                        it->second.long_volume = it->second.long_volume + pInvestorPosition->Position;
-                    } else if (bs_flag == kBsFlagSell) {
-                        it->second.short_pre_volume = it->second.short_pre_volume + pInvestorPosition->YdPosition;
-                        it->second.short_volume = it->second.short_volume + pInvestorPosition->Position;
-                    }
+                        // YdPositionYdPositionYdPositionYdPosition YdPosition 表示昨日收盘时持仓数量(静态数值, 日间不随着开平而变化)//
+                        // 当前的昨持仓 = 当前持仓数量 - 今开仓数量//
+                        if (bs_flag == kBsFlagBuy) {
+                            it->second.long_pre_volume = it->second.long_pre_volume + pInvestorPosition->YdPosition;
+                            it->second.long_volume = it->second.long_volume + pInvestorPosition->Position;
+                        } else if (bs_flag == kBsFlagSell) {
+                            it->second.short_pre_volume = it->second.short_pre_volume + pInvestorPosition->YdPosition;
+                            it->second.short_volume = it->second.short_volume + pInvestorPosition->Position;
+                        }
+                    };
+                    add(&query->positions);
+                    add(&query->hedge_positions[hedge_flag]);
                 }
             } else {
-                rsp_query_msg_ = CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
+                query->error = CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
             }
 
             if (bIsLast) {
-                for (auto it = all_pos_.begin(); it != all_pos_.end(); ++it) {
+                CTPPositionQuery _query;
+                {
+                    std::unique_lock<std::mutex> lock(mutex_);
+                    auto it = position_queries_.find(nRequestID);
+                    _query = std::move(it->second);
+                    position_queries_.erase(it);
+                }
+                CTPMetrics::Instance()->Add(&CTPMetricsPage::queries_done);
+                for (auto it = _query.positions.begin(); it != _query.positions.end(); ++it) {
                     LOG_INFO << it->second.code
                         << ", long_volume: " << it->second.long_volume
                         << ", long_pre_volume: " << it->second.long_pre_volume
@@ -537,48 +805,29 @@ namespace co {
                         << ", short_pre_volume: " << it->second.short_pre_volume;
                 }
                 if (state_ >= kStartupStepGetInitPositionsOver) {
-                    string req_message;
-                    {
-                        std::unique_lock<std::mutex> lock(mutex_);
-                        auto it = query_msg_.find(nRequestID);
-                        if (it != query_msg_.end()) {
-                            req_message = it->second;
-                            query_msg_.erase(it);
-                        } else {
-                            LOG_ERROR << "OnRspQryInvestorPosition, not find nRequestID: " << nRequestID;
-                        }
-                    }
-
-                    if (req_message.empty()) {
-                        LOG_ERROR << "OnRspQryInvestorPosition, req_message is empty. ";
+                    if (_query.req_message.empty()) {
+                        LOG_ERROR << "OnRspQryInvestorPosition, not find nRequestID: " << nRequestID;
                         return;
                     }
-                    MemGetTradePositionMessage* req = (MemGetTradePositionMessage*)(req_message.data());
-                    int total_num = all_pos_.size();
-                    int length = sizeof(MemGetTradePositionMessage) + sizeof(MemTradePosition) * total_num;
-                    char buffer[length] = "";
-                    MemGetTradePositionMessage* rep = (MemGetTradePositionMessage*)buffer;
-                    memcpy(rep, req, sizeof(MemGetTradePositionMessage));
-                    rep->items_size = total_num;
-                    if (total_num) {
-                        int index = 0;
-                        MemTradePosition *first = (MemTradePosition * )((char *)buffer + sizeof(MemGetTradePositionMessage));
-                        for (auto it = all_pos_.begin(); it != all_pos_.end(); ++it) {
-                            MemTradePosition *pos = first + index++;
-                            memcpy(pos, &it->second, sizeof(MemTradePosition));
-                        }
+                    if (_query.error.empty() && Config::Instance()->reconcile_interval_ms() > 0) {
+                        ReconcilePosition(_query);  // 客户端的持仓查询结果同样用于对账
                     }
-                    if (!rsp_query_msg_.empty()) {
-                        strcpy(rep->error, rsp_query_msg_.c_str());
+                    if (_query.reconcile) {
+                        return;
                     }
-                    broker_->SendRtnMessage(string(buffer, length), kMemTypeQueryTradePositionRep);
+                    SendPositionChunks(_query);
                 } else {
-                    vector<MemTradePosition> _positions;
-                    for (auto it = all_pos_.begin(); it != all_pos_.end(); ++it) {
-                        _positions.push_back(it->second);
+                    InnerFutureHedgePositions _positions = GetHedgePositions(_query);
+                    string journal_dir = Config::Instance()->journal_dir();
+                    if (!journal_dir.empty() && Config::Instance()->ctp_accounts().size() > 1) {
+                        journal_dir += "/" + investor_id_;  // 多个资金账号时按账号分目录
+                    }
+                    if (!journal_dir.empty() && !replay_) {  // 回放时不能写入实盘的持仓日志
+                        future_position_master_.OpenJournal(journal_dir, date_, Config::Instance()->journal_snapshot_interval());
                     }
                     future_position_master_.Init(_positions);
                     state_ = kStartupStepGetInitPositionsOver;
+                    ReqQryInvestorPositionDetail();
                 }
             }
         } catch (std::exception& e) {
@@ -586,12 +835,107 @@ namespace co {
         }
     }
 
+    void CTPTradeSpi::OnRspQryInvestorPositionDetail(CThostFtdcInvestorPositionDetailField* p, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspQryInvestorPositionDetail, p, pRspInfo, nRequestID, bIsLast);
+        try {
+            if (pRspInfo == NULL || pRspInfo->ErrorID == 0) {
+                if (p) {
+                    all_pos_details_.push_back(*p);
+                }
+            } else {
+                LOG_ERROR << "query position details failed: " << CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
+            }
+            if (bIsLast) {
+                // 订阅私有流时，今日的成交会全部重推，今仓由OnRtnTrade重建，这里只使用开盘前的昨仓
+                bool replay = !Config::Instance()->disable_subscribe();
+                int64_t lots = 0;
+                future_lot_book_.Init(date_, Config::Instance()->close_today_first_products());
+                for (auto& it : all_pos_details_) {
+                    bool today = strcmp(it.OpenDate, it.TradingDay) >= 0;
+                    int64_t volume = it.Volume;
+                    if (replay) {
+                        if (today) {
+                            continue;
+                        }
+                        volume += it.CloseVolume;
+                    }
+                    if (volume <= 0) {
+                        continue;
+                    }
+                    string ctp_code = it.InstrumentID;
+                    int64_t market = ctp_market2std(it.ExchangeID);
+                    if (market == co::kMarketCZCE) {
+                        InsertCzceCode(ctp_code);
+                    }
+                    string code = ctp_code + MarketToSuffix(market).data();
+                    int64_t multiple = 1;
+                    auto itor = all_instruments_.find(code);
+                    if (itor != all_instruments_.end()) {
+                        multiple = itor->second.second;
+                    }
+                    InnerFutureLot lot;
+                    lot.open_date = atoll(it.OpenDate);
+                    lot.open_price = it.OpenPrice;
+                    lot.volume = volume;
+                    lot.today = today;
+                    lot.comb = it.TradeType == THOST_FTDC_TRDT_CombinationDerived;
+                    future_lot_book_.Seed(code, market, multiple, ctp_hedge_flag2std(it.HedgeFlag), ctp_bs_flag2std(it.Direction), lot);
+                    ++lots;
+                }
+                LOG_INFO << "query position details ok: details = " << all_pos_details_.size() << ", lots = " << lots;
+                all_pos_details_.clear();
+                future_lot_book_.Start();
+                state_ = kStartupStepGetInitPositionDetailsOver;
+                ready_ = true;
+                if (Config::Instance()->ctp_price_limit_check() && CTPInstrumentCatalog::Instance()->TryRequestPriceLimits()) {
+                    // 查询需要等待流控，不阻塞回调线程；查询结束前的报单不检查涨跌停价
+                    if (price_limit_thread_ && price_limit_thread_->joinable()) {
+                        price_limit_thread_->join();
+                    }
+                    price_limit_thread_ = std::make_shared<std::thread>(std::bind(&CTPTradeSpi::ReqQryPriceLimits, this));
+                }
+            }
+        } catch (std::exception& e) {
+            LOG_ERROR << "OnRspQryInvestorPositionDetail: " << e.what();
+        }
+    }
+
+    void CTPTradeSpi::OnRspQryDepthMarketData(CThostFtdcDepthMarketDataField* pDepthMarketData, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspQryDepthMarketData, pDepthMarketData, pRspInfo, nRequestID, bIsLast);
+        if (pRspInfo && pRspInfo->ErrorID != 0) {
+            LOG_ERROR << "query price limits failed: " << CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
+            return;
+        }
+        if (pDepthMarketData) {
+            double upper = pDepthMarketData->UpperLimitPrice;
+            double lower = pDepthMarketData->LowerLimitPrice;
+            if (upper > 0 && upper < 1e300 && lower >= 0 && lower <= upper) {  // 没有行情时为DBL_MAX
+                string ctp_code = pDepthMarketData->InstrumentID;
+                int64_t market = ctp_market2std(pDepthMarketData->ExchangeID);
+                if (market == co::kMarketCZCE) {
+                    InsertCzceCode(ctp_code);
+                }
+                string code = ctp_code + MarketToSuffix(market).data();
+                const CTPInstrumentRecord* record = CTPInstrumentCatalog::Instance()->Find(code);
+                if (record) {
+                    CTPInstrumentCatalog::Instance()->SetPriceLimit(record, upper, lower);
+                    ++price_limit_count_;
+                }
+            }
+        }
+        if (bIsLast) {
+            LOG_INFO << "query price limits ok: contracts = " << price_limit_count_;
+        }
+    }
+
     /// 请求查询报单响应//
     void CTPTradeSpi::OnRspQryOrder(CThostFtdcOrderField* pOrder, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspQryOrder, pOrder, pRspInfo, nRequestID, bIsLast);
     }
 
     /// 请求查询成交响应//
     void CTPTradeSpi::OnRspQryTrade(CThostFtdcTradeField* pTrade, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspQryTrade, pTrade, pRspInfo, nRequestID, bIsLast);
         try {
             if (pRspInfo == NULL || pRspInfo->ErrorID == 0) {
                 if (pTrade) {
@@ -645,48 +989,21 @@ namespace co {
                         LOG_WARN << "ignore knock because no order_no found of order_sys_id: " << order_sys_id;
                     }
                     query_cursor_ = pTrade->TradeTime;
+                    int64_t chunk_size = Config::Instance()->query_reply_chunk_size();
+                    if (chunk_size > 0 && (int64_t)all_knock_.size() >= chunk_size) {  // 攒满一批就推送，不等全部返回
+                        SendKnockChunk(nRequestID, false);
+                    }
                 }
             } else {
                 rsp_query_msg_ = CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
             }
 
             if (bIsLast) {
-                string req_message;
-                {
-                    std::unique_lock<std::mutex> lock(mutex_);
-                    auto it = query_msg_.find(nRequestID);
-                    if (it != query_msg_.end()) {
-                        req_message = it->second;
-                        query_msg_.erase(it);
-                    } else {
-                        LOG_ERROR << "OnRspQryTrade, not find nRequestID: " << nRequestID;
-                    }
-                }
-                if (req_message.empty()) {
-                    LOG_ERROR << "OnRspQryTrade, req_message is empty. ";
-                    return;
-                }
-
-                MemGetTradeKnockMessage* req = (MemGetTradeKnockMessage*)(req_message.data());
-                int total_num = all_knock_.size();
-                int length = sizeof(MemGetTradeKnockMessage) + sizeof(MemTradeKnock) * total_num;
-                char buffer[length] = "";
-                MemGetTradeKnockMessage* rep = (MemGetTradeKnockMessage*)buffer;
-                memcpy(rep, req, sizeof(MemGetTradeKnockMessage));
-                rep->items_size = total_num;
-
-                if (total_num > 0) {
-                    MemTradeKnock* first = (MemTradeKnock*)((char*)buffer + sizeof(MemGetTradeKnockMessage));
-                    for (int i = 0; i < total_num; i++) {
-                        MemTradeKnock* knock = first + i;;
-                        memcpy(knock, &all_knock_[i], sizeof(MemTradeKnock));
-                    }
-                }
-                if (!rsp_query_msg_.empty()) {
-                    strcpy(rep->error, query_cursor_.c_str());
+                CTPMetrics::Instance()->Add(&CTPMetricsPage::queries_done);
+                if (Config::Instance()->query_reply_chunk_size() > 0 && !all_knock_.empty()) {
+                    SendKnockChunk(nRequestID, false);  // 分批推送时剩余的成交也按中间批次推送，最后单独推送空批次作为结束
                 }
-                strcpy(rep->next_cursor, rsp_query_msg_.c_str());
-                broker_->SendRtnMessage(string(buffer, length), kMemTypeQueryTradeKnockRep);
+                SendKnockChunk(nRequestID, true);
             }
         } catch (std::exception& e) {
             LOG_ERROR << "OnRspQryTrade: " << e.what();
@@ -695,6 +1012,9 @@ namespace co {
 
     /// 报单录入请求响应(CTP打回的废单会通过该函数返回)
     void CTPTradeSpi::OnRspOrderInsert(CThostFtdcInputOrderField* pInputOrder, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        std::unique_lock<std::mutex> callback_lock(callback_mutex_);  // 报单会话的响应在其回调线程中转交
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspOrderInsert, pInputOrder, pRspInfo, nRequestID, bIsLast);
+        CTPMetrics::Instance()->Add(&CTPMetricsPage::order_rejects);
         if (pInputOrder) {
             LOG_INFO << __FUNCTION__ << ", InstrumentID: " << pInputOrder->InstrumentID
                 << ", OrderRef: " << pInputOrder->OrderRef
@@ -724,26 +1044,28 @@ namespace co {
             }
             MemTradeOrderMessage* req = (MemTradeOrderMessage*)(req_message.data());
             int length = sizeof(MemTradeOrderMessage) + sizeof(MemTradeOrder) * req->items_size;
-            char buffer[length] = "";
+            char* buffer = NewReply<char>(length);
             memcpy(buffer, req, length);
             MemTradeOrderMessage* rep = (MemTradeOrderMessage*)buffer;
             string error = CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
             strcpy(rep->error, error.c_str());
             rep->rep_time = x::RawDateTime();
-            broker_->SendRtnMessage(string(buffer, length), kMemTypeTradeOrderRep);
+            SendReply(kMemTypeTradeOrderRep);
 
             {
                 MemTradeOrder* order = (MemTradeOrder*)((char*)req + sizeof(MemTradeOrderMessage));
                 co::fbs::TradeOrderT _order;
                 _order.trade_type = kTradeTypeFuture;
                 _order.fund_id = investor_id_;
-                stringstream ss;
-                ss << front_id_<< "_" << session_id_ << "_" << pInputOrder->OrderRef << "_" << pInputOrder->InstrumentID;
-                string order_no = ss.str();
+                string order_no = order->order_no;  // 报单时记下的委托合同号，可能来自其他报单会话
+                if (order_no.empty()) {
+                    order_no = CtpOrderNo(front_id_, session_id_, atoll(pInputOrder->OrderRef), pInputOrder->InstrumentID);
+                }
                 _order.order_no = order_no;
                 _order.market = order->market;
                 _order.code = order->code;
                 _order.bs_flag = req->bs_flag;
+                _order.hedge_flag = ctp_hedge_flag2std(pInputOrder->CombHedgeFlag[0]);
                 _order.oc_flag = ctp_oc_flag2std(pInputOrder->CombOffsetFlag[0]);
                 _order.volume = order->volume;
                 _order.price = order->price;
@@ -758,6 +1080,9 @@ namespace co {
 
     // 交易所打回的废单会通过该函数返回//
     void CTPTradeSpi::OnErrRtnOrderInsert(CThostFtdcInputOrderField* pInputOrder, CThostFtdcRspInfoField* pRspInfo) {
+        std::unique_lock<std::mutex> callback_lock(callback_mutex_);  // 报单会话的响应在其回调线程中转交
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackErrRtnOrderInsert, pInputOrder, pRspInfo);
+        CTPMetrics::Instance()->Add(&CTPMetricsPage::order_rejects);
         if (pInputOrder) {
             LOG_INFO << "OnErrRtnOrderInsert, InstrumentID: " << pInputOrder->InstrumentID
                 << ", OrderRef: " << pInputOrder->OrderRef
@@ -789,26 +1114,28 @@ namespace co {
             }
             MemTradeOrderMessage* req = (MemTradeOrderMessage*)(req_message.data());
             int length = sizeof(MemTradeOrderMessage) + sizeof(MemTradeOrder) * req->items_size;
-            char buffer[length] = "";
+            char* buffer = NewReply<char>(length);
             memcpy(buffer, req, length);
             MemTradeOrderMessage* rep = (MemTradeOrderMessage*)buffer;
             string error = CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
             strcpy(rep->error, error.c_str());
             rep->rep_time = x::RawDateTime();
-            broker_->SendRtnMessage(string(buffer, length), kMemTypeTradeOrderRep);
+            SendReply(kMemTypeTradeOrderRep);
 
             {
                 MemTradeOrder* order = (MemTradeOrder*)((char*)req + sizeof(MemTradeOrderMessage));
                 co::fbs::TradeOrderT _order;
                 _order.trade_type = kTradeTypeFuture;
                 _order.fund_id = investor_id_;
-                stringstream ss;
-                ss << front_id_<< "_" << session_id_ << "_" << pInputOrder->OrderRef << "_" << pInputOrder->InstrumentID;
-                string order_no = ss.str();
+                string order_no = order->order_no;  // 报单时记下的委托合同号，可能来自其他报单会话
+                if (order_no.empty()) {
+                    order_no = CtpOrderNo(front_id_, session_id_, atoll(pInputOrder->OrderRef), pInputOrder->InstrumentID);
+                }
                 _order.order_no = order_no;
                 _order.market = order->market;
                 _order.code = order->code;
                 _order.bs_flag = req->bs_flag;
+                _order.hedge_flag = ctp_hedge_flag2std(pInputOrder->CombHedgeFlag[0]);
                 _order.oc_flag = ctp_oc_flag2std(pInputOrder->CombOffsetFlag[0]);
                 _order.volume = order->volume;
                 _order.price = order->price;
@@ -823,6 +1150,9 @@ namespace co {
 
     /// 报单操作请求响应//
     void CTPTradeSpi::OnRspOrderAction(CThostFtdcInputOrderActionField* pInputOrderAction, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        std::unique_lock<std::mutex> callback_lock(callback_mutex_);  // 报单会话的响应在其回调线程中转交
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspOrderAction, pInputOrderAction, pRspInfo, nRequestID, bIsLast);
+        CTPMetrics::Instance()->Add(&CTPMetricsPage::withdraw_rejects);
         try {
             LOG_INFO << __FUNCTION__ << ", nRequestID: " << nRequestID << ", ErrorId: " << pRspInfo->ErrorID;
             string req_message;
@@ -836,22 +1166,28 @@ namespace co {
                     LOG_ERROR << "not find nRequestID: " << nRequestID;
                 }
             }
+            if (req_message.empty()) {
+                return;  // 批量撤单中的一笔，没有客户端请求
+            }
 
             MemTradeWithdrawMessage* req = (MemTradeWithdrawMessage*)(req_message.data());
             int length = sizeof(MemTradeWithdrawMessage);
-            char buffer[length] = "";
+            char* buffer = NewReply<char>(length);
             memcpy(buffer, req, length);
             MemTradeWithdrawMessage* rep = (MemTradeWithdrawMessage*)buffer;
             string error = CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
             strcpy(rep->error, error.c_str());
             rep->rep_time = x::RawDateTime();
-            broker_->SendRtnMessage(string(buffer, length), kMemTypeTradeWithdrawRep);
+            SendReply(kMemTypeTradeWithdrawRep);
         } catch (std::exception& e) {
             LOG_ERROR << "OnRspOrderAction: " << e.what();
         }
     }
 
     void CTPTradeSpi::OnErrRtnOrderAction(CThostFtdcOrderActionField* pOrderAction, CThostFtdcRspInfoField* pRspInfo) {
+        std::unique_lock<std::mutex> callback_lock(callback_mutex_);  // 报单会话的响应在其回调线程中转交
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackErrRtnOrderAction, pOrderAction, pRspInfo);
+        CTPMetrics::Instance()->Add(&CTPMetricsPage::withdraw_rejects);
         try {
             LOG_INFO << __FUNCTION__ << ", nRequestID: " << pOrderAction->RequestID << ", ErrorId: " << pRspInfo->ErrorID;
 
@@ -873,18 +1209,186 @@ namespace co {
             }
             MemTradeWithdrawMessage* req = (MemTradeWithdrawMessage*)(req_message.data());
             int length = sizeof(MemTradeWithdrawMessage);
-            char buffer[length] = "";
+            char* buffer = NewReply<char>(length);
             memcpy(buffer, req, length);
             MemTradeWithdrawMessage* rep = (MemTradeWithdrawMessage*)buffer;
             string error = CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
             strcpy(rep->error, error.c_str());
             rep->rep_time = x::RawDateTime();
-            broker_->SendRtnMessage(string(buffer, length), kMemTypeTradeWithdrawRep);
+            SendReply(kMemTypeTradeWithdrawRep);
         } catch (std::exception& e) {
             LOG_ERROR << "OnErrRtnOrderAction: " << e.what();
         }
     }
 
+    void CTPTradeSpi::OnRspBatchOrderAction(CThostFtdcInputBatchOrderActionField* pInputBatchOrderAction, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        std::unique_lock<std::mutex> callback_lock(callback_mutex_);  // 报单会话的响应在其回调线程中转交
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspBatchOrderAction, pInputBatchOrderAction, pRspInfo, nRequestID, bIsLast);
+        if (pRspInfo && pRspInfo->ErrorID != 0) {
+            CTPMetrics::Instance()->Add(&CTPMetricsPage::withdraw_rejects);
+            LOG_ERROR << "batch cancel failed: request_id = " << nRequestID
+                << ", exchange = " << (pInputBatchOrderAction ? pInputBatchOrderAction->ExchangeID : "")
+                << ", " << CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
+        }
+    }
+
+    void CTPTradeSpi::OnErrRtnBatchOrderAction(CThostFtdcBatchOrderActionField* pBatchOrderAction, CThostFtdcRspInfoField* pRspInfo) {
+        std::unique_lock<std::mutex> callback_lock(callback_mutex_);  // 报单会话的响应在其回调线程中转交
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackErrRtnBatchOrderAction, pBatchOrderAction, pRspInfo);
+        CTPMetrics::Instance()->Add(&CTPMetricsPage::withdraw_rejects);
+        if (pRspInfo) {
+            LOG_ERROR << "batch cancel rejected: exchange = " << (pBatchOrderAction ? pBatchOrderAction->ExchangeID : "")
+                << ", " << CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
+        }
+    }
+
+    /// 预埋单录入响应：成功时回报委托合同号，失败时回报错误并撤回内部持仓冻结
+    void CTPTradeSpi::OnRspParkedOrderInsert(CThostFtdcParkedOrderField* pParkedOrder, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspParkedOrderInsert, pParkedOrder, pRspInfo, nRequestID, bIsLast);
+        if (!pParkedOrder) {
+            LOG_ERROR << "OnRspParkedOrderInsert, pParkedOrder is null, nRequestID: " << nRequestID;
+            return;
+        }
+        bool failed = pRspInfo && pRspInfo->ErrorID != 0;
+        LOG_INFO << __FUNCTION__ << ", InstrumentID: " << pParkedOrder->InstrumentID
+            << ", OrderRef: " << pParkedOrder->OrderRef
+            << ", ParkedOrderID: " << pParkedOrder->ParkedOrderID
+            << ", Status: " << pParkedOrder->Status
+            << ", nRequestID: " << nRequestID
+            << ", ErrorId: " << (pRspInfo ? pRspInfo->ErrorID : 0);
+        try {
+            string req_message;
+            co::fbs::TradeOrderT inner_order;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                auto it = req_msg_.find(nRequestID);
+                if (it != req_msg_.end()) {
+                    req_message = it->second;
+                    req_msg_.erase(it);
+                } else {
+                    LOG_ERROR << "OnRspParkedOrderInsert, not find nRequestID: " << nRequestID;
+                }
+                auto itor = parked_orders_.find(string(pParkedOrder->OrderRef) + "_" + pParkedOrder->InstrumentID);
+                if (itor != parked_orders_.end()) {
+                    if (failed) {
+                        inner_order = itor->second.inner_order;
+                        parked_orders_.erase(itor);
+                    } else {
+                        itor->second.parked_order_id = x::Trim(pParkedOrder->ParkedOrderID);
+                    }
+                }
+            }
+            if (failed) {
+                CTPMetrics::Instance()->Add(&CTPMetricsPage::order_rejects);
+                if (!inner_order.order_no.empty()) {
+                    inner_order.withdraw_volume = inner_order.volume;
+                    future_position_master_.Update(inner_order);
+                }
+            }
+            if (req_message.empty()) {
+                return;
+            }
+            MemTradeOrderMessage* req = (MemTradeOrderMessage*)(req_message.data());
+            int length = sizeof(MemTradeOrderMessage) + sizeof(MemTradeOrder) * req->items_size;
+            char* buffer = NewReply<char>(length);
+            memcpy(buffer, req, length);  // 保存的请求中已记下委托合同号
+            MemTradeOrderMessage* rep = (MemTradeOrderMessage*)buffer;
+            if (failed) {
+                string error = CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
+                strcpy(rep->error, error.c_str());
+            }
+            rep->rep_time = x::RawDateTime();
+            SendReply(kMemTypeTradeOrderRep);
+        } catch (std::exception& e) {
+            LOG_ERROR << "OnRspParkedOrderInsert: " << e.what();
+        }
+    }
+
+    /// 预埋撤单录入响应：成功时等待报出后的撤单回报，失败时回报错误
+    void CTPTradeSpi::OnRspParkedOrderAction(CThostFtdcParkedOrderActionField* pParkedOrderAction, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspParkedOrderAction, pParkedOrderAction, pRspInfo, nRequestID, bIsLast);
+        bool failed = pRspInfo && pRspInfo->ErrorID != 0;
+        LOG_INFO << __FUNCTION__ << ", nRequestID: " << nRequestID << ", ErrorId: " << (pRspInfo ? pRspInfo->ErrorID : 0);
+        try {
+            string req_message;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                auto it = req_msg_.find(nRequestID);
+                if (it != req_msg_.end()) {
+                    req_message = it->second;
+                    req_msg_.erase(it);
+                    if (failed) {
+                        withdraw_msg_.erase(((MemTradeWithdrawMessage*)req_message.data())->order_no);
+                    }
+                } else {
+                    LOG_ERROR << "not find nRequestID: " << nRequestID;
+                }
+            }
+            if (!failed || req_message.empty()) {
+                return;
+            }
+            CTPMetrics::Instance()->Add(&CTPMetricsPage::withdraw_rejects);
+            MemTradeWithdrawMessage* rep = NewReply<MemTradeWithdrawMessage>();
+            memcpy(rep, req_message.data(), sizeof(MemTradeWithdrawMessage));
+            string error = CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
+            strcpy(rep->error, error.c_str());
+            rep->rep_time = x::RawDateTime();
+            SendReply(kMemTypeTradeWithdrawRep);
+        } catch (std::exception& e) {
+            LOG_ERROR << "OnRspParkedOrderAction: " << e.what();
+        }
+    }
+
+    /// 删除预埋单响应：成功时按全部撤单回报并撤回内部持仓冻结
+    void CTPTradeSpi::OnRspRemoveParkedOrder(CThostFtdcRemoveParkedOrderField* pRemoveParkedOrder, CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRspRemoveParkedOrder, pRemoveParkedOrder, pRspInfo, nRequestID, bIsLast);
+        bool failed = pRspInfo && pRspInfo->ErrorID != 0;
+        LOG_INFO << __FUNCTION__ << ", nRequestID: " << nRequestID
+            << ", ParkedOrderID: " << (pRemoveParkedOrder ? pRemoveParkedOrder->ParkedOrderID : "")
+            << ", ErrorId: " << (pRspInfo ? pRspInfo->ErrorID : 0);
+        try {
+            string req_message;
+            co::fbs::TradeOrderT inner_order;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                auto it = req_msg_.find(nRequestID);
+                if (it == req_msg_.end()) {
+                    LOG_ERROR << "not find nRequestID: " << nRequestID;
+                    return;
+                }
+                req_message = it->second;
+                req_msg_.erase(it);
+                string order_no = ((MemTradeWithdrawMessage*)req_message.data())->order_no;
+                withdraw_msg_.erase(order_no);
+                if (!failed) {
+                    for (auto itor = parked_orders_.begin(); itor != parked_orders_.end(); ++itor) {
+                        if (itor->second.order_no == order_no) {
+                            inner_order = itor->second.inner_order;
+                            parked_orders_.erase(itor);
+                            break;
+                        }
+                    }
+                }
+            }
+            MemTradeWithdrawMessage* rep = NewReply<MemTradeWithdrawMessage>();
+            memcpy(rep, req_message.data(), sizeof(MemTradeWithdrawMessage));
+            if (failed) {
+                CTPMetrics::Instance()->Add(&CTPMetricsPage::withdraw_rejects);
+                string error = CtpError(pRspInfo->ErrorID, pRspInfo->ErrorMsg);
+                strcpy(rep->error, error.c_str());
+            }
+            rep->rep_time = x::RawDateTime();
+            SendReply(kMemTypeTradeWithdrawRep);
+            if (failed || inner_order.order_no.empty()) {
+                return;
+            }
+
+            SendCancelKnock(inner_order);
+        } catch (std::exception& e) {
+            LOG_ERROR << "OnRspRemoveParkedOrder: " << e.what();
+        }
+    }
+
 /// 报单通知, 报单成功或状态变化
 // 报单流程：
 // 1.客户端调用ReqOrderInsert进行报单;
@@ -896,29 +1400,12 @@ namespace co {
 //   3.2如果交易所返回报单失败（比如超出涨跌停价）, 也会再调用一次OnRtnOrder, 此时没有OrderSysId, 接着还会再调用一次OnErrRtnOrderInsert
 //  RequestID的值是0
     void CTPTradeSpi::OnRtnOrder(CThostFtdcOrderField* pOrder) {
+        std::unique_lock<std::mutex> callback_lock(callback_mutex_);  // 报单会话的响应在其回调线程中转交
+        CTPCallbackTimer timer;
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRtnOrder, pOrder);
+        CTPMetrics::Instance()->Add(&CTPMetricsPage::order_updates);
         if (pOrder) {
-            LOG_INFO << "OnRtnOrder, InstrumentID: " << pOrder->InstrumentID
-                << ", ExchangeID: " << pOrder->ExchangeID
-                << ", FrontID: " << pOrder->FrontID
-                << ", SessionID: " << pOrder->SessionID
-                << ", OrderRef: " << pOrder->OrderRef
-                << ", Direction: " << pOrder->Direction
-                << ", CombOffsetFlag: " << pOrder->CombOffsetFlag
-                << ", RequestID: " << pOrder->RequestID
-                << ", OrderSysID: " << pOrder->OrderSysID
-                << ", OrderStatus: " << pOrder->OrderStatus
-                << ", OrderSubmitStatus: " << pOrder->OrderSubmitStatus
-                << ", TradingDay: " << pOrder->TradingDay
-                << ", GTDDate: " << pOrder->GTDDate
-                << ", InsertDate: " << pOrder->InsertDate
-                << ", InsertTime: " << pOrder->InsertTime
-                << ", CancelTime: " << pOrder->CancelTime
-                << ", ActiveTime: " << pOrder->ActiveTime
-                << ", SuspendTime: " << pOrder->SuspendTime
-                << ", UpdateTime: " << pOrder->UpdateTime
-                << ", LimitPrice: " << pOrder->LimitPrice
-                << ", VolumeTraded: " << pOrder->VolumeTraded
-                << ", VolumeTotal: " << pOrder->VolumeTotal;
+            CTPEventLog::Instance()->Write(kCTPEventRtnOrder, *pOrder);  // 由后台线程格式化，不阻塞回调线程
         }
 
         try {
@@ -926,14 +1413,26 @@ namespace co {
             string order_sys_id = x::Trim(pOrder->OrderSysID);
             int64_t order_ref = atoi(pOrder->OrderRef);
             string ctp_code = pOrder->InstrumentID;
-            stringstream ss;
-            ss << pOrder->FrontID << "_" << pOrder->SessionID << "_" << order_ref << "_" << ctp_code;
-            string order_no = ss.str();
+            string order_no = CtpOrderNo(pOrder->FrontID, pOrder->SessionID, order_ref, pOrder->InstrumentID);
+            string parked_key = std::to_string(order_ref) + "_" + ctp_code;
+            bool parked = false;
+            {
+                // 预埋单报出后仍使用预埋时的委托合同号
+                std::unique_lock<std::mutex> lock(mutex_);
+                auto it = parked_orders_.find(parked_key);
+                if (it != parked_orders_.end()) {
+                    CTPParkedOrder& parked_order = it->second;
+                    parked_order.sent = true;
+                    parked_order.front_id = pOrder->FrontID;
+                    parked_order.session_id = pOrder->SessionID;
+                    order_no = parked_order.order_no;
+                    parked = true;
+                }
+            }
             if (!order_sys_id.empty()) {
                 order_nos_[order_sys_id] = order_no;
             }
             int64_t order_state = ctp_order_state2std(pOrder->OrderStatus, pOrder->OrderSubmitStatus);
-            LOG_INFO << "order_no: " << order_no << ", order_state: " << order_state;
             if (order_state == kOrderPartlyCanceled || order_state == kOrderFullyCanceled) {
                 string req_message = "";
                 {
@@ -946,10 +1445,10 @@ namespace co {
                 }
                 if (req_message.length()) {
                     MemTradeWithdrawMessage *req = (MemTradeWithdrawMessage *) (req_message.data());
-                    MemTradeOrderMessage rep {};
-                    memcpy(&rep, req, sizeof(MemTradeWithdrawMessage));
-                    rep.rep_time = x::RawDateTime();
-                    broker_->SendRtnMessage(string(reinterpret_cast<const char*>(&rep), sizeof(MemTradeWithdrawMessage)), kMemTypeTradeWithdrawRep);
+                    MemTradeWithdrawMessage* rep = NewReply<MemTradeWithdrawMessage>();
+                    memcpy(rep, req, sizeof(MemTradeWithdrawMessage));
+                    rep->rep_time = x::RawDateTime();
+                    SendReply(kMemTypeTradeWithdrawRep);
                 }
             } else {
                 int _RequestID = atol(x::Trim(pOrder->OrderRef).c_str());
@@ -966,13 +1465,13 @@ namespace co {
                 if (req_message.length()) {
                     MemTradeOrderMessage* req = (MemTradeOrderMessage*)(req_message.data());
                     int length = sizeof(MemTradeOrderMessage) + sizeof(MemTradeOrder) * req->items_size;
-                    char buffer[length] = "";
+                    char* buffer = NewReply<char>(length);
                     memcpy(buffer, req, length);
                     MemTradeOrderMessage* rep = (MemTradeOrderMessage*)buffer;
                     auto order = (MemTradeOrder*)((char*)rep + sizeof(MemTradeOrderMessage));
                     strcpy(order->order_no, order_no.c_str());
                     rep->rep_time = x::RawDateTime();
-                    broker_->SendRtnMessage(string(buffer, length), kMemTypeTradeOrderRep);
+                    SendReply(kMemTypeTradeOrderRep);
                 }
             }
 
@@ -990,6 +1489,7 @@ namespace co {
                 _order.code = code;
                 _order.order_no = order_no;
                 _order.bs_flag = ctp_bs_flag2std(pOrder->Direction);
+                _order.hedge_flag = ctp_hedge_flag2std(pOrder->CombHedgeFlag[0]);
                 _order.oc_flag = ctp_oc_flag2std(pOrder->CombOffsetFlag[0]);
                 _order.volume = pOrder->VolumeTotalOriginal;
                 _order.price = pOrder->LimitPrice;
@@ -1006,19 +1506,41 @@ namespace co {
                 }
                 future_position_master_.Update(_order);
             }
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                if (order_state == kOrderFullyKnocked || order_state == kOrderPartlyCanceled || order_state == kOrderFullyCanceled || order_state == kOrderFailed) {
+                    live_orders_.erase(order_no);
+                    if (parked) {
+                        parked_orders_.erase(parked_key);
+                    }
+                } else if (live_orders_.find(order_no) == live_orders_.end()) {
+                    CTPLiveOrder& live = live_orders_[order_no];
+                    live.code = code;
+                    live.bs_flag = ctp_bs_flag2std(pOrder->Direction);
+                    live.front_id = pOrder->FrontID;
+                    live.session_id = pOrder->SessionID;
+                    live.order_ref = pOrder->OrderRef;
+                    live.instrument_id = pOrder->InstrumentID;
+                    live.exchange_id = pOrder->ExchangeID;
+                }
+            }
 
             // -----------------------------------------------------
             if (order_state == kOrderPartlyCanceled || order_state == kOrderFullyCanceled || order_state == kOrderFailed) {
-                MemTradeKnock _knock {};
+                MemTradeKnock& _knock = *NewReply<MemTradeKnock>();
                 if (order_state == kOrderFailed) {
                     _knock.timestamp = x::RawDateTime();
                 } else {
-                    if (strcmp(pOrder->CancelTime, "06:00:00") > 0 && strcmp(pOrder->CancelTime, "18:00:00") <= 0) {
-                        _knock.timestamp = CtpTimestamp(date_, pOrder->CancelTime);
-                    } else if (strcmp(pOrder->CancelTime, "18:00:00") > 0 && strcmp(pOrder->CancelTime, "23:59:59") <= 0) {
-                        _knock.timestamp = CtpTimestamp(pre_trading_day_, pOrder->CancelTime);
+                    // FAK/FOK由交易所立即撤销时可能没有撤销时间，使用最后修改时间
+                    char* cancel_time = pOrder->CancelTime[0] ? pOrder->CancelTime : pOrder->UpdateTime;
+                    if (!cancel_time[0]) {
+                        _knock.timestamp = x::RawDateTime();
+                    } else if (strcmp(cancel_time, "06:00:00") > 0 && strcmp(cancel_time, "18:00:00") <= 0) {
+                        _knock.timestamp = CtpTimestamp(date_, cancel_time);
+                    } else if (strcmp(cancel_time, "18:00:00") > 0 && strcmp(cancel_time, "23:59:59") <= 0) {
+                        _knock.timestamp = CtpTimestamp(pre_trading_day_, cancel_time);
                     } else {
-                        _knock.timestamp = CtpTimestamp(pre_trading_day_next_, pOrder->CancelTime);
+                        _knock.timestamp = CtpTimestamp(pre_trading_day_next_, cancel_time);
                     }
                 }
                 strcpy(_knock.fund_id, investor_id_.c_str());
@@ -1046,7 +1568,7 @@ namespace co {
                 }
                 _knock.match_price = 0;
                 _knock.match_amount = 0;
-                broker_->SendRtnMessage(string(reinterpret_cast<const char*>(&_knock), sizeof(MemTradeKnock)), kMemTypeTradeKnock);
+                SendReply(kMemTypeTradeKnock);
             }
         } catch (std::exception& e) {
             LOG_ERROR << "OnRtnOrder: " << e.what();
@@ -1055,49 +1577,62 @@ namespace co {
 
     /// 成交通知(测试发现, 委托状态更新比成交数据更快)
     void CTPTradeSpi::OnRtnTrade(CThostFtdcTradeField* pTrade) {
+        std::unique_lock<std::mutex> callback_lock(callback_mutex_);  // 报单会话的响应在其回调线程中转交
+        CTPCallbackTimer timer;
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRtnTrade, pTrade);
+        CTPMetrics::Instance()->Add(&CTPMetricsPage::knocks);
+        if (!pTrade) {
+            return;
+        }
         if (!query_instruments_finish_.load()) {
-            all_ftdc_trades_.push_back(*pTrade);
+            all_ftdc_trades_.push_back(*pTrade);  // 已录制和计数，合约表就绪后由HandleRtnTrade处理
             LOG_INFO << "query instrument not finish";
             return;
         }
-        if (pTrade) {
-            LOG_INFO << "OnRtnTrade, InstrumentID: " << pTrade->InstrumentID
-                << ", OrderRef: " << pTrade->OrderRef
-                << ", Direction: " << pTrade->Direction
-                << ", CombOffsetFlag: " << pTrade->OffsetFlag
-                << ", TradeID: " << pTrade->TradeID
-                << ", OrderSysID: " << pTrade->OrderSysID
-                << ", Price: " << pTrade->Price
-                << ", Volume: " << pTrade->Volume
-                << ", TradeTime: " << pTrade->TradeTime
-                << ", TradeDate: " << pTrade->TradeDate
-                << ", TradingDay: " << pTrade->TradingDay;
-        }
+        HandleRtnTrade(pTrade);
+    }
 
+    void CTPTradeSpi::HandleRtnTrade(CThostFtdcTradeField* pTrade) {
+        CTPEventLog::Instance()->Write(kCTPEventRtnTrade, *pTrade);
         try {
+            // 逐笔持仓明细按成交更新，不区分是否本会话的委托
+            string ctp_code = pTrade->InstrumentID;
+            int64_t market = ctp_market2std(pTrade->ExchangeID);
+            if (market == co::kMarketCZCE) {
+                InsertCzceCode(ctp_code);
+            }
+            string suffix =MarketToSuffix(market).data();
+            string code = ctp_code + suffix;
+            CTPMarketData::Instance()->Subscribe(code);  // 开仓后的新持仓
+            string name;
+            int64_t multiple = 1;
+            auto it = all_instruments_.find(code);
+            if (it != all_instruments_.end()) {
+                name = it->second.first;
+                multiple = it->second.second;
+            }
+            {
+                co::fbs::TradeOrderT _knock;
+                _knock.market = market;
+                _knock.code = code;
+                _knock.bs_flag = ctp_bs_flag2std(pTrade->Direction);
+                _knock.hedge_flag = ctp_hedge_flag2std(pTrade->HedgeFlag);
+                _knock.oc_flag = ctp_oc_flag2std(pTrade->OffsetFlag);
+                _knock.volume = pTrade->Volume;
+                _knock.price = pTrade->Price;
+                future_lot_book_.Update(_knock, multiple);
+            }
+
             // CTP推过来的成交数据中没有FrontId和SessionId, 无法生成委托合同号, 需要根据OrderSysId从映射表中查找//
             string order_sys_id = x::Trim(pTrade->OrderSysID);
             string match_no = x::Trim(pTrade->TradeID);
             map<string, string>::iterator itr_order_no = order_nos_.find(order_sys_id);
             if (itr_order_no != order_nos_.end()) {
                 string order_no = itr_order_no->second;
-                string ctp_code = pTrade->InstrumentID;
-                int64_t market = ctp_market2std(pTrade->ExchangeID);
-                if (market == co::kMarketCZCE) {
-                    InsertCzceCode(ctp_code);
-                }
-                string suffix =MarketToSuffix(market).data();
-                string code = ctp_code + suffix;
                 string match_no = x::Trim(pTrade->TradingDay) + "_" + x::Trim(pTrade->TradeID);
-                double match_amount = pTrade->Price * pTrade->Volume;
-                string name;
-                auto it = all_instruments_.find(code);
-                if (it != all_instruments_.end()) {
-                    name = it->second.first;
-                    match_amount = match_amount * it->second.second;
-                }
+                double match_amount = pTrade->Price * pTrade->Volume * multiple;
 
-                MemTradeKnock _knock {};
+                MemTradeKnock& _knock = *NewReply<MemTradeKnock>();
                 if (strcmp(pTrade->TradeTime, "06:00:00") > 0 && strcmp(pTrade->TradeTime, "18:00:00") <= 0) {
                     _knock.timestamp = CtpTimestamp(date_, pTrade->TradeTime);
                 } else if (strcmp(pTrade->TradeTime, "18:00:00") > 0 && strcmp(pTrade->TradeTime, "23:59:59") <= 0) {
@@ -1118,7 +1653,7 @@ namespace co {
                 _knock.match_volume = pTrade->Volume;
                 _knock.match_price = pTrade->Price;
                 _knock.match_amount = match_amount;
-                broker_->SendRtnMessage(string((char*)(&_knock), sizeof(MemTradeKnock)), kMemTypeTradeKnock);
+                SendReply(kMemTypeTradeKnock);
             } else {
                 LOG_WARN << "no order_no found of knock: order_sys_id = " << order_sys_id << ", match_no = " << match_no;
             }
@@ -1127,8 +1662,23 @@ namespace co {
         }
     }
 
+    /// 合约交易状态通知，交易所按品种推送，登录时会补发当日已有的状态
+    void CTPTradeSpi::OnRtnInstrumentStatus(CThostFtdcInstrumentStatusField* pInstrumentStatus) {
+        CTPRecorder::Instance()->Record(investor_id_, kCTPCallbackRtnInstrumentStatus, pInstrumentStatus);
+        if (!pInstrumentStatus) {
+            return;
+        }
+        if (CTPTradingStatus::Instance()->Update(pInstrumentStatus->InstrumentID, pInstrumentStatus->InstrumentStatus)) {
+            LOG_INFO << "instrument status: " << pInstrumentStatus->ExchangeID << "." << pInstrumentStatus->InstrumentID
+                << ", status = " << pInstrumentStatus->InstrumentStatus
+                << ", enter_time = " << pInstrumentStatus->EnterTime
+                << ", enter_reason = " << pInstrumentStatus->EnterReason;
+        }
+    }
+
     /// 错误应答
     void CTPTradeSpi::OnRspError(CThostFtdcRspInfoField* pRspInfo, int nRequestID, bool bIsLast) {
+        CTPRecorder::Instance()->Record<CThostFtdcRspInfoField>(investor_id_, kCTPCallbackRspError, nullptr, pRspInfo, nRequestID, bIsLast);
         LOG_ERROR << "OnRspError: ret=" << pRspInfo->ErrorID << ", msg=" << CtpToUTF8(pRspInfo->ErrorMsg);
         if (pRspInfo->ErrorID == 90) {
             x::Sleep(CTP_FLOW_CONTROL_MS);
@@ -1141,15 +1691,16 @@ namespace co {
             ReqQryInstrument();
         } else if (state_ == kStartupStepGetContractsOver) {
             ReqQryInvestorPosition();
-        } else if (state_ == kStartupStepGetInitPositionsOver) {  // 已启动完成之后，返回异步响应
+        } else if (state_ == kStartupStepGetInitPositionsOver) {
+            ReqQryInvestorPositionDetail();
+        } else if (state_ == kStartupStepGetInitPositionDetailsOver) {  // 已启动完成之后，返回异步响应
 
         }
     }
 
     void CTPTradeSpi::Start() {
         state_ = kStartupStepInit;
-        string ctp_app_id = Config::Instance()->ctp_app_id();
-        if (!ctp_app_id.empty()) {
+        if (!account_.app_id.empty()) {
             ReqAuthenticate();
         } else {
             ReqUserLogin();
@@ -1157,12 +1708,643 @@ namespace co {
     }
 
     void CTPTradeSpi::Wait() {
-        while (state_ < kStartupStepGetInitPositionsOver) {
+        while (state_ < kStartupStepGetInitPositionDetailsOver) {
             x::Sleep(10);
         }
     }
 
+    void CTPTradeSpi::OnInstrumentsReady() {
+        query_instruments_finish_.store(true);
+        for (auto& it : all_ftdc_trades_) {
+            HandleRtnTrade(&it);
+        }
+        all_ftdc_trades_.clear();
+        state_ = kStartupStepGetContractsOver;
+        ReqQryInvestorPosition();
+    }
+
+    void CTPTradeSpi::WaitDisconnected() {
+        std::unique_lock<std::mutex> lock(front_mutex_);
+        front_cv_.wait(lock, [this] { return front_disconnected_; });
+    }
+
+    void CTPTradeSpi::SendKnockChunk(int request_id, bool last) {
+        string req_message;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto it = query_msg_.find(request_id);
+            if (it != query_msg_.end()) {
+                req_message = it->second;
+                if (last) {
+                    query_msg_.erase(it);
+                }
+            } else {
+                LOG_ERROR << "OnRspQryTrade, not find nRequestID: " << request_id;
+            }
+        }
+        if (req_message.empty()) {
+            LOG_ERROR << "OnRspQryTrade, req_message is empty. ";
+            all_knock_.clear();
+            return;
+        }
+        MemGetTradeKnockMessage* req = (MemGetTradeKnockMessage*)(req_message.data());
+        int total_num = all_knock_.size();
+        int length = sizeof(MemGetTradeKnockMessage) + sizeof(MemTradeKnock) * total_num;
+        char* buffer = NewReply<char>(length);
+        MemGetTradeKnockMessage* rep = (MemGetTradeKnockMessage*)buffer;
+        memcpy(rep, req, sizeof(MemGetTradeKnockMessage));
+        rep->items_size = total_num;
+        if (total_num > 0) {
+            memcpy(buffer + sizeof(MemGetTradeKnockMessage), all_knock_.data(), sizeof(MemTradeKnock) * total_num);
+        }
+        if (last) {
+            strcpy(rep->error, rsp_query_msg_.c_str());
+            rep->next_cursor[0] = '\0';  // next_cursor为空表示没有后续批次
+        } else {
+            strcpy(rep->next_cursor, query_cursor_.c_str());  // 中间批次带上本批最后一笔成交的时间，不为空表示还有后续批次
+        }
+        SendReply(kMemTypeQueryTradeKnockRep);
+        all_knock_.clear();
+    }
+
+    void CTPTradeSpi::SendPositionChunks(const CTPPositionQuery& query) {
+        // 持仓需要汇总同一合约的多条记录，只能在全部返回后推送；按批推送以限制单条消息的大小
+        const MemGetTradePositionMessage* req = (const MemGetTradePositionMessage*)(query.req_message.data());
+        int64_t chunk_size = Config::Instance()->query_reply_chunk_size();
+        int64_t total_num = query.positions.size();
+        int64_t sent = 0;
+        auto it = query.positions.begin();
+        while (true) {
+            // 分批推送时数据批次之后总是单独推送一个空批次作为结束，客户端不需要知道批大小；不分批时一次推送全部
+            int64_t num = total_num - sent;
+            bool last = true;
+            if (chunk_size > 0 && num > 0) {
+                num = std::min(num, chunk_size);
+                last = false;
+            }
+            int length = sizeof(MemGetTradePositionMessage) + sizeof(MemTradePosition) * num;
+            char* buffer = NewReply<char>(length);
+            MemGetTradePositionMessage* rep = (MemGetTradePositionMessage*)buffer;
+            memcpy(rep, req, sizeof(MemGetTradePositionMessage));
+            rep->items_size = num;
+            MemTradePosition* first = (MemTradePosition*)(buffer + sizeof(MemGetTradePositionMessage));
+            for (int64_t i = 0; i < num; ++i, ++it) {
+                memcpy(first + i, &it->second, sizeof(MemTradePosition));
+                FillMarketValue(first + i);
+            }
+            if (last && !query.error.empty()) {
+                strcpy(rep->error, query.error.c_str());
+            }
+            SendReply(kMemTypeQueryTradePositionRep);
+            sent += num;
+            if (last) {
+                break;
+            }
+        }
+    }
+
+    void CTPTradeSpi::FillMarketValue(MemTradePosition* pos) {
+        if (!CTPMarketData::Instance()->enabled()) {
+            return;
+        }
+        const CTPInstrumentRecord* record = CTPInstrumentCatalog::Instance()->Find(pos->code);
+        double price = 0;
+        if (record && CTPMarketData::Instance()->GetLastPrice(record, &price)) {
+            pos->long_market_value = pos->long_volume * price * record->multiple;
+            pos->short_market_value = pos->short_volume * price * record->multiple;
+        }
+    }
+
+    void CTPTradeSpi::FillLiveEquity(MemTradeAsset* asset, CThostFtdcTradingAccountField* account) {
+        if (!CTPMarketData::Instance()->enabled()) {
+            return;
+        }
+        int64_t missing = 0;
+        double profit = future_lot_book_.GetPositionProfit([](const string& code, double* last_price, double* pre_settlement_price) {
+            const CTPInstrumentRecord* record = CTPInstrumentCatalog::Instance()->Find(code);
+            return record && CTPMarketData::Instance()->GetPrices(record, last_price, pre_settlement_price);
+        }, &missing);
+        if (missing > 0) {  // 部分合约还没有行情，保留查询时的权益
+            return;
+        }
+        asset->equity += profit - account->PositionProfit;
+    }
+
+    InnerFutureHedgePositions CTPTradeSpi::GetHedgePositions(const CTPPositionQuery& query) {
+        InnerFutureHedgePositions positions;
+        for (auto& it : query.hedge_positions) {
+            vector<MemTradePosition>& items = positions[it.first];
+            for (auto& itor : it.second) {
+                items.push_back(itor.second);
+            }
+        }
+        return positions;
+    }
+
+    void CTPTradeSpi::ReconcilePosition(const CTPPositionQuery& query) {
+        InnerFutureHedgePositions positions = GetHedgePositions(query);
+        bool heal = Config::Instance()->reconcile_self_heal();
+        vector<InnerFutureDrift> drifts = future_position_master_.Reconcile(positions, heal);
+        int64_t healed = 0;
+        for (auto& drift : drifts) {
+            healed += drift.healed ? 1 : 0;
+            LOG_WARN << "[PositionDrift] code=" << drift.code
+                << ", hedge_flag=" << drift.hedge_flag
+                << ", bs_flag=" << drift.bs_flag
+                << ", ctp_volume=" << drift.ctp_volume
+                << ", inner_volume=" << drift.inner_volume
+                << ", ctp_pre_volume=" << drift.ctp_pre_volume
+                << ", inner_pre_volume=" << drift.inner_pre_volume
+                << ", healed=" << (drift.healed ? 1 : 0);
+        }
+        // 逐笔持仓明细与CTP持仓核对数量，并汇总逐笔平仓盈亏
+        double close_profit = 0;
+        for (auto& it : positions) {
+            for (auto& pos : it.second) {
+                for (int64_t bs_flag : {kBsFlagBuy, kBsFlagSell}) {
+                    InnerFutureLotSummary summary;
+                    if (!future_lot_book_.GetSummary(pos.code, it.first, bs_flag, &summary)) {
+                        continue;
+                    }
+                    close_profit += summary.close_profit;
+                    int64_t ctp_volume = bs_flag == kBsFlagBuy ? pos.long_volume : pos.short_volume;
+                    if (summary.td_volume + summary.yd_volume != ctp_volume) {
+                        LOG_WARN << "[LotDrift] code=" << pos.code
+                            << ", hedge_flag=" << it.first
+                            << ", bs_flag=" << bs_flag
+                            << ", ctp_volume=" << ctp_volume
+                            << ", lot_td_volume=" << summary.td_volume
+                            << ", lot_yd_volume=" << summary.yd_volume;
+                    }
+                }
+            }
+        }
+        LOG_INFO << "[PositionReconcile] instruments=" << query.positions.size()
+            << ", drifts=" << drifts.size()
+            << ", healed=" << healed
+            << ", lot_close_profit=" << close_profit;
+        if (!drifts.empty()) {  // 通知客户端持仓存在差异
+            MemMonitorRiskMessage& msg = *NewReply<MemMonitorRiskMessage>();
+            string error = "inner position drift: drifts=" + std::to_string(drifts.size()) + ", healed=" + std::to_string(healed)
+                + ", first=" + drifts.front().code + "_" + std::to_string(drifts.front().hedge_flag) + "_" + std::to_string(drifts.front().bs_flag);
+            strncpy(msg.error, error.c_str(), sizeof(msg.error) - 1);
+            msg.timestamp = x::RawDateTime();
+            SendReply(kMemTypeMonitorRisk);
+        }
+    }
+
+    char* CTPTradeSpi::NewReplyBuffer(int64_t length) {
+        reply_buffer_.assign(length, '\0');  // 容量足够时不会重新分配内存
+        return &reply_buffer_[0];
+    }
+
+    void CTPTradeSpi::SendReply(int64_t type) {
+        if (broker_) {  // 回放时没有broker，只构造回报不推送
+            broker_->SendRtnMessage(reply_buffer_, type);
+        }
+    }
+
+    void CTPTradeSpi::CountRequest(int ret, std::atomic<int64_t> CTPMetricsPage::*sent, std::atomic<int64_t> CTPMetricsPage::*failed) {
+        CTPMetrics* metrics = CTPMetrics::Instance();
+        if (ret == 0) {
+            metrics->Add(sent);
+        } else if (failed) {
+            metrics->Add(failed);
+        }
+        if (is_flow_control(ret)) {
+            metrics->Add(&CTPMetricsPage::flow_control_hits);
+        }
+    }
+
+    int CTPTradeSpi::SendFlowRequest(CTPFlowRequest& req, CThostFtdcTraderApi* api, int64_t front_id, int64_t session_id) {
+        int ret = 0;
+        if (!req.parked_order_id.empty()) {
+            CThostFtdcRemoveParkedOrderField field;
+            memset(&field, 0, sizeof(field));
+            strcpy(field.BrokerID, req.action.BrokerID);
+            strcpy(field.InvestorID, req.action.InvestorID);
+            strncpy(field.ParkedOrderID, req.parked_order_id.c_str(), sizeof(field.ParkedOrderID) - 1);
+            LOG_INFO << "ReqRemoveParkedOrder, request_id: " << req.request_id << ", parked_order_id: " << req.parked_order_id;
+            ret = api->ReqRemoveParkedOrder(&field, req.request_id);
+            CountRequest(ret, &CTPMetricsPage::withdraws_sent, &CTPMetricsPage::withdraw_failures);
+        } else if (req.batch) {
+            CThostFtdcInputBatchOrderActionField field = req.batch_action;
+            LOG_INFO << "ReqBatchOrderAction, request_id: " << req.request_id << ", exchange: " << field.ExchangeID
+                << ", front_id: " << field.FrontID << ", session_id: " << field.SessionID;
+            ret = api->ReqBatchOrderAction(&field, req.request_id);
+            CountRequest(ret, &CTPMetricsPage::withdraws_sent, &CTPMetricsPage::withdraw_failures);
+        } else if (req.withdraw) {
+            if (req.parked) {
+                CThostFtdcParkedOrderActionField field;
+                parked_action2ctp(req.action, &field);
+                LOG_INFO << "ReqParkedOrderAction, request_id: " << req.request_id;
+                ret = api->ReqParkedOrderAction(&field, req.request_id);
+            } else {
+                CThostFtdcInputOrderActionField field = req.action;
+                LOG_INFO << "ReqOrderAction, request_id: " << req.request_id;
+                ret = api->ReqOrderAction(&field, req.request_id);
+            }
+            CountRequest(ret, &CTPMetricsPage::withdraws_sent, &CTPMetricsPage::withdraw_failures);
+        } else {
+            CThostFtdcInputOrderField field = req.order;
+            if (req.parked) {
+                CThostFtdcParkedOrderField parked;
+                parked_order2ctp(field, &parked);
+                LOG_INFO << "ReqParkedOrderInsert, request_id: " << req.request_id << ", order_no: " << req.order_no;
+                ret = api->ReqParkedOrderInsert(&parked, req.request_id);
+            } else {
+                // OnRtnOrder按报出会话的前置和会话编号生成委托合同号，这里保持一致
+                string order_no = CtpOrderNo(front_id, session_id, req.request_id, field.InstrumentID);
+                if (order_no != req.order_no) {
+                    RekeyOrder(&req, order_no);
+                }
+                ret = api->ReqOrderInsert(&field, req.request_id);
+            }
+            CountRequest(ret, &CTPMetricsPage::orders_sent, &CTPMetricsPage::order_send_failures);
+            CTPEventLog::Instance()->Write(kCTPEventInputOrder, field);
+        }
+        return ret;
+    }
+
+    void CTPTradeSpi::RekeyOrder(CTPFlowRequest* req, const string& order_no) {
+        LOG_WARN << "session changed while order queued: order_no = " << req->order_no << " -> " << order_no;
+        co::fbs::TradeOrderT old_order = req->inner_order;
+        old_order.withdraw_volume = old_order.volume;  // 撤回旧编号的冻结
+        future_position_master_.Update(old_order);
+        req->order_no = order_no;
+        req->inner_order.order_no = order_no;
+        future_position_master_.Update(req->inner_order);
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = req_msg_.find(req->request_id);
+        if (it != req_msg_.end()) {
+            MemTradeOrder* saved = (MemTradeOrder*)(&it->second[0] + sizeof(MemTradeOrderMessage));
+            memset(saved->order_no, 0, sizeof(saved->order_no));
+            strncpy(saved->order_no, order_no.c_str(), sizeof(saved->order_no) - 1);
+        }
+    }
+
+    vector<string> CTPTradeSpi::CancelOrders(const string& code, int64_t bs_flag) {
+        vector<std::pair<string, CTPLiveOrder>> orders;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (auto& it : live_orders_) {
+                const CTPLiveOrder& order = it.second;
+                if ((code.empty() || order.code == code) && (bs_flag == 0 || order.bs_flag == bs_flag)) {
+                    orders.emplace_back(it.first, order);
+                }
+            }
+        }
+        // 仍在流控队列中的报单在本地撤销
+        vector<CTPFlowRequest> queued = RemoveQueuedOrders([&](const CTPFlowRequest& r) {
+            return (code.empty() || r.inner_order.code == code) && (bs_flag == 0 || r.inner_order.bs_flag == bs_flag);
+        });
+        vector<string> order_nos;
+        for (auto& r : queued) {
+            CancelQueuedOrder(r);
+            order_nos.push_back(r.order_no);
+        }
+        const vector<string>& batch_exchanges = Config::Instance()->ctp_batch_action_exchanges();
+        bool batch = code.empty() && bs_flag == 0 && !batch_exchanges.empty();
+        std::map<std::tuple<int, int, string>, bool> batches;  // (前置编号, 会话编号, 交易所) -> 是否已发出
+        for (auto& it : orders) {
+            const CTPLiveOrder& order = it.second;
+            CTPFlowRequest flow_req;
+            flow_req.withdraw = true;
+            flow_req.mass = true;
+            flow_req.request_id = GetRequestID();
+            flow_req.order_no = it.first;
+            if (batch && std::find(batch_exchanges.begin(), batch_exchanges.end(), order.exchange_id) != batch_exchanges.end()) {
+                // 批量撤单按会话撤销该交易所的全部委托，同会话同交易所的其他委托随之撤销
+                auto key = std::make_tuple(order.front_id, order.session_id, order.exchange_id);
+                auto batch_it = batches.find(key);
+                if (batch_it != batches.end()) {
+                    if (batch_it->second) {
+                        order_nos.push_back(it.first);
+                    }
+                    continue;
+                }
+                batches[key] = false;
+                CThostFtdcInputBatchOrderActionField& field = flow_req.batch_action;
+                memset(&field, 0, sizeof(field));
+                strcpy(field.BrokerID, broker_id_.c_str());
+                strcpy(field.InvestorID, investor_id_.c_str());
+                strcpy(field.UserID, investor_id_.c_str());
+                field.OrderActionRef = flow_req.request_id;
+                field.RequestID = flow_req.request_id;
+                field.FrontID = order.front_id;
+                field.SessionID = order.session_id;
+                strncpy(field.ExchangeID, order.exchange_id.c_str(), sizeof(field.ExchangeID) - 1);
+                flow_req.batch = true;
+            } else {
+                CThostFtdcInputOrderActionField& field = flow_req.action;
+                memset(&field, 0, sizeof(field));
+                strcpy(field.BrokerID, broker_id_.c_str());
+                strcpy(field.InvestorID, investor_id_.c_str());
+                field.ActionFlag = THOST_FTDC_AF_Delete;
+                field.FrontID = order.front_id;
+                field.SessionID = order.session_id;
+                strncpy(field.OrderRef, order.order_ref.c_str(), sizeof(field.OrderRef) - 1);
+                strncpy(field.InstrumentID, order.instrument_id.c_str(), sizeof(field.InstrumentID) - 1);
+                strncpy(field.ExchangeID, order.exchange_id.c_str(), sizeof(field.ExchangeID) - 1);
+            }
+            CTPOrderSession* session = PickOrderSession();
+            int ret = session ? session->Send(flow_req) : flow_control_.Send(flow_req);
+            if (ret != 0) {
+                FailWithdrawRequest(flow_req, ret);
+            } else {
+                if (flow_req.batch) {
+                    batches[std::make_tuple(order.front_id, order.session_id, order.exchange_id)] = true;
+                }
+                order_nos.push_back(it.first);
+            }
+        }
+        return order_nos;
+    }
+
+    void CTPTradeSpi::StartOrderSessions() {
+        int64_t count = Config::Instance()->ctp_order_sessions();
+        for (int64_t i = 1; i < count; ++i) {
+            std::shared_ptr<CTPOrderSession> session = std::make_shared<CTPOrderSession>(this, account_, (int)i);
+            session->Start();
+            order_sessions_.push_back(session);
+        }
+    }
+
+    bool CTPTradeSpi::IsParkedOrderTime(const CTPInstrumentRecord* record) {
+        const vector<std::pair<int64_t, int64_t>>& times = Config::Instance()->ctp_parked_order_times();
+        if (times.empty()) {
+            return false;  // 没有配置时不使用预埋单
+        }
+        if (record) {
+            // 交易所按品种推送的状态比本地时钟准确，能覆盖节假日后没有夜盘、临时休市等情况
+            char status = CTPTradingStatus::Instance()->Get(record->instrument_id, record->product_id);
+            if (status != 0) {
+                return status == THOST_FTDC_IS_BeforeTrading || status == THOST_FTDC_IS_NoTrading;
+            }
+        }
+        int64_t now = (x::RawDateTime() / 1000) % 1000000;  // HHMMSS
+        for (auto& it : times) {
+            if (now >= it.first && now < it.second) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool CTPTradeSpi::CheckOrder(MemTradeOrderMessage* req, string* error) {
+        MemTradeOrder* order = (MemTradeOrder*)((char*)req + sizeof(MemTradeOrderMessage));
+        CTPInstrumentCatalog* catalog = CTPInstrumentCatalog::Instance();
+        const CTPInstrumentRecord* record = catalog->Find(order->code);
+        // 按合约表做静态检查，交易所会拒绝的报单不再发出
+        CTPOrderCondition cond;
+        if (!ParseOrderCondition(order->price_type, order->volume, &cond, error)) {
+            LOG_WARN << "reject order: " << order->code << ", " << *error;
+            return false;
+        }
+        TThostFtdcOrderPriceTypeType price_type = order_price_type2ctp(cond.price_type);
+        if (order->volume <= 0) {
+            *error = "not valid volume: " + std::to_string(order->volume);
+        } else if (order->hedge_flag != 0 && order->hedge_flag != kHedgeFlagSpeculate
+            && order->hedge_flag != kHedgeFlagArbitrage && order->hedge_flag != kHedgeFlagHedge) {  // 0为未指定，按投机处理
+            *error = "not valid hedge_flag: " + std::to_string(order->hedge_flag);
+        } else if (!record && catalog->ready()) {
+            *error = string("instrument not found: ") + order->code;
+        } else if (record) {
+            bool limit = price_type == THOST_FTDC_OPT_LimitPrice;
+            int64_t max_volume = limit ? record->max_limit_order_volume : record->max_market_order_volume;
+            int64_t min_volume = limit ? record->min_limit_order_volume : record->min_market_order_volume;
+            if (record->expire_date > 0 && date_ > 0 && record->expire_date < date_) {
+                *error = string("instrument is expired: ") + order->code + ", expire_date = " + std::to_string(record->expire_date);
+            } else if (max_volume > 0 && order->volume > max_volume) {
+                *error = "volume is more than max order volume: " + std::to_string(order->volume) + " > " + std::to_string(max_volume);
+            } else if (min_volume > 0 && order->volume < min_volume) {
+                *error = "volume is less than min order volume: " + std::to_string(order->volume) + " < " + std::to_string(min_volume);
+            } else if (limit && order->price <= 0) {
+                *error = "not valid price: " + std::to_string(order->price);
+            } else if (limit && record->price_tick > 0) {
+                double ticks = order->price / record->price_tick;
+                if (std::fabs(ticks - std::round(ticks)) > 1e-6) {
+                    *error = "price is not multiple of price tick: " + std::to_string(order->price) + ", price_tick = " + std::to_string(record->price_tick);
+                }
+            }
+            double upper = 0;
+            double lower = 0;
+            if (error->empty() && limit && Config::Instance()->ctp_price_limit_check() && catalog->GetPriceLimit(record, &upper, &lower)) {
+                double eps = record->price_tick > 0 ? record->price_tick * 1e-6 : 1e-9;
+                if (order->price > upper + eps || order->price < lower - eps) {
+                    *error = "price is out of limit: " + std::to_string(order->price) + ", limit = [" + std::to_string(lower) + ", " + std::to_string(upper) + "]";
+                }
+            }
+        }
+        if (!error->empty()) {
+            LOG_WARN << "reject order: " << order->code << ", " << *error;
+            return false;
+        }
+        // 非交易阶段的报单在本地拒绝，预埋单由CTP在交易时段开始时报出，不检查
+        if (record && Config::Instance()->ctp_trading_status_check() && !IsParkedOrderTime(record)) {
+            char status = CTPTradingStatus::Instance()->Get(record->instrument_id, record->product_id);
+            if (!CTPTradingStatus::IsTradable(status)) {
+                *error = string("instrument is not in trading: ") + order->code + ", status = " + status;
+                LOG_WARN << "reject order: " << *error;
+                return false;
+            }
+        }
+        return true;
+    }
+
+    CTPOrderSession* CTPTradeSpi::PickOrderSession() {
+        size_t count = order_sessions_.size() + 1;
+        for (size_t i = 1; i < count; ++i) {
+            size_t index = next_session_++ % count;
+            if (index == 0) {
+                return nullptr;
+            }
+            if (order_sessions_[index - 1]->ready()) {
+                return order_sessions_[index - 1].get();
+            }
+        }
+        return nullptr;
+    }
+
+    void CTPTradeSpi::OnFlowRequestFailed(const CTPFlowRequest& req, int ret) {
+        if (req.withdraw) {
+            FailWithdrawRequest(req, ret);
+        } else {
+            FailOrderRequest(req, ret);
+        }
+    }
+
+    void CTPTradeSpi::FailOrderRequest(const CTPFlowRequest& req, int ret) {
+        string req_message;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto it = req_msg_.find(req.request_id);
+            if (it != req_msg_.end()) {
+                req_message = it->second;
+                req_msg_.erase(it);
+            }
+        }
+        if (req.parked) {
+            std::unique_lock<std::mutex> lock(mutex_);
+            parked_orders_.erase(string(req.order.OrderRef) + "_" + req.order.InstrumentID);
+        }
+        co::fbs::TradeOrderT inner_order = req.inner_order;
+        inner_order.withdraw_volume = inner_order.volume;  // 未报出的委托按全部撤单撤回冻结
+        future_position_master_.Update(inner_order);
+        if (req_message.empty()) {
+            LOG_ERROR << "order failed but request not found: request_id = " << req.request_id;
+            return;
+        }
+        string error = "order faild, ret: " + std::to_string(ret) + ", " + CtpApiError(ret);
+        MemTradeOrderMessage* rep = NewReply<MemTradeOrderMessage>();
+        memcpy(rep, req_message.data(), sizeof(MemTradeOrderMessage));
+        strcpy(rep->error, error.c_str());
+        rep->rep_time = x::RawDateTime();
+        SendReply(kMemTypeTradeOrderRep);
+    }
+
+    vector<CTPFlowRequest> CTPTradeSpi::RemoveQueued(const std::function<bool(const CTPFlowRequest&)>& match) {
+        vector<CTPFlowRequest> removed = flow_control_.Remove(match);
+        for (auto& session : order_sessions_) {
+            vector<CTPFlowRequest> reqs = session->Remove(match);
+            removed.insert(removed.end(), reqs.begin(), reqs.end());
+        }
+        return removed;
+    }
+
+    vector<CTPFlowRequest> CTPTradeSpi::RemoveQueuedOrders(const std::function<bool(const CTPFlowRequest&)>& match) {
+        vector<CTPFlowRequest> orders = RemoveQueued([&match](const CTPFlowRequest& r) { return !r.withdraw && match(r); });
+        if (orders.empty()) {
+            return orders;
+        }
+        // 撤单可能经其他会话排队，报单在本地撤销后这些撤单不再发送，按撤单成功回报
+        std::set<string> order_nos;
+        for (auto& r : orders) {
+            order_nos.insert(r.order_no);
+        }
+        vector<CTPFlowRequest> withdraws = RemoveQueued([&order_nos](const CTPFlowRequest& r) {
+            return r.withdraw && !r.batch && r.parked_order_id.empty() && order_nos.count(r.order_no) > 0;
+        });
+        for (auto& r : withdraws) {
+            string req_message;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                auto it = req_msg_.find(r.request_id);
+                if (it != req_msg_.end()) {
+                    req_message = it->second;
+                    req_msg_.erase(it);
+                }
+                withdraw_msg_.erase(r.order_no);
+            }
+            if (r.mass || req_message.empty()) {
+                continue;
+            }
+            MemTradeWithdrawMessage* rep = NewReply<MemTradeWithdrawMessage>();
+            memcpy(rep, req_message.data(), sizeof(MemTradeWithdrawMessage));
+            rep->rep_time = x::RawDateTime();
+            SendReply(kMemTypeTradeWithdrawRep);
+        }
+        return orders;
+    }
+
+    void CTPTradeSpi::CancelQueuedOrder(const CTPFlowRequest& req) {
+        string req_message;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto it = req_msg_.find(req.request_id);
+            if (it != req_msg_.end()) {
+                req_message = it->second;
+                req_msg_.erase(it);
+            }
+            if (req.parked) {
+                parked_orders_.erase(string(req.order.OrderRef) + "_" + req.order.InstrumentID);
+            }
+        }
+        LOG_INFO << "cancel queued order: order_no = " << req.order_no << ", request_id = " << req.request_id;
+        if (!req_message.empty()) {
+            // 委托回报只在首次OnRtnOrder时发出，未报出的委托在这里补发，保存的请求中已记下委托合同号
+            MemTradeOrderMessage* msg = (MemTradeOrderMessage*)(req_message.data());
+            int length = sizeof(MemTradeOrderMessage) + sizeof(MemTradeOrder) * msg->items_size;
+            char* buffer = NewReply<char>(length);
+            memcpy(buffer, msg, length);
+            ((MemTradeOrderMessage*)buffer)->rep_time = x::RawDateTime();
+            SendReply(kMemTypeTradeOrderRep);
+        }
+        SendCancelKnock(req.inner_order);
+    }
+
+    void CTPTradeSpi::SendCancelKnock(co::fbs::TradeOrderT inner_order) {
+        inner_order.withdraw_volume = inner_order.volume;
+        future_position_master_.Update(inner_order);
+        MemTradeKnock& _knock = *NewReply<MemTradeKnock>();
+        _knock.timestamp = x::RawDateTime();
+        strcpy(_knock.fund_id, investor_id_.c_str());
+        string match_no = "_" + inner_order.order_no;
+        strcpy(_knock.order_no, inner_order.order_no.c_str());
+        strcpy(_knock.match_no, match_no.c_str());
+        strcpy(_knock.code, inner_order.code.c_str());
+        _knock.market = inner_order.market;
+        auto it = all_instruments_.find(inner_order.code);
+        if (it != all_instruments_.end()) {
+            strcpy(_knock.name, it->second.first.c_str());
+        }
+        _knock.bs_flag = inner_order.bs_flag;
+        _knock.oc_flag = inner_order.oc_flag;
+        _knock.match_type = kMatchTypeWithdrawOK;
+        _knock.match_volume = inner_order.volume;
+        _knock.match_price = 0;
+        _knock.match_amount = 0;
+        SendReply(kMemTypeTradeKnock);
+    }
+
+    void CTPTradeSpi::FailWithdrawRequest(const CTPFlowRequest& req, int ret) {
+        if (req.mass) {
+            LOG_WARN << "cancel order failed: order_no = " << req.order_no << ", ret: " << ret << ", " << CtpApiError(ret);
+            return;
+        }
+        string req_message;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto it = req_msg_.find(req.request_id);
+            if (it != req_msg_.end()) {
+                req_message = it->second;
+                req_msg_.erase(it);
+            }
+            withdraw_msg_.erase(req.order_no);
+        }
+        if (req_message.empty()) {
+            LOG_ERROR << "withdraw failed but request not found: request_id = " << req.request_id;
+            return;
+        }
+        string error = "withdraw faild, ret: " + std::to_string(ret) + ", " + CtpApiError(ret);
+        MemTradeWithdrawMessage* rep = NewReply<MemTradeWithdrawMessage>();
+        memcpy(rep, req_message.data(), sizeof(MemTradeWithdrawMessage));
+        strcpy(rep->error, error.c_str());
+        rep->rep_time = x::RawDateTime();
+        SendReply(kMemTypeTradeWithdrawRep);
+    }
+
+    void CTPTradeSpi::BindCallbackThread() {
+        // 回调线程由SDK创建，只能在第一次回调时设置；重连后仍是同一个线程
+        int64_t tid = GetThreadID();
+        if (callback_tid_.exchange(tid) == tid) {
+            return;
+        }
+        SetThreadName("ctp_spi");
+        int cpu = Config::Instance()->ctp_callback_cpu();
+        if (cpu >= 0 && !replay_) {
+            SetThreadAffinity({cpu});
+        }
+        if (!replay_) {
+            SetThreadFifo(Config::Instance()->ctp_thread_priority());
+        }
+        LOG_INFO << "ctp callback thread: tid = " << tid;
+    }
+
     void CTPTradeSpi::PrepareQuery() {
+        CTPMetrics::Instance()->Add(&CTPMetricsPage::query_waiting);
+        std::unique_lock<std::mutex> lock(query_mutex_);
+        CTPMetrics::Instance()->Add(&CTPMetricsPage::query_waiting, -1);
         int64_t elapsed_ms = x::Timestamp() - pre_query_timestamp_;
         int64_t Sleep_ms = CTP_FLOW_CONTROL_MS - elapsed_ms;
         if (Sleep_ms > 0) {
@@ -1,9 +1,21 @@
 // Copyright 2021 Fancapital Inc.  All rights reserved.
 #pragma once
+#include <condition_variable>
 #include <mutex>
+#include <set>
+#include <shared_mutex>
 #include "ctp_support.h"
 #include "config.h"
 #include "inner_future_master.h"
+#include "inner_future_lot.h"
+#include "ctp_metrics.h"
+#include "ctp_recorder.h"
+#include "ctp_thread.h"
+#include "ctp_flow_control.h"
+#include "ctp_instrument.h"
+#include "ctp_order_session.h"
+#include "ctp_trading_status.h"
+#include "ctp_market_data.h"
 
 using namespace std;
 using namespace x;
@@ -15,15 +27,71 @@ namespace co {
     constexpr int kStartupStepConfirmSettlementOver = 2;
     constexpr int kStartupStepGetContractsOver = 3;
     constexpr int kStartupStepGetInitPositionsOver = 4;
+    constexpr int kStartupStepGetInitPositionDetailsOver = 5;
+
+    /**
+     * 未完成的委托，批量撤单时按合约、方向筛选
+     */
+struct CTPLiveOrder {
+    string code;  // 带市场后缀的代码
+    int64_t bs_flag = 0;
+    int front_id = 0;
+    int session_id = 0;
+    string order_ref;
+    string instrument_id;
+    string exchange_id;
+};
+
+    /**
+     * 一次持仓查询的结果，按nRequestID分别汇总，客户端查询与对账查询同时进行时互不影响
+     */
+struct CTPPositionQuery {
+    string req_message;  // 请求消息，启动时的查询和回放时为空
+    bool reconcile = false;  // 对账查询，结果不推送给客户端
+    string error;
+    std::unordered_map<std::string, MemTradePosition> positions;  // code -> 持仓，推送给客户端的持仓按合约汇总
+    std::map<int64_t, std::unordered_map<std::string, MemTradePosition>> hedge_positions;  // hedge_flag -> code -> 持仓
+};
+
+    /**
+     * 预埋单，CTP在交易时段开始时报出，报出后的前置和会话编号可能与预埋时不同
+     */
+struct CTPParkedOrder {
+    string order_no;  // 预埋时分配的委托合同号，报出后的回报仍使用该编号
+    string parked_order_id;  // CTP的预埋单编号，预埋成功后才有，删除预埋单时使用
+    bool sent = false;  // 已由CTP报出
+    int front_id = 0;  // 报出后的前置编号，撤单时使用
+    int session_id = 0;  // 报出后的会话编号
+    co::fbs::TradeOrderT inner_order;  // 已计入内部持仓的委托，预埋失败或删除时撤回
+};
 
 class CTPBroker;
 class CTPTradeSpi : public CThostFtdcTraderSpi {
  public:
-    CTPTradeSpi(CTPBroker* broker);
-    virtual ~CTPTradeSpi() = default;
+    friend class CTPOrderSession;
+    explicit CTPTradeSpi(CTPBroker* broker);  // 使用配置中的第一个资金账号
+    CTPTradeSpi(CTPBroker* broker, const CTPAccount& account);
+    virtual ~CTPTradeSpi();
+
+    /**
+     * 切换前置时替换API
+     * 发送请求时持有api_mutex_的共享锁，这里取独占锁，返回时已没有使用旧API的请求，调用方可以立即释放旧API
+     * @return 旧的API，首次设置时为nullptr
+     */
+    inline CThostFtdcTraderApi* SwapApi(CThostFtdcTraderApi* api) {
+        CThostFtdcTraderApi* old_api = nullptr;
+        {
+            std::unique_lock<std::shared_mutex> lock(api_mutex_);
+            old_api = api_.exchange(api);
+        }
+        std::unique_lock<std::mutex> lock(front_mutex_);
+        front_disconnected_ = false;
+        return old_api;
+    }
 
-    inline void SetApi(CThostFtdcTraderApi* api) {
-        api_ = api;
+    // 回放模式：不向CTP发送请求，不写持仓日志，回报只构造不推送，见CTPReplayer
+    inline void set_replay(bool value) {
+        replay_ = value;
     }
 
     void ReqAuthenticate();  // 客户端认证请求
@@ -31,6 +99,9 @@ class CTPTradeSpi : public CThostFtdcTraderSpi {
     void ReqSettlementInfoConfirm();  // 请求确认结算单，确认后才可以进行交易
     void ReqQryInstrument();
     void ReqQryInvestorPosition();
+    void ReqQryInvestorPositionDetail();  // 查询持仓明细，用于初始化逐笔持仓
+    void ReqReconcilePosition();  // 定时查询CTP持仓并与内部持仓对账，查询结果不推送给客户端
+    void ReqQryPriceLimits();  // 查询全市场行情，缓存各合约的涨跌停价
 
     void OnQueryTradeAsset(MemGetTradeAssetMessage* req);
 
@@ -42,6 +113,16 @@ class CTPTradeSpi : public CThostFtdcTraderSpi {
 
     void OnTradeWithdraw(MemTradeWithdrawMessage* req);
 
+    /**
+     * 批量撤单：撤销符合条件的全部未完成委托
+     * 不限合约和方向时，ctp_batch_action_exchanges中的交易所按会话用ReqBatchOrderAction一次撤销，其他委托逐笔撤单，由流控均匀发出
+     * @param code: 带市场后缀的代码，为空时不限合约
+     * @param bs_flag: 为0时不限方向
+     * 仍在流控队列中的报单直接从队列取出并在本地撤单
+     * @return 已发出（含排队）撤单请求或已在本地撤销的委托合同号，批量撤单覆盖的委托逐一列出
+     */
+    vector<string> CancelOrders(const string& code, int64_t bs_flag);
+
 //    void OnQueryTradeAsset(const std::string& raw_req);
 //    void OnQueryTradePosition(const std::string& raw_req);
 //    void OnQueryTradeKnock(const std::string& raw_req);
@@ -78,6 +159,12 @@ class CTPTradeSpi : public CThostFtdcTraderSpi {
     /// 请求查询投资者持仓响应
     virtual void OnRspQryInvestorPosition(CThostFtdcInvestorPositionField *pInvestorPosition, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
 
+    /// 请求查询投资者持仓明细响应
+    virtual void OnRspQryInvestorPositionDetail(CThostFtdcInvestorPositionDetailField *pInvestorPositionDetail, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
+
+    /// 请求查询行情响应
+    virtual void OnRspQryDepthMarketData(CThostFtdcDepthMarketDataField *pDepthMarketData, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
+
     /// 请求查询报单响应
     virtual void OnRspQryOrder(CThostFtdcOrderField *pOrder, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
 
@@ -96,57 +183,141 @@ class CTPTradeSpi : public CThostFtdcTraderSpi {
     /// 报单操作错误回报
     virtual void OnErrRtnOrderAction(CThostFtdcOrderActionField *pOrderAction, CThostFtdcRspInfoField *pRspInfo);
 
+    ///批量报单操作请求响应
+    virtual void OnRspBatchOrderAction(CThostFtdcInputBatchOrderActionField *pInputBatchOrderAction, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
+
+    ///批量报单操作错误回报
+    virtual void OnErrRtnBatchOrderAction(CThostFtdcBatchOrderActionField *pBatchOrderAction, CThostFtdcRspInfoField *pRspInfo);
+
+    ///预埋单录入请求响应
+    virtual void OnRspParkedOrderInsert(CThostFtdcParkedOrderField *pParkedOrder, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
+
+    ///预埋撤单录入请求响应
+    virtual void OnRspParkedOrderAction(CThostFtdcParkedOrderActionField *pParkedOrderAction, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
+
+    ///删除预埋单响应
+    virtual void OnRspRemoveParkedOrder(CThostFtdcRemoveParkedOrderField *pRemoveParkedOrder, CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
+
     /// 报单通知
     virtual void OnRtnOrder(CThostFtdcOrderField *pOrder);
 
     /// 成交通知
     virtual void OnRtnTrade(CThostFtdcTradeField *pTrade);
 
+    /// 合约交易状态通知
+    virtual void OnRtnInstrumentStatus(CThostFtdcInstrumentStatusField *pInstrumentStatus);
+
     /// 错误应答
     virtual void OnRspError(CThostFtdcRspInfoField *pRspInfo, int nRequestID, bool bIsLast);
 
     // 等待查询合约信息结束
     void Wait();
+    // 等待当前前置断开，多前置时由CTPBroker切换到下一个前置
+    void WaitDisconnected();
+    // 启动额外的报单会话（ctp_order_sessions - 1个），启动完成后调用
+    void StartOrderSessions();
+
+    inline int64_t callback_tid() const {
+        return callback_tid_.load();
+    }
+
+    inline const CTPAccount& account() const {
+        return account_;
+    }
 
  protected:
     void Start();
+    void OnInstrumentsReady();  // 合约表已就绪，继续查询初始持仓
+    void HandleRtnTrade(CThostFtdcTradeField* pTrade);  // 处理成交回报，不录制也不计数，OnRtnTrade和合约表就绪后处理缓存的成交时调用
     int GetRequestID();
     void PrepareQuery();
+    void BindCallbackThread();
+    int SendFlowRequest(CTPFlowRequest& req, CThostFtdcTraderApi* api, int64_t front_id, int64_t session_id);  // 流控放行后实际发送报单或撤单，front_id和session_id为发送会话的编号
+    void RekeyOrder(CTPFlowRequest* req, const string& order_no);  // 排队期间发送会话重连，把内部持仓的冻结和保存的请求改到报出时的委托合同号
+    CTPOrderSession* PickOrderSession();  // 轮流选择发送会话，返回nullptr时使用主会话
+    // 是否使用预埋单：按合约的交易状态判断（开盘前、非交易），没有合约或没有收到状态时按ctp_parked_order_times的本地时段判断
+    bool IsParkedOrderTime(const CTPInstrumentRecord* record);
+    bool CheckOrder(MemTradeOrderMessage* req, string* error);  // 报单前的本地检查，不通过时不报出，error为拒绝原因
+    void OnFlowRequestFailed(const CTPFlowRequest& req, int ret);
+    void FailOrderRequest(const CTPFlowRequest& req, int ret);  // 撤回内部持仓冻结并回报错误
+    void FailWithdrawRequest(const CTPFlowRequest& req, int ret);
+    vector<CTPFlowRequest> RemoveQueued(const std::function<bool(const CTPFlowRequest&)>& match);  // 从主会话和全部报单会话的流控队列中取出请求
+    vector<CTPFlowRequest> RemoveQueuedOrders(const std::function<bool(const CTPFlowRequest&)>& match);  // 取出排队中的报单，同时取出并回报针对这些报单的排队撤单
+    void CancelQueuedOrder(const CTPFlowRequest& req);  // 尚未报出的报单在本地撤单：回报委托后按全部撤单回报
+    void SendCancelKnock(co::fbs::TradeOrderT inner_order);  // 撤回未报出委托的内部持仓冻结并回报撤单成交
+    void CountRequest(int ret, std::atomic<int64_t> CTPMetricsPage::*sent, std::atomic<int64_t> CTPMetricsPage::*failed);  // 按请求返回值累加指标
+    void QueryTradePosition(MemGetTradePositionMessage* req, bool reconcile);
+    void ReconcilePosition(const CTPPositionQuery& query);
+    InnerFutureHedgePositions GetHedgePositions(const CTPPositionQuery& query);
+    void SendKnockChunk(int request_id, bool last);  // 推送已收到的成交，last为true时为最后一批
+    void SendPositionChunks(const CTPPositionQuery& query);
+    void FillMarketValue(MemTradePosition* pos);  // 按行情会话的最新价计算持仓市值，没有行情时不填
+    void FillLiveEquity(MemTradeAsset* asset, CThostFtdcTradingAccountField* account);  // 按行情会话的最新价重算持仓盈亏，替换权益中查询时的PositionProfit
+
+    /**
+        * 回报消息：在当前线程复用的回报缓冲区中构造消息（已清零），SendReply时由SendRtnMessage复制到回报队列。
+        * MemBroker只提供按string发送的接口，不能在共享内存队列中原地构造，这里只省去栈上构造和每条回报的内存分配，并非零拷贝。
+        * 同一线程在SendReply之前不能再次NewReply。
+        */
+    template<typename T>
+    inline T* NewReply(int64_t length = sizeof(T)) {
+        return reinterpret_cast<T*>(NewReplyBuffer(length));
+    }
+    char* NewReplyBuffer(int64_t length);
+    void SendReply(int64_t type);
     string GetContractName(const string code);
 
  private:
     int state_ = 0;
+    std::atomic_bool ready_ {false};  // 首次启动完成，之后重连登录时保留内部持仓和委托映射，不再重新初始化
+    std::mutex front_mutex_;
+    std::condition_variable front_cv_;
+    bool front_disconnected_ = false;
+    CTPAccount account_;
     string broker_id_;
     string investor_id_;
     int64_t date_ = 0;
-    int64_t front_id_ = 0;
-    int64_t session_id_ = 0;
+    std::atomic<int64_t> front_id_ {0};  // 报单线程生成委托合同号时读取
+    std::atomic<int64_t> session_id_ {0};
 
     int64_t pre_trading_day_ = 0;
     int64_t pre_trading_day_next_ = 0;
 
     CTPBroker* broker_ = nullptr;
-    CThostFtdcTraderApi* api_ = nullptr;
+    std::atomic<CThostFtdcTraderApi*> api_ {nullptr};
+    std::shared_mutex api_mutex_;  // 报单线程和查询线程发送请求时持有共享锁，SwapApi持有独占锁
+    std::atomic_bool stopping_ {false};  // 析构时通知后台线程退出
+    std::shared_ptr<std::thread> price_limit_thread_;  // 查询涨跌停价，等待流控时不阻塞回调线程
+    bool replay_ = false;
+    std::atomic<int64_t> callback_tid_ {0};  // SPI回调线程的线程号
     map<string, string> order_nos_; // CTP的OrderSysId到内部order_no的映射关系，用于在成交回报接收时查找对应的委托合同号
 
     InnerFutureMaster future_position_master_;
+    InnerFutureLotBook future_lot_book_;  // 逐笔持仓明细
+    CTPFlowControl flow_control_;  // 报单、撤单的本地流控
+    vector<std::shared_ptr<CTPOrderSession>> order_sessions_;  // 额外的报单会话
+    std::atomic<uint64_t> next_session_ {0};
     int64_t pre_query_timestamp_ = 0; // 上次查询的时间戳，用于进行流控控制，CTP限制每秒只能查询一次
 
-    int start_index_ = 0;
+    static thread_local std::string reply_buffer_;  // 回报缓冲区，每个线程一个
+    std::atomic<int> start_index_ {0};  // 对账线程也会发起查询
+    mutex query_mutex_;  // 串行化各线程的查询流控
+    mutex callback_mutex_;  // 串行化主会话与报单会话的委托、成交相关回调，在mutex_之前获取
     mutex mutex_;
     string rsp_query_msg_;
     string query_cursor_;
-    flatbuffers::FlatBufferBuilder req_fbb_;
-
-    CThostFtdcTradingAccountField accout_field_;
     std::unordered_map<int, std::string> query_msg_;
     std::unordered_map<int, std::string> req_msg_;
     std::atomic_bool query_instruments_finish_;
     std::vector <CThostFtdcTradeField> all_ftdc_trades_;
 
+    std::unordered_map<std::string, CTPLiveOrder> live_orders_;  // 未完成的委托，key是order_no
+    std::unordered_map<std::string, CTPParkedOrder> parked_orders_;  // 未完成的预埋单，key是<报单引用>_<合约代码>
     std::unordered_map<std::string, std::string> withdraw_msg_;  // OnRtnOrder中的RequestID是0，导致必须要自己维护, key是order_no
     std::vector<MemTradeKnock> all_knock_;
-    std::unordered_map<std::string, MemTradePosition> all_pos_;
-    std::unordered_map<std::string, std::pair<std::string, int>> all_instruments_;  // 保存合约名称与乘数
+    std::unordered_map<int, CTPPositionQuery> position_queries_;  // request_id -> 持仓查询，由mutex_保护
+    std::vector<CThostFtdcInvestorPositionDetailField> all_pos_details_;
+    int64_t price_limit_count_ = 0;  // 已缓存涨跌停价的合约数
+    CTPInstrumentCatalog::Items& all_instruments_;  // 保存合约名称与乘数，多个资金账号共用
 };
 }  // namespace co
@@ -0,0 +1,34 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#include "ctp_trading_status.h"
+#include "ThostFtdcUserApiDataType.h"
+
+namespace co {
+    CTPTradingStatus* CTPTradingStatus::instance_ = new CTPTradingStatus();
+
+    CTPTradingStatus* CTPTradingStatus::Instance() {
+        return instance_;
+    }
+
+    bool CTPTradingStatus::Update(const string& id, char status) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        char& value = status_[id];
+        if (value == status) {
+            return false;  // 多个资金账号会收到同样的推送
+        }
+        value = status;
+        return true;
+    }
+
+    char CTPTradingStatus::Get(const string& instrument_id, const string& product_id) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto it = status_.find(instrument_id);
+        if (it == status_.end() && !product_id.empty()) {
+            it = status_.find(product_id);
+        }
+        return it != status_.end() ? it->second : 0;
+    }
+
+    bool CTPTradingStatus::IsTradable(char status) {
+        return status == 0 || status == THOST_FTDC_IS_Continous || status == THOST_FTDC_IS_AuctionOrdering;
+    }
+}  // namespace co
@@ -0,0 +1,42 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#pragma once
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+using namespace std;
+
+namespace co {
+    /**
+     * 合约交易状态表，由OnRtnInstrumentStatus更新，同一进程内的所有资金账号共用
+     * 交易所按品种（部分按合约）推送状态，报单前先按合约、再按品种查找，O(1)判断能否报单。
+     */
+class CTPTradingStatus {
+ public:
+    static CTPTradingStatus* Instance();
+
+    /**
+     * 更新状态
+     * @param id: 品种或合约代码，与CThostFtdcInstrumentStatusField::InstrumentID一致
+     * @return 状态是否有变化
+     */
+    bool Update(const string& id, char status);
+
+    // 没有收到状态时返回0
+    char Get(const string& instrument_id, const string& product_id);
+
+    // 连续交易和集合竞价报单阶段可以报单，没有收到状态时不限制
+    static bool IsTradable(char status);
+
+ protected:
+    CTPTradingStatus() = default;
+    ~CTPTradingStatus() = default;
+    CTPTradingStatus(const CTPTradingStatus&) = delete;
+    const CTPTradingStatus& operator=(const CTPTradingStatus&) = delete;
+
+ private:
+    static CTPTradingStatus* instance_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, char> status_;  // 品种或合约代码 -> THOST_FTDC_IS_XXX
+};
+}  // namespace co
@@ -0,0 +1,220 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cstdio>
+#include <boost/filesystem.hpp>
+#include "inner_future_journal.h"
+
+namespace co {
+    constexpr char kInnerFutureJournalMagic[8] = "CTPPOSJ";
+    constexpr char kInnerFutureSnapshotMagic[8] = "CTPPOSS";
+    constexpr int64_t kInnerFutureJournalInitCapacity = 1 << 16;  // 初始可容纳的变动数，写满后翻倍
+
+    InnerFutureJournal::~InnerFutureJournal() {
+        if (snapshot_thread_.joinable()) {  // 写完最后一次快照再退出
+            {
+                std::unique_lock<std::mutex> lock(snapshot_mutex_);
+                stopping_ = true;
+            }
+            snapshot_cv_.notify_one();
+            snapshot_thread_.join();
+        }
+        Close();
+    }
+
+    bool InnerFutureJournal::Open(const string& dir, int64_t trading_day, int64_t snapshot_interval) {
+        Close();
+        boost::filesystem::create_directories(dir);
+        trading_day_ = trading_day;
+        snapshot_interval_ = snapshot_interval;
+        journal_file_ = dir + "/position_journal_" + std::to_string(trading_day) + ".dat";
+        snapshot_file_ = dir + "/position_snapshot_" + std::to_string(trading_day) + ".dat";
+        fd_ = ::open(journal_file_.c_str(), O_RDWR | O_CREAT, 0644);
+        if (fd_ < 0) {
+            LOG_ERROR << "open position journal failed: " << journal_file_;
+            return false;
+        }
+        struct stat st;
+        fstat(fd_, &st);
+        int64_t capacity = kInnerFutureJournalInitCapacity;
+        if (st.st_size > (int64_t)sizeof(Header)) {
+            capacity = (st.st_size - sizeof(Header)) / sizeof(InnerFuturePositionDelta);
+        }
+        if (!Map(capacity)) {
+            Close();
+            return false;
+        }
+        if (strcmp(header_->magic, kInnerFutureJournalMagic) != 0) {
+            memset((void*)header_, 0, sizeof(Header));
+            strcpy(header_->magic, kInnerFutureJournalMagic);
+            header_->version = kInnerFutureJournalVersion;
+            header_->trading_day = trading_day;
+            header_->record_size = sizeof(InnerFuturePositionDelta);
+        } else if (header_->version != kInnerFutureJournalVersion || header_->record_size != (int64_t)sizeof(InnerFuturePositionDelta)) {
+            LOG_ERROR << "incompatible position journal: " << journal_file_ << ", version = " << header_->version;
+            Close();
+            return false;
+        }
+        header_->capacity = capacity;
+        LOG_INFO << "open position journal ok: " << journal_file_ << ", deltas = " << seq();
+        return true;
+    }
+
+    bool InnerFutureJournal::Map(int64_t capacity) {
+        if (header_) {
+            munmap(header_, mapped_size_);
+            header_ = nullptr;
+            records_ = nullptr;
+        }
+        size_t size = sizeof(Header) + sizeof(InnerFuturePositionDelta) * capacity;
+        struct stat st;
+        fstat(fd_, &st);
+        if ((size_t)st.st_size < size && ftruncate(fd_, size) != 0) {
+            LOG_ERROR << "resize position journal failed: " << journal_file_ << ", size = " << size;
+            return false;
+        }
+        void* p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (p == MAP_FAILED) {
+            LOG_ERROR << "mmap position journal failed: " << journal_file_ << ", size = " << size;
+            return false;
+        }
+        mapped_size_ = size;
+        header_ = reinterpret_cast<Header*>(p);
+        records_ = reinterpret_cast<InnerFuturePositionDelta*>(reinterpret_cast<char*>(p) + sizeof(Header));
+        return true;
+    }
+
+    void InnerFutureJournal::Close() {
+        if (header_) {
+            munmap(header_, mapped_size_);
+            header_ = nullptr;
+            records_ = nullptr;
+            mapped_size_ = 0;
+        }
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+    }
+
+    void InnerFutureJournal::Append(InnerFuturePositionDelta* delta) {
+        if (!is_open()) {
+            return;
+        }
+        int64_t size = header_->size.load(std::memory_order_relaxed);  // 只有持有写锁的线程追加
+        if (size >= header_->capacity) {
+            int64_t capacity = header_->capacity * 2;
+            if (!Map(capacity)) {
+                LOG_ERROR << "position journal is full, close it: " << journal_file_;
+                Close();
+                return;
+            }
+            header_->capacity = capacity;
+        }
+        delta->seq = size + 1;
+        records_[size] = *delta;
+        header_->size.store(delta->seq, std::memory_order_release);  // 先写数据再发布数量，读到数量时记录一定完整
+    }
+
+    void InnerFutureJournal::WriteSnapshot(InnerFutureJournalState* state) {
+        if (!is_open()) {
+            return;
+        }
+        state->seq = seq();
+        snapshot_seq_ = state->seq;
+        {
+            std::unique_lock<std::mutex> lock(snapshot_mutex_);
+            pending_snapshot_.reset(new InnerFutureJournalState(std::move(*state)));
+            if (!snapshot_thread_.joinable()) {
+                snapshot_thread_ = std::thread(&InnerFutureJournal::RunSnapshot, this);
+            }
+        }
+        snapshot_cv_.notify_one();
+    }
+
+    void InnerFutureJournal::RunSnapshot() {
+        while (true) {
+            std::unique_ptr<InnerFutureJournalState> state;
+            {
+                std::unique_lock<std::mutex> lock(snapshot_mutex_);
+                snapshot_cv_.wait(lock, [this] { return pending_snapshot_ || stopping_; });
+                if (!pending_snapshot_) {
+                    return;
+                }
+                state.swap(pending_snapshot_);
+            }
+            DoWriteSnapshot(*state);
+        }
+    }
+
+    void InnerFutureJournal::DoWriteSnapshot(const InnerFutureJournalState& state) {
+        string tmp_file = snapshot_file_ + ".tmp";
+        FILE* fp = fopen(tmp_file.c_str(), "wb");
+        if (!fp) {
+            LOG_ERROR << "write position snapshot failed: " << tmp_file;
+            return;
+        }
+        int64_t positions_size = state.positions.size();
+        int64_t orders_size = state.orders.size();
+        bool ok = fwrite(kInnerFutureSnapshotMagic, sizeof(kInnerFutureSnapshotMagic), 1, fp) == 1
+            && fwrite(&kInnerFutureJournalVersion, sizeof(int64_t), 1, fp) == 1
+            && fwrite(&trading_day_, sizeof(int64_t), 1, fp) == 1
+            && fwrite(&state.seq, sizeof(int64_t), 1, fp) == 1
+            && fwrite(state.open_cache, sizeof(state.open_cache), 1, fp) == 1
+            && fwrite(&positions_size, sizeof(int64_t), 1, fp) == 1
+            && fwrite(&orders_size, sizeof(int64_t), 1, fp) == 1
+            && (positions_size == 0 || fwrite(state.positions.data(), sizeof(InnerFutureJournalPosition), positions_size, fp) == (size_t)positions_size)
+            && (orders_size == 0 || fwrite(state.orders.data(), sizeof(InnerFutureJournalOrder), orders_size, fp) == (size_t)orders_size);
+        ok = fclose(fp) == 0 && ok;
+        if (!ok || rename(tmp_file.c_str(), snapshot_file_.c_str()) != 0) {
+            LOG_ERROR << "write position snapshot failed: " << snapshot_file_;
+            return;
+        }
+        LOG_INFO << "write position snapshot ok: seq = " << state.seq << ", positions = " << positions_size << ", orders = " << orders_size;
+    }
+
+    bool InnerFutureJournal::Load(InnerFutureJournalState* state, vector<InnerFuturePositionDelta>* deltas) {
+        if (!is_open()) {
+            return false;
+        }
+        FILE* fp = fopen(snapshot_file_.c_str(), "rb");
+        if (!fp) {
+            return false;
+        }
+        char magic[sizeof(kInnerFutureSnapshotMagic)] = "";
+        int64_t version = 0;
+        int64_t trading_day = 0;
+        int64_t positions_size = 0;
+        int64_t orders_size = 0;
+        bool ok = fread(magic, sizeof(magic), 1, fp) == 1
+            && strcmp(magic, kInnerFutureSnapshotMagic) == 0
+            && fread(&version, sizeof(int64_t), 1, fp) == 1
+            && version == kInnerFutureJournalVersion
+            && fread(&trading_day, sizeof(int64_t), 1, fp) == 1
+            && trading_day == trading_day_
+            && fread(&state->seq, sizeof(int64_t), 1, fp) == 1
+            && fread(state->open_cache, sizeof(state->open_cache), 1, fp) == 1
+            && fread(&positions_size, sizeof(int64_t), 1, fp) == 1
+            && fread(&orders_size, sizeof(int64_t), 1, fp) == 1
+            && positions_size >= 0 && orders_size >= 0;
+        if (ok) {
+            state->positions.resize(positions_size);
+            state->orders.resize(orders_size);
+            ok = (positions_size == 0 || fread(state->positions.data(), sizeof(InnerFutureJournalPosition), positions_size, fp) == (size_t)positions_size)
+                && (orders_size == 0 || fread(state->orders.data(), sizeof(InnerFutureJournalOrder), orders_size, fp) == (size_t)orders_size);
+        }
+        fclose(fp);
+        if (!ok || state->seq > seq()) {
+            LOG_ERROR << "broken position snapshot: " << snapshot_file_;
+            return false;
+        }
+        deltas->clear();
+        for (int64_t i = state->seq; i < seq(); ++i) {
+            deltas->push_back(records_[i]);
+        }
+        snapshot_seq_ = state->seq;
+        return true;
+    }
+}  // namespace co
@@ -0,0 +1,128 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <x/x.h>
+#include <coral/coral.h>
+#include "inner_future_position.h"
+
+using namespace std;
+
+namespace co {
+    constexpr int64_t kInnerFutureJournalVersion = 1;
+    constexpr int kInnerFutureRiskTypeSize = 4;
+    constexpr const char* kInnerFutureRiskTypes[kInnerFutureRiskTypeSize] = {"IF", "IH", "IC", "IM"};  // 受当日最大开仓数限制的股指期货
+
+    /**
+     * 内部持仓的一次变动（新增委托、新增成交、新增撤单），按定长二进制写入日志
+     */
+struct InnerFuturePositionDelta {
+    int64_t seq = 0;  // 日志序号，从1开始
+    int64_t timestamp = 0;
+    char order_no[64] = "";
+    char code[32] = "";
+    int64_t market = 0;
+    int64_t hedge_flag = 0;
+    int64_t bs_flag = 0;
+    int64_t oc_flag = 0;  // 处理后的开平仓标记
+    int64_t order_volume = 0;  // 本次新增委托数
+    int64_t match_volume = 0;  // 本次新增成交数
+    int64_t withdraw_volume = 0;  // 本次新增撤单数
+};
+
+struct InnerFutureJournalPosition {
+    char code[32] = "";
+    int64_t hedge_flag = 0;
+    int64_t bs_flag = 0;
+    InnerFuturePositionSnapshot data;
+};
+
+struct InnerFutureJournalOrder {
+    char order_no[64] = "";
+    int64_t order_volume = 0;
+    int64_t match_volume = 0;
+    int64_t withdraw_volume = 0;
+};
+
+    /**
+     * 内部持仓的快照，包含写快照时的日志序号，恢复时只需重放该序号之后的变动
+     */
+struct InnerFutureJournalState {
+    int64_t seq = 0;
+    int64_t open_cache[kInnerFutureRiskTypeSize] = {0};
+    vector<InnerFutureJournalPosition> positions;
+    vector<InnerFutureJournalOrder> orders;
+};
+
+    /**
+     * 内部持仓日志
+     * 1.每个交易日一个日志文件<dir>/position_journal_<trading_day>.dat，通过mmap追加定长的InnerFuturePositionDelta；
+     * 2.每写入snapshot_interval条变动，写一次快照<dir>/position_snapshot_<trading_day>.dat（先写临时文件再改名），
+     *   调用方只复制快照数据，文件由后台线程写入，未写完时新的快照替换旧的快照；
+     * 3.程序崩溃重启后，加载快照并重放之后的变动即可恢复内部持仓，不需要解析日志或重新查询CTP。
+     * 日志只追加，不会因为写快照而截断，可以用于盘后审计。
+     */
+class InnerFutureJournal {
+ public:
+    InnerFutureJournal() = default;
+    ~InnerFutureJournal();
+    InnerFutureJournal(const InnerFutureJournal&) = delete;
+    const InnerFutureJournal& operator=(const InnerFutureJournal&) = delete;
+
+    bool Open(const string& dir, int64_t trading_day, int64_t snapshot_interval);
+    void Close();
+
+    inline bool is_open() const {
+        return header_ != nullptr;
+    }
+    inline int64_t seq() const {
+        return is_open() ? header_->size.load(std::memory_order_acquire) : 0;
+    }
+    inline bool NeedSnapshot() const {
+        return is_open() && snapshot_interval_ > 0 && seq() - snapshot_seq_ >= snapshot_interval_;
+    }
+
+    void Append(InnerFuturePositionDelta* delta);  // 分配日志序号并追加
+
+    void WriteSnapshot(InnerFutureJournalState* state);  // state->seq由日志填写，数据被移交给后台线程写入文件
+
+    /**
+        * 加载最近一次快照及之后的全部变动
+        * @return: 没有快照时返回false
+        */
+    bool Load(InnerFutureJournalState* state, vector<InnerFuturePositionDelta>* deltas);
+
+ protected:
+    struct Header {
+        char magic[8];
+        int64_t version;
+        int64_t trading_day;
+        int64_t record_size;
+        int64_t capacity;
+        std::atomic<int64_t> size;  // 已提交的变动数，先写记录再以release发布
+    };
+    bool Map(int64_t capacity);
+    void RunSnapshot();
+    void DoWriteSnapshot(const InnerFutureJournalState& state);
+
+ private:
+    string journal_file_;
+    string snapshot_file_;
+    int64_t trading_day_ = 0;
+    int64_t snapshot_interval_ = 0;
+    int64_t snapshot_seq_ = 0;
+    int fd_ = -1;
+    Header* header_ = nullptr;
+    InnerFuturePositionDelta* records_ = nullptr;
+    size_t mapped_size_ = 0;
+
+    std::thread snapshot_thread_;
+    std::mutex snapshot_mutex_;
+    std::condition_variable snapshot_cv_;
+    std::unique_ptr<InnerFutureJournalState> pending_snapshot_;  // 等待写入的快照
+    bool stopping_ = false;
+};
+}  // namespace co
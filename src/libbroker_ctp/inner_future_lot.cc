@@ -0,0 +1,335 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#include <algorithm>
+#include "inner_future_lot.h"
+
+namespace co {
+    InnerFutureLotRing::InnerFutureLotRing(size_t capacity) {
+        size_t n = 1;
+        while (n < capacity) {
+            n <<= 1;
+        }
+        lots_.resize(n);
+    }
+
+    void InnerFutureLotRing::push_back(const InnerFutureLot& lot) {
+        if (size_ == lots_.size()) {  // 已满，容量翻倍，并把数据按顺序搬到新缓冲区的开头
+            vector<InnerFutureLot> lots(lots_.size() * 2);
+            for (size_t i = 0; i < size_; ++i) {
+                lots[i] = at(i);
+            }
+            lots_.swap(lots);
+            head_ = 0;
+        }
+        lots_[(head_ + size_) & (lots_.size() - 1)] = lot;
+        ++size_;
+    }
+
+    void InnerFutureLotRing::Release(size_t closed) {
+        holes_ += closed;
+        // 先开先平时平掉的都在队首，直接出队
+        while (size_ > 0 && holes_ > 0 && at(0).volume <= 0) {
+            head_ = (head_ + 1) & (lots_.size() - 1);
+            --size_;
+            --holes_;
+        }
+        if (holes_ * 2 > size_) {  // 先平今仓、郑商所先平单腿时空洞在中间
+            Compact();
+        }
+    }
+
+    void InnerFutureLotRing::Compact() {
+        size_t n = 0;
+        for (size_t i = 0; i < size_; ++i) {
+            if (at(i).volume > 0) {
+                if (n != i) {
+                    at(n) = at(i);
+                }
+                ++n;
+            }
+        }
+        size_ = n;
+        holes_ = 0;
+    }
+
+    void InnerFutureLotBook::Init(int64_t trading_day, const vector<string>& today_first_products) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        trading_day_ = trading_day;
+        today_first_products_.clear();
+        today_first_products_.insert(today_first_products.begin(), today_first_products.end());
+    }
+
+    void InnerFutureLotBook::Seed(const string& code, int64_t market, int64_t multiple, int64_t hedge_flag, int64_t bs_flag, const InnerFutureLot& lot) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        Ledger& ledger = GetLedger(code, market, multiple, hedge_flag);
+        if (bs_flag == kBsFlagBuy) {
+            ledger.long_lots.push_back(lot);
+        } else if (bs_flag == kBsFlagSell) {
+            ledger.short_lots.push_back(lot);
+        } else {
+            return;
+        }
+        AddVolume(&ledger, bs_flag, lot, lot.volume);
+    }
+
+    void InnerFutureLotBook::Start() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // 查询结果不保证按开仓日期排序，排序后昨仓总在今仓之前，先开先平按队列顺序即可
+        for (auto& it : ledgers_) {
+            for (InnerFutureLotRing* ring : {&it.second.long_lots, &it.second.short_lots}) {
+                vector<InnerFutureLot> lots;
+                for (size_t i = 0; i < ring->size(); ++i) {
+                    lots.push_back(ring->at(i));
+                }
+                std::stable_sort(lots.begin(), lots.end(), [](const InnerFutureLot& a, const InnerFutureLot& b) {
+                    return a.today != b.today ? b.today : a.open_date < b.open_date;
+                });
+                *ring = InnerFutureLotRing(lots.size());
+                for (auto& lot : lots) {
+                    ring->push_back(lot);
+                }
+            }
+        }
+        started_ = true;
+        for (auto& it : init_knocks_) {
+            DoUpdate(it.first, it.second);
+        }
+        LOG_INFO << "init inner future lots ok: instruments = " << ledgers_.size() << ", knocks = " << init_knocks_.size();
+        init_knocks_.clear();
+    }
+
+    void InnerFutureLotBook::Update(const co::fbs::TradeOrderT& knock, int64_t multiple) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!started_) {  // 未完成初始化，先缓存起来等待处理
+            init_knocks_.emplace_back(knock, multiple);
+            return;
+        }
+        DoUpdate(knock, multiple);
+    }
+
+    InnerFutureLotBook::Ledger& InnerFutureLotBook::GetLedger(const string& code, int64_t market, int64_t multiple, int64_t hedge_flag) {
+        auto key = std::make_pair(code, hedge_flag);
+        auto itr = ledgers_.find(key);
+        if (itr != ledgers_.end()) {
+            return itr->second;
+        }
+        Ledger& ledger = ledgers_[key];
+        ledger.multiple = multiple > 0 ? multiple : 1;
+        ledger.view = std::make_shared<LedgerView>();
+        ledger.view->market = market;
+        size_t n = 0;  // 品种代码为合约代码开头的字母部分
+        while (n < code.length() && isalpha((unsigned char)code[n])) {
+            ++n;
+        }
+        ledger.view->today_first = market == co::kMarketCFFEX || today_first_products_.count(code.substr(0, n)) > 0;
+        std::shared_ptr<const ViewIndex> views = std::atomic_load(&views_);
+        std::shared_ptr<ViewIndex> new_views = views ? std::make_shared<ViewIndex>(*views) : std::make_shared<ViewIndex>();
+        (*new_views)[key] = ledger.view;
+        std::atomic_store(&views_, std::shared_ptr<const ViewIndex>(new_views));
+        return ledger;
+    }
+
+    void InnerFutureLotBook::AddVolume(Ledger* ledger, int64_t bs_flag, const InnerFutureLot& lot, int64_t volume) {
+        InnerFutureLotVolumes& v = bs_flag == kBsFlagBuy ? ledger->view->long_volumes : ledger->view->short_volumes;
+        std::atomic<int64_t>& item = lot.comb ? (lot.today ? v.td_comb : v.yd_comb) : (lot.today ? v.td_single : v.yd_single);
+        uint64_t seq = v.seq.load(std::memory_order_relaxed);
+        v.seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        item.store(item.load(std::memory_order_relaxed) + volume, std::memory_order_relaxed);
+        v.seq.store(seq + 2, std::memory_order_release);
+    }
+
+    void InnerFutureLotBook::DoUpdate(const co::fbs::TradeOrderT& knock, int64_t multiple) {
+        if (knock.volume <= 0) {
+            return;
+        }
+        Ledger& ledger = GetLedger(knock.code, knock.market, multiple, knock.hedge_flag);
+        if (knock.oc_flag == kOcFlagOpen) {
+            InnerFutureLot lot;
+            lot.open_date = trading_day_;
+            lot.open_price = knock.price;
+            lot.volume = knock.volume;
+            lot.today = true;
+            if (knock.bs_flag == kBsFlagBuy) {
+                ledger.long_lots.push_back(lot);
+            } else if (knock.bs_flag == kBsFlagSell) {
+                ledger.short_lots.push_back(lot);
+            } else {
+                return;
+            }
+            AddVolume(&ledger, knock.bs_flag, lot, lot.volume);
+            return;
+        }
+        // 买平减少空头持仓，卖平减少多头持仓
+        int64_t bs_flag = knock.bs_flag == kBsFlagBuy ? kBsFlagSell : kBsFlagBuy;
+        double& close_profit = bs_flag == kBsFlagBuy ? ledger.long_close_profit : ledger.short_close_profit;
+        double pre_close_profit = close_profit;
+        int64_t today_volume = 0;
+        int64_t closed = Close(&ledger, bs_flag, knock.oc_flag, knock.volume, knock.price, &today_volume);
+        LOG_INFO << "[LotClose] code=" << knock.code
+            << ", hedge_flag=" << knock.hedge_flag
+            << ", bs_flag=" << bs_flag
+            << ", volume=" << closed
+            << ", today_volume=" << today_volume
+            << ", price=" << knock.price
+            << ", profit=" << close_profit - pre_close_profit
+            << ", close_profit=" << close_profit;
+        if (closed < knock.volume) {
+            LOG_WARN << "update future inner lots failed: code = " << knock.code
+                << ", hedge_flag = " << knock.hedge_flag
+                << ", bs_flag = " << knock.bs_flag
+                << ", oc_flag = " << knock.oc_flag
+                << ", volume = " << knock.volume
+                << ", closed = " << closed;
+        }
+    }
+
+    int64_t InnerFutureLotBook::Close(Ledger* ledger, int64_t bs_flag, int64_t oc_flag, int64_t volume, double price, int64_t* today_volume) {
+        InnerFutureLotRing& lots = bs_flag == kBsFlagBuy ? ledger->long_lots : ledger->short_lots;
+        double& close_profit = bs_flag == kBsFlagBuy ? ledger->long_close_profit : ledger->short_close_profit;
+        int64_t market = ledger->view->market;
+        // 0-今昨仓都可以平，1-只平今仓，2-只平昨仓
+        int scope = 0;
+        if (oc_flag == kOcFlagCloseToday) {
+            scope = 1;
+        } else if (oc_flag == kOcFlagCloseYesterday || market == co::kMarketSHFE || market == co::kMarketINE) {
+            scope = 2;
+        }
+        int scopes[2] = {scope, 0};
+        int rounds = 1;
+        if (scope == 0 && ledger->view->today_first) {  // 先平今仓，第一轮只平今仓，第二轮平昨仓
+            scopes[0] = 1;
+            scopes[1] = 2;
+            rounds = 2;
+        }
+        int passes = market == co::kMarketCZCE ? 2 : 1;  // 郑商所第一遍只平单腿持仓，第二遍平组合持仓
+        int64_t left = volume;
+        size_t closed = 0;
+        for (int round = 0; round < rounds && left > 0; ++round) {
+            int s = scopes[round];
+            for (int pass = 0; pass < passes && left > 0; ++pass) {
+                for (size_t i = 0; i < lots.size() && left > 0; ++i) {
+                    InnerFutureLot& lot = lots.at(i);
+                    if (lot.volume <= 0 || (s == 1 && !lot.today) || (s == 2 && lot.today)) {
+                        continue;
+                    }
+                    if (passes == 2 && lot.comb != (pass == 1)) {
+                        continue;
+                    }
+                    int64_t v = lot.volume < left ? lot.volume : left;
+                    left -= v;
+                    if (lot.today) {
+                        *today_volume += v;
+                    }
+                    double diff = bs_flag == kBsFlagBuy ? price - lot.open_price : lot.open_price - price;
+                    close_profit += diff * v * ledger->multiple;
+                    lot.volume -= v;
+                    AddVolume(ledger, bs_flag, lot, -v);
+                    if (lot.volume == 0) {
+                        ++closed;
+                    }
+                }
+            }
+        }
+        lots.Release(closed);
+        return volume - left;
+    }
+
+    bool InnerFutureLotBook::PeekCloseToday(const string& code, int64_t hedge_flag, int64_t bs_flag, int64_t volume, int64_t* today_volume) const {
+        *today_volume = 0;
+        if (!started_.load()) {
+            return false;
+        }
+        std::shared_ptr<const ViewIndex> views = std::atomic_load(&views_);
+        if (!views) {
+            return false;
+        }
+        auto itr = views->find(std::make_pair(code, hedge_flag));
+        if (itr == views->end()) {
+            return false;
+        }
+        const LedgerView& view = *itr->second;
+        if (view.market == co::kMarketSHFE || view.market == co::kMarketINE) {  // 等同平昨
+            return true;
+        }
+        const InnerFutureLotVolumes& v = bs_flag == kBsFlagBuy ? view.long_volumes : view.short_volumes;
+        int64_t yd_single = 0;
+        int64_t td_single = 0;
+        int64_t yd_comb = 0;
+        int64_t td_comb = 0;
+        uint64_t begin = 0;
+        uint64_t end = 0;
+        do {
+            begin = v.seq.load(std::memory_order_acquire);
+            yd_single = v.yd_single.load(std::memory_order_relaxed);
+            td_single = v.td_single.load(std::memory_order_relaxed);
+            yd_comb = v.yd_comb.load(std::memory_order_relaxed);
+            td_comb = v.td_comb.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            end = v.seq.load(std::memory_order_relaxed);
+        } while ((begin & 1) || begin != end);
+        auto clamp = [](int64_t x, int64_t hi) { return x < 0 ? 0 : (x < hi ? x : hi); };
+        if (view.today_first) {
+            *today_volume = clamp(volume, td_single + td_comb);
+        } else if (view.market == co::kMarketCZCE) {
+            // 第一遍平单腿持仓（昨仓在前），第二遍平组合持仓
+            *today_volume = clamp(volume - yd_single, td_single) + clamp(volume - yd_single - td_single - yd_comb, td_comb);
+        } else {
+            *today_volume = clamp(volume - yd_single - yd_comb, td_single + td_comb);
+        }
+        return true;
+    }
+
+    double InnerFutureLotBook::GetPositionProfit(const std::function<bool(const string&, double*, double*)>& get_price, int64_t* missing) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        double profit = 0;
+        *missing = 0;
+        for (auto& it : ledgers_) {
+            const Ledger& ledger = it.second;
+            if (ledger.long_lots.empty() && ledger.short_lots.empty()) {
+                continue;
+            }
+            double last_price = 0;
+            double pre_settlement_price = 0;
+            if (!get_price(it.first.first, &last_price, &pre_settlement_price) || pre_settlement_price <= 0) {
+                ++*missing;
+                continue;
+            }
+            double price = last_price > 0 ? last_price : pre_settlement_price;
+            for (int64_t bs_flag : {kBsFlagBuy, kBsFlagSell}) {
+                const InnerFutureLotRing& lots = bs_flag == kBsFlagBuy ? ledger.long_lots : ledger.short_lots;
+                for (size_t i = 0; i < lots.size(); ++i) {
+                    const InnerFutureLot& lot = lots.at(i);
+                    double cost = lot.today ? lot.open_price : pre_settlement_price;
+                    double diff = bs_flag == kBsFlagBuy ? price - cost : cost - price;
+                    profit += diff * lot.volume * ledger.multiple;
+                }
+            }
+        }
+        return profit;
+    }
+
+    bool InnerFutureLotBook::GetSummary(const string& code, int64_t hedge_flag, int64_t bs_flag, InnerFutureLotSummary* summary) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        auto itr = ledgers_.find(std::make_pair(code, hedge_flag));
+        if (itr == ledgers_.end()) {
+            return false;
+        }
+        Ledger& ledger = itr->second;
+        InnerFutureLotRing& lots = bs_flag == kBsFlagBuy ? ledger.long_lots : ledger.short_lots;
+        *summary = InnerFutureLotSummary();
+        for (size_t i = 0; i < lots.size(); ++i) {
+            const InnerFutureLot& lot = lots.at(i);
+            if (lot.today) {
+                summary->td_volume += lot.volume;
+            } else {
+                summary->yd_volume += lot.volume;
+            }
+            if (lot.comb) {
+                summary->comb_volume += lot.volume;
+            }
+            summary->open_cost += lot.open_price * lot.volume * ledger.multiple;
+        }
+        summary->close_profit = bs_flag == kBsFlagBuy ? ledger.long_close_profit : ledger.short_close_profit;
+        return true;
+    }
+}  // namespace co
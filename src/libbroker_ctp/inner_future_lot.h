@@ -0,0 +1,163 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+#pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <x/x.h>
+#include <coral/coral.h>
+
+using namespace std;
+
+namespace co {
+    /**
+     * 持仓明细（按成交开仓的一笔持仓）
+     */
+struct InnerFutureLot {
+    int64_t open_date = 0;  // 开仓日期
+    double open_price = 0;  // 开仓价格
+    int64_t volume = 0;  // 剩余数量
+    bool today = false;  // 是否今仓
+    bool comb = false;  // 是否组合持仓的腿（郑商所先平单腿持仓，再平组合持仓）
+};
+
+    /**
+     * 持仓明细环形缓冲区，按开仓先后顺序保存，0为最早开仓的一笔
+     * 平仓后数量为0的明细由Release回收：队首的直接出队，中间的空洞超过一半时再整体压缩，均摊O(1)
+     */
+class InnerFutureLotRing {
+ public:
+    explicit InnerFutureLotRing(size_t capacity = 16);
+
+    inline size_t size() const {
+        return size_;
+    }
+    inline bool empty() const {
+        return size_ == 0;
+    }
+    inline InnerFutureLot& at(size_t i) {
+        return lots_[(head_ + i) & (lots_.size() - 1)];
+    }
+    inline const InnerFutureLot& at(size_t i) const {
+        return lots_[(head_ + i) & (lots_.size() - 1)];
+    }
+
+    void push_back(const InnerFutureLot& lot);
+    void Release(size_t closed);  // 本次平仓有closed笔明细数量变为0
+    void Compact();  // 删除已全部平掉的持仓明细，保持开仓顺序
+
+ private:
+    vector<InnerFutureLot> lots_;  // 容量始终为2的幂
+    size_t head_ = 0;
+    size_t size_ = 0;
+    size_t holes_ = 0;  // 数量为0但还没有回收的明细
+};
+
+    /**
+     * 合约单方向按今昨、单腿/组合分类的剩余数量
+     * 写入方在InnerFutureLotBook::mutex_内更新，读取方用seqlock不加锁读取：写入时seq为奇数，读取前后seq相同且为偶数时结果一致
+     */
+struct InnerFutureLotVolumes {
+    std::atomic<uint64_t> seq {0};
+    std::atomic<int64_t> yd_single {0};
+    std::atomic<int64_t> td_single {0};
+    std::atomic<int64_t> yd_comb {0};
+    std::atomic<int64_t> td_comb {0};
+};
+
+    /**
+     * 合约单方向的持仓明细汇总
+     */
+struct InnerFutureLotSummary {
+    int64_t yd_volume = 0;  // 昨仓
+    int64_t td_volume = 0;  // 今仓
+    int64_t comb_volume = 0;  // 其中组合持仓
+    double open_cost = 0;  // 开仓成本（开仓价 * 数量 * 乘数）
+    double close_profit = 0;  // 逐笔平仓盈亏
+};
+
+    /**
+     * 期货逐笔持仓明细
+     * 工作流程：
+     * 1.系统启动时，使用ReqQryInvestorPositionDetail的结果初始化，昨仓按开盘前的数量（Volume + CloseVolume）建立明细；
+     * 2.订阅私有流时今日成交会全部重推，今仓由OnRtnTrade重建；初始化完成之前收到的成交先缓存起来；
+     * 3.每笔成交：开仓增加一笔明细，平仓按交易所规则扣减明细并计算逐笔平仓盈亏。
+     *
+     * 平仓规则
+     * 1.平今只平今仓，平昨只平昨仓，上期所、能源中心的平仓等同平昨；
+     * 2.中金所以及配置了先平今仓的品种（如免收平今手续费的品种）先平今仓，再平昨仓；
+     * 3.其他交易所先开先平，郑商所先平单腿持仓，再平组合持仓。
+     * 明细按合约、套保标记分别记账，投机、套利、套保的持仓互不影响。
+     *
+     * 线程模型
+     * 1.Seed/Start/Update/GetSummary由mutex_串行化；
+     * 2.PeekCloseToday在报单线程计算自动开平仓时调用，不加锁：按合约发布的InnerFutureLotVolumes采用写时复制索引，
+     *   昨仓总在今仓之前（Start时按开仓日期排序），由各类剩余数量即可算出会平掉的今仓。
+     */
+class InnerFutureLotBook {
+ public:
+    /**
+        * 初始化，在Seed之前调用
+        * @param trading_day: 交易日，作为今仓明细的开仓日期
+        * @param today_first_products: 先平今仓的品种代码，如：IF、jd
+        */
+    void Init(int64_t trading_day, const vector<string>& today_first_products);
+    void Seed(const string& code, int64_t market, int64_t multiple, int64_t hedge_flag, int64_t bs_flag, const InnerFutureLot& lot);
+    void Start();
+
+    /**
+        * 处理一笔成交
+        * @param knock: 成交，price、volume为成交价与成交数量
+        * @param multiple: 合约乘数
+        */
+    void Update(const co::fbs::TradeOrderT& knock, int64_t multiple);
+
+    bool GetSummary(const string& code, int64_t hedge_flag, int64_t bs_flag, InnerFutureLotSummary* summary);
+
+    /**
+        * 按最新价计算盯市持仓盈亏：昨仓相对昨结算价，今仓相对开仓价，与CTP资金中的PositionProfit口径相同
+        * @param get_price: 取合约的最新价和昨结算价，没有行情时返回false
+        * @param missing: 有持仓但取不到价格的合约数，不为0时结果不完整
+        */
+    double GetPositionProfit(const std::function<bool(const string&, double*, double*)>& get_price, int64_t* missing);
+
+    /**
+        * 按交易所规则预估一笔不指定今昨的平仓会平掉多少今仓，不修改明细
+        * @param bs_flag: 被平持仓的方向
+        * @param today_volume: 会平掉的今仓数量
+        * @return: 没有该合约的明细时返回false
+        */
+    bool PeekCloseToday(const string& code, int64_t hedge_flag, int64_t bs_flag, int64_t volume, int64_t* today_volume) const;
+
+ protected:
+    struct LedgerView {  // 不加锁读取的部分，创建后market、today_first不再修改
+        int64_t market = 0;
+        bool today_first = false;  // 先平今仓
+        InnerFutureLotVolumes long_volumes;
+        InnerFutureLotVolumes short_volumes;
+    };
+    typedef map<std::pair<string, int64_t>, std::shared_ptr<LedgerView>> ViewIndex;
+    struct Ledger {
+        int64_t multiple = 1;
+        std::shared_ptr<LedgerView> view;
+        InnerFutureLotRing long_lots;
+        InnerFutureLotRing short_lots;
+        double long_close_profit = 0;
+        double short_close_profit = 0;
+    };
+    Ledger& GetLedger(const string& code, int64_t market, int64_t multiple, int64_t hedge_flag);
+    void DoUpdate(const co::fbs::TradeOrderT& knock, int64_t multiple);
+    void AddVolume(Ledger* ledger, int64_t bs_flag, const InnerFutureLot& lot, int64_t volume);  // 按明细的今昨、单腿/组合分类累加剩余数量
+    int64_t Close(Ledger* ledger, int64_t bs_flag, int64_t oc_flag, int64_t volume, double price, int64_t* today_volume);
+
+ private:
+    std::mutex mutex_;
+    std::atomic_bool started_ {false};
+    int64_t trading_day_ = 0;
+    std::set<string> today_first_products_;
+    vector<std::pair<co::fbs::TradeOrderT, int64_t>> init_knocks_;  // 初始化完成之前收到的成交
+    map<std::pair<string, int64_t>, Ledger> ledgers_;  // <code, hedge_flag> -> ledger
+    std::shared_ptr<const ViewIndex> views_;  // 新增合约时复制后用std::atomic_store发布
+};
+}  // namespace co
@@ -4,25 +4,57 @@ constexpr int kCFFEXOptionLength = 14;
 
 namespace co {
 
-    void InnerFutureMaster::Init(const vector<MemTradePosition>& positions) {
+    InnerFutureMaster::InnerFutureMaster(): positions_(std::make_shared<PositionIndex>()) {
+        // 预先建好所有的合约类型，之后只修改数值，读线程可以无锁访问
+        for (auto type : kInnerFutureRiskTypes) {
+            open_cache_[type].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void InnerFutureMaster::Init(const InnerFutureHedgePositions& positions) {
         // 初始化持仓，这里的初始持仓数据应该是今天开盘前的数据，而不是当前状态的持仓。开盘前，只有昨持仓，今日开仓数应该为0
         LOG_INFO << "init inner future position ...";
+        std::unique_lock<std::mutex> lock(write_mutex_);
         state_ = 1;
-        for (auto m : positions) {
-            InnerFuturePositionPtr buy_pos = GetPosition(m.code, kHedgeFlagSpeculate, kBsFlagBuy);
-            buy_pos->set_yd_volume(m.long_pre_volume);
-            InnerFuturePositionPtr sell_pos = GetPosition(m.code, kHedgeFlagSpeculate, kBsFlagSell);
-            sell_pos->set_yd_volume(m.short_pre_volume);
+        if (Recover()) {  // 从持仓日志恢复的持仓已包含昨仓及之后的全部变动，CTP重推的委托只会计算出新增部分
+            for (auto order : init_orders_) {
+                DoUpdate(*order);
+            }
+            LOG_INFO << "init inner future position ok: recovered from journal, orders = " << init_orders_.size();
+            init_orders_.clear();
+            state_ = 2;
+            return;
+        }
+        int64_t positions_size = 0;
+        for (auto& it : positions) {
+            int64_t hedge_flag = it.first;
+            for (auto& m : it.second) {
+                InnerFuturePositionPtr buy_pos = GetPosition(m.code, hedge_flag, kBsFlagBuy);
+                buy_pos->BeginWrite();
+                buy_pos->set_yd_volume(m.long_pre_volume);
+                buy_pos->EndWrite();
+                InnerFuturePositionPtr sell_pos = GetPosition(m.code, hedge_flag, kBsFlagSell);
+                sell_pos->BeginWrite();
+                sell_pos->set_yd_volume(m.short_pre_volume);
+                sell_pos->EndWrite();
+                ++positions_size;
+            }
         }
+        WriteSnapshot();  // 昨仓写入快照，之后的变动写入日志
         for (auto order : init_orders_) {
-            Update(*order);
+            DoUpdate(*order);
         }
-        LOG_INFO << "init inner future position ok: positions = " << positions.size() << ", orders = " << init_orders_.size();
+        LOG_INFO << "init inner future position ok: positions = " << positions_size << ", orders = " << init_orders_.size();
         init_orders_.clear();
         state_ = 2;
     }
 
     void InnerFutureMaster::Update(const co::fbs::TradeOrderT& order) {
+        std::unique_lock<std::mutex> lock(write_mutex_);
+        DoUpdate(order);
+    }
+
+    void InnerFutureMaster::DoUpdate(const co::fbs::TradeOrderT& order) {
         // 更新内部持仓，理论上如果CTP推送过来的委托状态不发生数据丢失和数据顺序错乱的情况，内部持仓就是准确的。
         if (state_ == 0) {  // 未开始初始化，先缓存起来等待处理
             std::shared_ptr<co::fbs::TradeOrderT> m = make_shared<co::fbs::TradeOrderT>(order);
@@ -32,7 +64,7 @@ namespace co {
         string code = order.code;
         int64_t market = order.market;
         string order_no = order.order_no;
-        int64_t hedge_flag = kHedgeFlagSpeculate;
+        int64_t hedge_flag = GetHedgeFlag(order);
         int64_t bs_flag = order.bs_flag;
         int64_t oc_flag = order.oc_flag;
         // -------------------------------------------------------------------
@@ -95,13 +127,33 @@ namespace co {
             LOG_WARN << "unknown oc_flag for updating future inner position: "; //  << order.Utf8DebugString()
             return;
         }
-        LOG_INFO << "[InnerFutureOrder], code: " << code
-            << ", order_no : " << order_no
-            << ", bs_flag : " << bs_flag
-            << ", oc_flag : " << _oc_flag
-            << ", order_volume: " << iorder->order_volume()
-            << ", match_volume: " << iorder->match_volume()
-            << ", withdraw_volume: " << iorder->withdraw_volume();
+        InnerFuturePositionDelta delta;
+        delta.timestamp = x::RawDateTime();
+        strncpy(delta.order_no, order_no.c_str(), sizeof(delta.order_no) - 1);
+        strncpy(delta.code, code.c_str(), sizeof(delta.code) - 1);
+        delta.market = market;
+        delta.hedge_flag = hedge_flag;
+        delta.bs_flag = bs_flag;
+        delta.oc_flag = _oc_flag;
+        delta.order_volume = new_order_volume;
+        delta.match_volume = new_match_volume;
+        delta.withdraw_volume = new_withdraw_volume;
+        journal_.Append(&delta);
+        Apply(delta);
+        if (journal_.NeedSnapshot()) {
+            WriteSnapshot();
+        }
+    }
+
+    void InnerFutureMaster::Apply(const InnerFuturePositionDelta& delta) {
+        string code = delta.code;
+        int64_t market = delta.market;
+        int64_t hedge_flag = delta.hedge_flag;
+        int64_t bs_flag = delta.bs_flag;
+        int64_t _oc_flag = delta.oc_flag;
+        int64_t new_order_volume = delta.order_volume;
+        int64_t new_match_volume = delta.match_volume;
+        int64_t new_withdraw_volume = delta.withdraw_volume;
         // 获取待更新的持仓
         InnerFuturePositionPtr pos;
         if ((bs_flag == kBsFlagBuy && _oc_flag == kOcFlagOpen) ||
@@ -120,16 +172,9 @@ namespace co {
         if (pos == nullptr) {
             LOG_ERROR << "pos is empty.";
         }
-        stringstream ss;
-        ss << "[InnerFuturePosition] Order{code=" << code
-            << ", market=" << market
-            << ", bs_flag=" << bs_flag
-            << ", oc_flag=" << oc_flag
-            << ", order_no=" << order.order_no
-            << ", order_volume=+" << new_order_volume << "/" << order.volume
-            << ", match_volume=+" << new_match_volume << "/" << order.match_volume
-            << ", withdraw_volume=+" << new_withdraw_volume << "/" << order.withdraw_volume
-            << "}, " << pos->ToString();
+        InnerFuturePositionEvent event;
+        event.delta = delta;
+        event.before = pos->Snapshot();
         // 内部持仓更新逻辑
         // 1.买开（更新买持仓）
         // 1.1 买开委托：增加开仓冻结；
@@ -147,6 +192,7 @@ namespace co {
         // 4.1 卖平委托：减少持仓，增加平仓冻结；
         // 4.2 卖平成交：减少平仓冻结，增加已平仓数；
         // 4.3 卖平撤单：减少平仓冻结，增加持仓；
+        pos->BeginWrite();
         switch (_oc_flag) {
         case kOcFlagOpen:
             if (new_order_volume > 0) { // 开仓委托：增加开仓冻结
@@ -359,8 +405,9 @@ namespace co {
         default:
             break;
         }
-        ss << " -> " << pos->ToString();
-        LOG_INFO << ss.str();
+        pos->EndWrite();
+        event.after = pos->Snapshot();
+        CTPEventLog::Instance()->Write(kCTPEventInnerPosition, event);
         // ------------------------------------------------
         // 风控策略：更新当前期货类型的已开仓数和开仓冻结数之和
         if (code.length() > kCFFEXOptionLength) {
@@ -370,11 +417,9 @@ namespace co {
             string type = code.length() > 2 ? code.substr(0, 2) : "";
             if (type == "IF" || type == "IH" || type == "IC" || type == "IM") {
                 int64_t volume = new_order_volume - new_withdraw_volume;
-                map<string, int64_t>::iterator itr = open_cache_.find(type);
+                auto itr = open_cache_.find(type);
                 if (itr != open_cache_.end()) {
-                    itr->second += volume;
-                } else {
-                    open_cache_[type] = volume;
+                    itr->second.fetch_add(volume, std::memory_order_relaxed);
                 }
             }
         }
@@ -399,27 +444,26 @@ namespace co {
             return ret_oc_flag;
         }
         int64_t r_bs_flag = _bs_flag == kBsFlagBuy ? kBsFlagSell : kBsFlagBuy;
-        string key = GetKey(code, kHedgeFlagSpeculate, r_bs_flag);
-        map<string, InnerFuturePositionPtr>::iterator itr = positions_.find(key);
-        if (itr == positions_.end()) {
+        InnerFuturePositionPtr pos = FindPosition(code, GetHedgeFlag(order), r_bs_flag);
+        if (!pos) {
+            WriteOcFlagEvent(order, ret_oc_flag, false, nullptr);
             CheckRisk(order.code, order.bs_flag, order.oc_flag, order.volume);
             return ret_oc_flag;
         }
-        InnerFuturePositionPtr pos = itr->second;
-        LOG_INFO << "GetAutoOcFlag: " << pos->ToString();
+        InnerFuturePositionSnapshot snap = pos->Snapshot();  // 一次读取，后续判断都基于同一份一致的数据
         int64_t order_volume = order.volume;
         // 上期所，平仓时需要指定是平今仓还是昨仓；
         // 其他交易所，平仓时不指定是平今仓还是昨仓，交易所自动以“先开先平”的原则进行处理。
         if (order.market == co::kMarketSHFE || order.market == co::kMarketINE) {
-            if (pos->yd_volume() >= order_volume) { // 先平昨仓
+            if (snap.yd_volume >= order_volume) { // 先平昨仓
                 ret_oc_flag = kOcFlagCloseYesterday;
-            } else if (pos->td_volume() >= order_volume) { // 后平今仓
+            } else if (snap.td_volume >= order_volume) { // 后平今仓
                 ret_oc_flag = kOcFlagCloseToday;
             }
         } else {
-            if (pos->yd_volume() >= order_volume) { // 先平昨仓
+            if (snap.yd_volume >= order_volume) { // 先平昨仓
                 ret_oc_flag = kOcFlagClose;
-            } else if (pos->td_volume() >= order_volume) { // 后平今仓
+            } else if (snap.td_volume >= order_volume) { // 后平今仓
                 ret_oc_flag = kOcFlagClose;
             }
             // ---------------------------------------------
@@ -430,7 +474,7 @@ namespace co {
                     string type = code.length() > 2 ? code.substr(0, 2) : "";
                     if (type == "IF" || type == "IH" || type == "IC" || type == "IM") {
                         // 如果有今仓，不管有没有昨仓，CTP都会执行平今的操作，这里要修改为开仓
-                        if (pos->td_volume() > 0) {
+                        if (GetCloseTodayVolume(order, r_bs_flag, snap) > 0) {
                             ret_oc_flag = kOcFlagOpen; // 修改为开仓
                         }
                     }
@@ -438,6 +482,7 @@ namespace co {
             }
             // ---------------------------------------------
         }
+        WriteOcFlagEvent(order, ret_oc_flag, false, &snap);
         CheckRisk(code, _bs_flag, ret_oc_flag, order_volume);
         return ret_oc_flag;
     }
@@ -448,47 +493,248 @@ namespace co {
         string code = order.code;
         int64_t _bs_flag = order.bs_flag;
         int64_t r_bs_flag = _bs_flag == kBsFlagBuy ? kBsFlagSell : kBsFlagBuy;
-        string key = GetKey(code, kHedgeFlagSpeculate, r_bs_flag);
-        map<string, InnerFuturePositionPtr>::iterator itr = positions_.find(key);
+        InnerFuturePositionPtr pos = FindPosition(code, GetHedgeFlag(order), r_bs_flag);
         // 无昨仓
-        if (itr == positions_.end()) {
-            LOG_INFO << "no yestoday volume, open flag.";
+        if (!pos) {
+            WriteOcFlagEvent(order, ret_oc_flag, true, nullptr);
             CheckRisk(order.code, order.bs_flag, order.oc_flag, order.volume);
             return ret_oc_flag;
         }
-        InnerFuturePositionPtr pos = itr->second;
-        LOG_INFO << "GetCloseYestodayFlag: " << pos->ToString();
+        InnerFuturePositionSnapshot snap = pos->Snapshot();
         int64_t order_volume = order.volume;
-        LOG_INFO << "yd_volume: " << pos->yd_volume() << ", order_volume: " << order_volume
-            << ", market: " << order.market;
         if (order.market == co::kMarketSHFE) {
-            if (pos->yd_volume() >= order_volume) { // 只平昨仓
+            if (snap.yd_volume >= order_volume) { // 只平昨仓
                 ret_oc_flag = kOcFlagCloseYesterday;
             }
         } else {
-            if (pos->yd_volume() >= order_volume) { // 只平昨仓
+            // 先平今仓的品种，有今仓时平仓会先平掉今仓，只能开仓
+            if (snap.yd_volume >= order_volume && GetCloseTodayVolume(order, r_bs_flag, snap) <= 0) { // 只平昨仓
                 ret_oc_flag = kOcFlagClose;
             }
         }
+        WriteOcFlagEvent(order, ret_oc_flag, true, &snap);
         CheckRisk(code, _bs_flag, ret_oc_flag, order_volume);
         return ret_oc_flag;
     }
 
+    void InnerFutureMaster::WriteOcFlagEvent(const co::fbs::TradeOrderT& order, int64_t ret_oc_flag, bool close_yesterday, const InnerFuturePositionSnapshot* snap) {
+        InnerFutureOcFlagEvent event;
+        strncpy(event.code, order.code.c_str(), sizeof(event.code) - 1);
+        event.market = order.market;
+        event.hedge_flag = GetHedgeFlag(order);
+        event.bs_flag = order.bs_flag;
+        event.oc_flag = order.oc_flag;
+        event.volume = order.volume;
+        event.ret_oc_flag = ret_oc_flag;
+        event.close_yesterday = close_yesterday;
+        if (snap) {
+            event.has_position = true;
+            event.position = *snap;
+        }
+        CTPEventLog::Instance()->Write(kCTPEventInnerOcFlag, event);
+    }
+
     string InnerFutureMaster::GetKey(string code, int64_t hedge_flag, int64_t bs_flag) {
         stringstream ss;
         ss << code << "_" << hedge_flag << "_" << bs_flag;
         return ss.str();
     }
 
+    bool InnerFutureMaster::OpenJournal(const string& dir, int64_t trading_day, int64_t snapshot_interval) {
+        std::unique_lock<std::mutex> lock(write_mutex_);
+        return journal_.Open(dir, trading_day, snapshot_interval);
+    }
+
+    bool InnerFutureMaster::Recover() {
+        // 只在持有write_mutex_时调用
+        InnerFutureJournalState journal_state;
+        vector<InnerFuturePositionDelta> deltas;
+        if (!journal_.Load(&journal_state, &deltas)) {
+            return false;
+        }
+        for (auto& m : journal_state.positions) {
+            InnerFuturePositionPtr pos = GetPosition(m.code, m.hedge_flag, m.bs_flag);
+            pos->BeginWrite();
+            pos->set_yd_volume(m.data.yd_volume);
+            pos->set_yd_closing_volume(m.data.yd_closing_volume);
+            pos->set_yd_close_volume(m.data.yd_close_volume);
+            pos->set_td_volume(m.data.td_volume);
+            pos->set_td_closing_volume(m.data.td_closing_volume);
+            pos->set_td_close_volume(m.data.td_close_volume);
+            pos->set_td_opening_volume(m.data.td_opening_volume);
+            pos->set_td_open_volume(m.data.td_open_volume);
+            pos->EndWrite();
+        }
+        for (auto& m : journal_state.orders) {
+            InnerFutureOrderPtr iorder = std::make_shared<InnerFutureOrder>();
+            iorder->set_order_volume(m.order_volume);
+            iorder->set_match_volume(m.match_volume);
+            iorder->set_withdraw_volume(m.withdraw_volume);
+            orders_[m.order_no] = iorder;
+        }
+        for (int i = 0; i < kInnerFutureRiskTypeSize; ++i) {
+            open_cache_[kInnerFutureRiskTypes[i]].store(journal_state.open_cache[i], std::memory_order_relaxed);
+        }
+        for (auto& delta : deltas) {
+            InnerFutureOrderPtr& iorder = orders_[delta.order_no];
+            if (!iorder) {
+                iorder = std::make_shared<InnerFutureOrder>();
+            }
+            iorder->set_order_volume(iorder->order_volume() + delta.order_volume);
+            iorder->set_match_volume(iorder->match_volume() + delta.match_volume);
+            iorder->set_withdraw_volume(iorder->withdraw_volume() + delta.withdraw_volume);
+            Apply(delta);
+        }
+        LOG_INFO << "recover inner future position ok: snapshot_seq = " << journal_state.seq
+            << ", positions = " << journal_state.positions.size()
+            << ", orders = " << journal_state.orders.size()
+            << ", deltas = " << deltas.size();
+        return true;
+    }
+
+    void InnerFutureMaster::WriteSnapshot() {
+        // 只在持有write_mutex_时调用
+        if (!journal_.is_open()) {
+            return;
+        }
+        InnerFutureJournalState journal_state;
+        std::shared_ptr<const PositionIndex> positions = std::atomic_load(&positions_);
+        for (auto& it : *positions) {
+            InnerFutureJournalPosition m;
+            strncpy(m.code, it.second->code().c_str(), sizeof(m.code) - 1);
+            m.hedge_flag = it.second->hedge_flag();
+            m.bs_flag = it.second->bs_flag();
+            m.data = it.second->Snapshot();
+            journal_state.positions.push_back(m);
+        }
+        for (auto& it : orders_) {
+            InnerFutureJournalOrder m;
+            strncpy(m.order_no, it.first.c_str(), sizeof(m.order_no) - 1);
+            m.order_volume = it.second->order_volume();
+            m.match_volume = it.second->match_volume();
+            m.withdraw_volume = it.second->withdraw_volume();
+            journal_state.orders.push_back(m);
+        }
+        for (int i = 0; i < kInnerFutureRiskTypeSize; ++i) {
+            journal_state.open_cache[i] = open_cache_[kInnerFutureRiskTypes[i]].load(std::memory_order_relaxed);
+        }
+        journal_.WriteSnapshot(&journal_state);
+    }
+
+    int64_t InnerFutureMaster::GetCloseTodayVolume(const co::fbs::TradeOrderT& order, int64_t bs_flag, const InnerFuturePositionSnapshot& snap) {
+        int64_t today_volume = 0;
+        if (lot_book_ && lot_book_->PeekCloseToday(order.code, GetHedgeFlag(order), bs_flag, order.volume, &today_volume)) {
+            return today_volume;
+        }
+        // 没有逐笔明细时按交易所规则估算：中金所先平今仓，其他交易所先开先平
+        int64_t volume = order.market == co::kMarketCFFEX ? order.volume : order.volume - snap.yd_volume;
+        volume = volume < snap.td_volume ? volume : snap.td_volume;
+        return volume > 0 ? volume : 0;
+    }
+
+    int64_t InnerFutureMaster::GetHedgeFlag(const co::fbs::TradeOrderT& order) {
+        return order.hedge_flag > 0 ? order.hedge_flag : kHedgeFlagSpeculate;
+    }
+
+    vector<InnerFutureDrift> InnerFutureMaster::Reconcile(const InnerFutureHedgePositions& positions, bool heal) {
+        std::unique_lock<std::mutex> lock(write_mutex_);
+        vector<InnerFutureDrift> drifts;
+        if (state_ != 2) {
+            return drifts;
+        }
+        std::shared_ptr<const PositionIndex> index = std::atomic_load(&positions_);
+        map<string, InnerFutureDrift> new_drifts;
+        set<string> keys;
+        auto check = [&](const string& code, int64_t hedge_flag, int64_t bs_flag, int64_t ctp_volume, int64_t ctp_pre_volume) {
+            string key = GetKey(code, hedge_flag, bs_flag);
+            keys.insert(key);
+            InnerFutureDrift drift;
+            drift.code = code;
+            drift.hedge_flag = hedge_flag;
+            drift.bs_flag = bs_flag;
+            drift.ctp_volume = ctp_volume;
+            drift.ctp_pre_volume = ctp_pre_volume;
+            auto itr = index->find(key);
+            if (itr != index->end()) {
+                InnerFuturePositionSnapshot snap = itr->second->Snapshot();
+                drift.inner_volume = snap.yd_volume + snap.yd_closing_volume + snap.td_volume + snap.td_closing_volume;
+                drift.inner_pre_volume = snap.yd_volume + snap.yd_closing_volume + snap.yd_close_volume;
+            }
+            if (drift.inner_volume == drift.ctp_volume && drift.inner_pre_volume == drift.ctp_pre_volume) {
+                return;
+            }
+            auto last = last_drifts_.find(key);
+            bool stable = last != last_drifts_.end() &&
+                last->second.ctp_volume == drift.ctp_volume && last->second.inner_volume == drift.inner_volume &&
+                last->second.ctp_pre_volume == drift.ctp_pre_volume && last->second.inner_pre_volume == drift.inner_pre_volume;
+            if (heal && stable) {
+                InnerFuturePositionPtr pos = GetPosition(code, hedge_flag, bs_flag);
+                int64_t pre_diff = drift.ctp_pre_volume - drift.inner_pre_volume;
+                int64_t td_diff = drift.ctp_volume - drift.inner_volume - pre_diff;
+                pos->BeginWrite();
+                pos->set_yd_volume(pos->yd_volume() + pre_diff);
+                pos->set_td_volume(pos->td_volume() + td_diff);
+                pos->EndWrite();
+                drift.healed = true;
+            } else {
+                new_drifts[key] = drift;
+            }
+            drifts.push_back(drift);
+        };
+        for (auto& it : positions) {
+            for (auto& m : it.second) {
+                check(m.code, it.first, kBsFlagBuy, m.long_volume, m.long_pre_volume);
+                check(m.code, it.first, kBsFlagSell, m.short_volume, m.short_pre_volume);
+            }
+        }
+        for (auto& it : *index) {  // CTP中已没有的持仓
+            if (keys.find(it.first) == keys.end()) {
+                check(it.second->code(), it.second->hedge_flag(), it.second->bs_flag(), 0, 0);
+            }
+        }
+        last_drifts_.swap(new_drifts);
+        for (auto& drift : drifts) {
+            if (drift.healed) {
+                WriteSnapshot();  // 修正后的持仓不是由委托变动产生的，写入快照以便恢复
+                break;
+            }
+        }
+        return drifts;
+    }
+
+    bool InnerFutureMaster::GetSnapshot(const string& code, int64_t hedge_flag, int64_t bs_flag, InnerFuturePositionSnapshot* snapshot) {
+        InnerFuturePositionPtr pos = FindPosition(code, hedge_flag, bs_flag);
+        if (!pos) {
+            return false;
+        }
+        *snapshot = pos->Snapshot();
+        return true;
+    }
+
     InnerFuturePositionPtr InnerFutureMaster::GetPosition(string code, int64_t hedge_flag, int64_t bs_flag) {
+        // 只在持有write_mutex_时调用
         InnerFuturePositionPtr pos;
         string key = GetKey(code, hedge_flag, bs_flag);
-        map<string, InnerFuturePositionPtr>::iterator itr_pos = positions_.find(key);
-        if (itr_pos != positions_.end()) {
+        std::shared_ptr<const PositionIndex> positions = std::atomic_load(&positions_);
+        auto itr_pos = positions->find(key);
+        if (itr_pos != positions->end()) {
             pos = itr_pos->second;
         } else {
             pos = InnerFuturePosition::New(code, hedge_flag, bs_flag);
-            positions_[key] = pos;
+            std::shared_ptr<PositionIndex> copy = std::make_shared<PositionIndex>(*positions);
+            (*copy)[key] = pos;
+            std::atomic_store(&positions_, std::shared_ptr<const PositionIndex>(copy));
+        }
+        return pos;
+    }
+
+    InnerFuturePositionPtr InnerFutureMaster::FindPosition(string code, int64_t hedge_flag, int64_t bs_flag) {
+        InnerFuturePositionPtr pos;
+        string key = GetKey(code, hedge_flag, bs_flag);
+        std::shared_ptr<const PositionIndex> positions = std::atomic_load(&positions_);
+        auto itr_pos = positions->find(key);
+        if (itr_pos != positions->end()) {
+            pos = itr_pos->second;
         }
         return pos;
     }
@@ -503,9 +749,9 @@ namespace co {
             string type = code.length() > 2 ? code.substr(0, 2) : "";
             if (type == "IF" || type == "IH" || type == "IC" || type == "IM") {
                 int64_t open_volume = 0; // 当前期货类型的已开仓数和开仓冻结数之和
-                map<string, int64_t>::iterator itr = open_cache_.find(type);
+                auto itr = open_cache_.find(type);
                 if (itr != open_cache_.end()) {
-                    open_volume = itr->second;
+                    open_volume = itr->second.load(std::memory_order_relaxed);
                 }
                 if (order_volume + open_volume > risk_max_today_opening_volume_) {
                     stringstream ss;
@@ -1,18 +1,41 @@
 // Copyright 2021 Fancapital Inc.  All rights reserved.
 #pragma once
+#include <atomic>
+#include <mutex>
+#include <set>
 #include <x/x.h>
 #include <coral/coral.h>
 #include "inner_future_position.h"
 #include "inner_future_order.h"
+#include "inner_future_journal.h"
+#include "inner_future_lot.h"
+#include "ctp_event_log.h"
 using namespace std;
 
 namespace co {
+    typedef map<int64_t, vector<MemTradePosition>> InnerFutureHedgePositions;  // hedge_flag -> 按合约汇总的持仓
+
+    /**
+     * 内部持仓与CTP持仓的差异，数量均按合约、套保标记、单方向汇总
+     */
+struct InnerFutureDrift {
+    string code;
+    int64_t hedge_flag = 0;
+    int64_t bs_flag = 0;
+    int64_t ctp_volume = 0;  // CTP持仓数量(Position)
+    int64_t inner_volume = 0;  // 内部持仓数量，包括平仓冻结
+    int64_t ctp_pre_volume = 0;  // CTP昨仓(YdPosition)
+    int64_t inner_pre_volume = 0;  // 内部开盘前的昨仓，即昨仓 + 平仓冻结 + 已平仓
+    bool healed = false;  // 是否已用CTP持仓修正内部持仓
+};
+
     /**
      * 期货内部持仓管理
      * 工作流程：
      * 1.系统启动时，使用开盘前的昨持仓进行初始化；
      * 2.接收到委托状态更新时，更新内部持仓；
      * 3.报单时，计算自动开平仓逻辑，并返回处理后的买卖方向和开平仓标记；该步骤里面只计算，并不更新内部持仓数据。
+     * 持仓按投机、套利、套保分别管理，自动开平仓只会平同一套保标记下的持仓；委托中hedge_flag为0时按投机处理。
      *
      * “平今”和“平昨”的区别：
      * 上期所的持仓分今仓（当日开仓）和昨仓（历史持仓），平仓时需要指定是平今仓还是昨仓。
@@ -23,10 +46,24 @@ namespace co {
      * 1.国内四家交易所的平仓顺序统一规则为先开先平。
      * 2.郑商所在此基础上还有先平单腿持仓，再平组合持仓。
      * 3.除上期所外的三家交易在涉及到平今手续费减免时先平今后平昨（后开先平）。
+     *
+     * 线程模型
+     * 1.Init/Update由CTP回调线程与报单线程调用，写操作之间用write_mutex_串行化；
+     * 2.GetAutoOcFlag/GetCloseYestodayFlag/GetSnapshot只读，不加锁：持仓索引采用写时复制发布，
+     *   单个持仓通过seqlock读取一致的快照；预估平今数量时读取的逐笔明细同样不加锁，见InnerFutureLotBook::PeekCloseToday。
      */
 class InnerFutureMaster {
  public:
-    void Init(const vector<MemTradePosition>& positions);
+    typedef map<string, InnerFuturePositionPtr> PositionIndex;
+
+    InnerFutureMaster();
+
+    /**
+        * 打开持仓日志，需要在Init之前调用；日志中已有当日的快照时，Init直接从日志恢复持仓
+        */
+    bool OpenJournal(const string& dir, int64_t trading_day, int64_t snapshot_interval);
+
+    void Init(const InnerFutureHedgePositions& positions);
     void Update(const co::fbs::TradeOrderT& order);
 
     /**
@@ -38,6 +75,20 @@ class InnerFutureMaster {
 
     int64_t GetCloseYestodayFlag(const co::fbs::TradeOrderT& order);
 
+    /**
+        * 无锁读取持仓快照，供报单线程及查询、监控线程使用
+        * @return: 持仓不存在时返回false
+        */
+    bool GetSnapshot(const string& code, int64_t hedge_flag, int64_t bs_flag, InnerFuturePositionSnapshot* snapshot);
+
+    /**
+        * 与CTP查询到的持仓对账，按合约、套保标记、单方向比较，每本账各遍历一次
+        * 委托在途时会有暂时的差异，只有连续两次对账出现相同的差异，才会在heal为true时修正内部持仓
+        * @param positions: CTP持仓，按合约汇总
+        * @return: 差异列表
+        */
+    vector<InnerFutureDrift> Reconcile(const InnerFutureHedgePositions& positions, bool heal);
+
     inline void set_risk_forbid_closing_today(bool value) {
         risk_forbid_closing_today_ = value;
     }
@@ -46,21 +97,37 @@ class InnerFutureMaster {
         risk_max_today_opening_volume_ = value;
     }
 
+    inline void set_lot_book(InnerFutureLotBook* lot_book) {  // 逐笔持仓明细，用于判断不指定今昨的平仓会不会平到今仓
+        lot_book_ = lot_book;
+    }
+
  protected:
+    void DoUpdate(const co::fbs::TradeOrderT& order);
+    void Apply(const InnerFuturePositionDelta& delta);
+    bool Recover();
+    void WriteSnapshot();
     string GetKey(string code, int64_t hedge_flag, int64_t bs_flag);
+    int64_t GetHedgeFlag(const co::fbs::TradeOrderT& order);
+    void WriteOcFlagEvent(const co::fbs::TradeOrderT& order, int64_t ret_oc_flag, bool close_yesterday, const InnerFuturePositionSnapshot* snap);
     InnerFuturePositionPtr GetPosition(string code, int64_t hedge_flag, int64_t bs_flag);
+    InnerFuturePositionPtr FindPosition(string code, int64_t hedge_flag, int64_t bs_flag);
+    int64_t GetCloseTodayVolume(const co::fbs::TradeOrderT& order, int64_t bs_flag, const InnerFuturePositionSnapshot& snap);
     void CheckRisk(string code, int64_t bs_flag, int64_t oc_flag, int64_t order_volume);
 
  private:
     int state_ = 0;  // 0-未初始化，1-初始化中，2-完成初始化
     vector<std::shared_ptr<co::fbs::TradeOrderT>> init_orders_;  // 等待初始化的委托列表，因为程序启动后委托会先推过来，之后才能查询持仓进行初始化
-    map<string, InnerFuturePositionPtr> positions_;  // <code>_<hedge_flag>_<bs_flag>
+    std::mutex write_mutex_;  // 串行化CTP回调线程与报单线程的写操作，读操作不加锁
+    std::shared_ptr<const PositionIndex> positions_;  // <code>_<hedge_flag>_<bs_flag>，新增持仓时复制后原子替换
     map<string, InnerFutureOrderPtr> orders_;  // order_no -> order
+    InnerFutureJournal journal_;  // 持仓变动日志及快照
+    map<string, InnerFutureDrift> last_drifts_;  // 上一次对账的差异，<code>_<hedge_flag>_<bs_flag> -> drift
+    InnerFutureLotBook* lot_book_ = nullptr;
 
     // ----------------------------------------
     bool risk_forbid_closing_today_ = false;  // 风控策略：禁止股指期货自动开平仓时平今仓
     int64_t risk_max_today_opening_volume_ = 0;  // 风控策略：限制股指期货当日最大开仓数
-    map<string, int64_t> open_cache_;  // 合约类型（IF、IH、IC） -> 已开仓数 + 开仓冻结数，用于限制当日最大开仓数
+    map<string, std::atomic<int64_t>> open_cache_;  // 合约类型（IF、IH、IC、IM） -> 已开仓数 + 开仓冻结数，用于限制当日最大开仓数，构造时预先建好
 };
 
 typedef std::shared_ptr<InnerFutureMaster> InnerFutureMasterPtr;
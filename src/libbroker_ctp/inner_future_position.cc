@@ -12,19 +12,47 @@ namespace co {
         bs_flag_(bs_flag) {
     }
 
-    string InnerFuturePosition::ToString() {
+    void InnerFuturePosition::BeginWrite() {
+        seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void InnerFuturePosition::EndWrite() {
+        seq_.store(seq_.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    InnerFuturePositionSnapshot InnerFuturePosition::Snapshot() const {
+        InnerFuturePositionSnapshot snap;
+        uint64_t seq = 0;
+        do {
+            seq = seq_.load(std::memory_order_acquire);
+            snap.yd_volume = yd_volume_.load(std::memory_order_relaxed);
+            snap.yd_closing_volume = yd_closing_volume_.load(std::memory_order_relaxed);
+            snap.yd_close_volume = yd_close_volume_.load(std::memory_order_relaxed);
+            snap.td_volume = td_volume_.load(std::memory_order_relaxed);
+            snap.td_closing_volume = td_closing_volume_.load(std::memory_order_relaxed);
+            snap.td_close_volume = td_close_volume_.load(std::memory_order_relaxed);
+            snap.td_opening_volume = td_opening_volume_.load(std::memory_order_relaxed);
+            snap.td_open_volume = td_open_volume_.load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+        } while ((seq & 1) || seq != seq_.load(std::memory_order_relaxed));
+        return snap;
+    }
+
+    string InnerFuturePosition::ToString() const {
+        InnerFuturePositionSnapshot snap = Snapshot();
         stringstream ss;
         ss << "InnerPosition{";
         ss << "code: " << code_
             << ", bs_flag: " << bs_flag_
-            << ", yd_volume: " << yd_volume_
-            << ", yd_closing_volume: " << yd_closing_volume_
-            << ", yd_close_volume: " << yd_close_volume_
-            << ", td_volume: " << td_volume_
-            << ", td_closing_volume: " << td_closing_volume_
-            << ", td_close_volume: " << td_close_volume_
-            << ", td_opening_volume: " << td_opening_volume_
-            << ", td_open_volume: " << td_open_volume_
+            << ", yd_volume: " << snap.yd_volume
+            << ", yd_closing_volume: " << snap.yd_closing_volume
+            << ", yd_close_volume: " << snap.yd_close_volume
+            << ", td_volume: " << snap.td_volume
+            << ", td_closing_volume: " << snap.td_closing_volume
+            << ", td_close_volume: " << snap.td_close_volume
+            << ", td_opening_volume: " << snap.td_opening_volume
+            << ", td_open_volume: " << snap.td_open_volume
             << "}";
         return ss.str();
     }
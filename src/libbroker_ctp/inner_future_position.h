@@ -5,12 +5,29 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <atomic>
 
 using namespace std;
 
 namespace co {
+    /**
+     * ڲֲֿգ߳ͨInnerFuturePosition::Snapshot()ȡһµyd/td
+     */
+struct InnerFuturePositionSnapshot {
+    int64_t yd_volume = 0;  // ճֲ
+    int64_t yd_closing_volume = 0;  // ճֲƽֶ
+    int64_t yd_close_volume = 0;  // ճֲƽ
+    int64_t td_volume = 0;  // ճֲ
+    int64_t td_closing_volume = 0;  // ճֲƽֶ
+    int64_t td_close_volume = 0;  // ճֲƽ
+    int64_t td_opening_volume = 0;  // ճֲֶֿ
+    int64_t td_open_volume = 0;  // ճֲѿ
+};
+
     /**
      * ڲֲ֣<code>_<hedge_flag>_<bs_flag>л, ڼԶƽֵķ//
+     * д߳(CTPص߳뱨߳, InnerFutureMasterл)BeginWrite/EndWrite֮޸ĳֲ,
+     * ߳ͨSnapshot()ȡ, Ϊǰһʱض(seqlock), ˺ѵݡ
      */
 class InnerFuturePosition {
  public:
@@ -18,78 +35,83 @@ class InnerFuturePosition {
 
     InnerFuturePosition(string code, int64_t hedge_flag, int64_t bs_flag);
 
-    string ToString();
+    string ToString() const;
+
+    void BeginWrite();
+    void EndWrite();
+    InnerFuturePositionSnapshot Snapshot() const;
 
-    inline string code() {
+    inline string code() const {
         return code_;
     }
-    inline int64_t hedge_flag() {
+    inline int64_t hedge_flag() const {
         return hedge_flag_;
     }
-    inline int64_t bs_flag() {
+    inline int64_t bs_flag() const {
         return bs_flag_;
     }
-    inline int64_t yd_volume() {
-        return yd_volume_;
+    inline int64_t yd_volume() const {
+        return yd_volume_.load(std::memory_order_relaxed);
     }
     inline void set_yd_volume(int64_t v) {
-        yd_volume_ = v;
+        yd_volume_.store(v, std::memory_order_relaxed);
     }
-    inline int64_t yd_closing_volume() {
-        return yd_closing_volume_;
+    inline int64_t yd_closing_volume() const {
+        return yd_closing_volume_.load(std::memory_order_relaxed);
     }
     inline void set_yd_closing_volume(int64_t v) {
-        yd_closing_volume_ = v;
+        yd_closing_volume_.store(v, std::memory_order_relaxed);
     }
-    inline int64_t yd_close_volume() {
-        return yd_close_volume_;
+    inline int64_t yd_close_volume() const {
+        return yd_close_volume_.load(std::memory_order_relaxed);
     }
     inline void set_yd_close_volume(int64_t v) {
-        yd_close_volume_ = v;
+        yd_close_volume_.store(v, std::memory_order_relaxed);
     }
-    inline int64_t td_volume() {
-        return td_volume_;
+    inline int64_t td_volume() const {
+        return td_volume_.load(std::memory_order_relaxed);
     }
     inline void set_td_volume(int64_t v) {
-        td_volume_ = v;
+        td_volume_.store(v, std::memory_order_relaxed);
     }
-    inline int64_t td_closing_volume() {
-        return td_closing_volume_;
+    inline int64_t td_closing_volume() const {
+        return td_closing_volume_.load(std::memory_order_relaxed);
     }
     inline void set_td_closing_volume(int64_t v) {
-        td_closing_volume_ = v;
+        td_closing_volume_.store(v, std::memory_order_relaxed);
     }
-    inline int64_t td_close_volume() {
-        return td_close_volume_;
+    inline int64_t td_close_volume() const {
+        return td_close_volume_.load(std::memory_order_relaxed);
     }
     inline void set_td_close_volume(int64_t v) {
-        td_close_volume_ = v;
+        td_close_volume_.store(v, std::memory_order_relaxed);
     }
-    inline int64_t td_opening_volume() {
-        return td_opening_volume_;
+    inline int64_t td_opening_volume() const {
+        return td_opening_volume_.load(std::memory_order_relaxed);
     }
     inline void set_td_opening_volume(int64_t v) {
-        td_opening_volume_ = v;
+        td_opening_volume_.store(v, std::memory_order_relaxed);
     }
-    inline int64_t td_open_volume() {
-        return td_open_volume_;
+    inline int64_t td_open_volume() const {
+        return td_open_volume_.load(std::memory_order_relaxed);
     }
     inline void set_td_open_volume(int64_t v) {
-        td_open_volume_ = v;
+        td_open_volume_.store(v, std::memory_order_relaxed);
     }
 
  private:
     string code_;
     int64_t hedge_flag_ = 0;  // ױǣ1-Ͷ2-3-ױ
     int64_t bs_flag_ = 0;  // ǣ1-룬2-
-    int64_t yd_volume_ = 0;  // ճֲ
-    int64_t yd_closing_volume_ = 0;  // ճֲƽֶ
-    int64_t yd_close_volume_ = 0;  // ճֲƽ
-    int64_t td_volume_ = 0;  // ճֲ
-    int64_t td_closing_volume_ = 0;  // ճֲƽֶ
-    int64_t td_close_volume_ = 0;  // ճֲƽ
-    int64_t td_opening_volume_ = 0;  // ճֲֶֿ
-    int64_t td_open_volume_ = 0;  // ճֲѿ
+    std::atomic<uint64_t> seq_ {0};  // seqlock, ʾд
+    std::atomic<int64_t> yd_volume_ {0};  // ճֲ
+    std::atomic<int64_t> yd_closing_volume_ {0};  // ճֲƽֶ
+    std::atomic<int64_t> yd_close_volume_ {0};  // ճֲƽ
+    std::atomic<int64_t> td_volume_ {0};  // ճֲ
+    std::atomic<int64_t> td_closing_volume_ {0};  // ճֲƽֶ
+    std::atomic<int64_t> td_close_volume_ {0};  // ճֲƽ
+    std::atomic<int64_t> td_opening_volume_ {0};  // ճֲֶֿ
+    std::atomic<int64_t> td_open_volume_ {0};  // ճֲѿ
 };
 typedef std::shared_ptr<InnerFuturePosition> InnerFuturePositionPtr;
 }  // namespace co
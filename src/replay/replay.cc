@@ -0,0 +1,67 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+// 离线回放录制的CTP回调，统计各回调的处理耗时，不连接CTP前置，不推送回报
+// 多个资金账号的录制文件按配置中的账号分别回放，配置中没有的账号跳过
+// ./replay --file ../data/record/ctp_record_20240612090000000.dat [--max_speed]
+#include <iostream>
+#include <boost/program_options.hpp>
+#include "../libbroker_ctp/libbroker_ctp.h"
+#include "../libbroker_ctp/ctp_trade_spi.h"
+
+using namespace std;
+using namespace co;
+namespace po = boost::program_options;
+
+int main(int argc, char* argv[]) {
+    po::options_description desc("[CTP Replay] Usage");
+    string file;
+    bool max_speed = false;
+    try {
+        desc.add_options()
+            ("file,f", po::value<std::string>(&file), "ctp record file")
+            ("max_speed", "replay at maximum speed instead of recorded speed")
+            ("help,h", "show help message");
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+        if (vm.count("help") || file.empty()) {
+            cout << desc << endl;
+            return 0;
+        }
+        max_speed = vm.count("max_speed") > 0;
+    } catch (...) {
+        cout << desc << endl;
+        return 0;
+    }
+    try {
+        CTPEventLog::Instance()->Start("", false);  // 回调中的事件由后台线程取出丢弃
+        CTPReplayer replayer;
+        if (!replayer.Open(file)) {
+            return 1;
+        }
+        vector<std::shared_ptr<CTPTradeSpi>> spis;
+        for (auto& investor_id : replayer.investor_ids()) {
+            const CTPAccount* account = nullptr;
+            for (auto& it : Config::Instance()->ctp_accounts()) {
+                if (it.investor_id == investor_id) {
+                    account = &it;
+                }
+            }
+            if (!account) {
+                LOG_WARN << "investor is not in configuration, skip: " << investor_id;
+                continue;
+            }
+            std::shared_ptr<CTPTradeSpi> spi = std::make_shared<CTPTradeSpi>(nullptr, *account);
+            spi->set_replay(true);
+            replayer.AddSpi(investor_id, spi.get());
+            spis.push_back(spi);
+        }
+        replayer.Run(!max_speed);
+        string result = replayer.ToString();
+        LOG_INFO << endl << result;
+        cout << result << endl;
+    } catch (std::exception& e) {
+        LOG_ERROR << "replay failed: " << e.what();
+        return 1;
+    }
+    return 0;
+}
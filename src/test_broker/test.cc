@@ -1,107 +1,170 @@
+// 压力测试：按目标速率通过MemBroker发送报单、撤单、查询，忙轮询读取回报，统计吞吐量与延迟分位数
+// --accounts指定参与测试的资金账号（默认为配置中的全部账号），请求按账号轮流发送
+// CTP前置在broker.yaml中按账号配置，可以指向仿真环境或模拟柜台；--replay指定录制文件时不连接前置，离线回放这些账号的回调
+// ./test --rate 200 --duration_s 30 --mix 80:15:1:2:2 --code rb2410.SHFE --price 3500 --volume 1 --accounts 10001,10002
+// ./test --accounts 10001 --replay ../data/record/ctp_record_20240612090000000.dat [--max_speed]
 #include "../libbroker_ctp/libbroker_ctp.h"
+#include "../libbroker_ctp/ctp_trade_spi.h"
 #include <boost/filesystem.hpp>
+#include <boost/program_options.hpp>
+#include <boost/algorithm/string.hpp>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <mutex>
 
 using namespace co;
 using namespace std;
+namespace po = boost::program_options;
 
-string fund_id;
+constexpr int kLoadOrder = 0;
+constexpr int kLoadWithdraw = 1;
+constexpr int kLoadQueryAsset = 2;
+constexpr int kLoadQueryPosition = 3;
+constexpr int kLoadQueryKnock = 4;
+constexpr int kLoadTypes = 5;
+const char* kLoadNames[kLoadTypes] = {"order", "withdraw", "query_asset", "query_position", "query_knock"};
+
+vector<string> fund_ids;  // 参与测试的资金账号
 string mem_dir;
 string mem_req_file;
 string mem_rep_file;
 
-void order_1(std::shared_ptr<co::MemBroker> broker) {
-    int total_order_num = 1;
-    string id = x::UUID();
-    int length = sizeof(MemTradeOrderMessage) + sizeof(MemTradeOrder) * total_order_num;
-    char buffer[length] = "";
-    MemTradeOrderMessage* msg = (MemTradeOrderMessage*) buffer;
-    strncpy(msg->id, id.c_str(), id.length());
-    strcpy(msg->fund_id, fund_id.c_str());
-    msg->bs_flag = kBsFlagBuy;
-    msg->items_size = total_order_num;
-    MemTradeOrder* item = (MemTradeOrder*)((char*)buffer + sizeof(MemTradeOrderMessage));
-    for (int i = 0; i < total_order_num; i++) {
-        MemTradeOrder* order = item + i;
-        order->volume = 1;
-        order->price = 3500.40;
-        // order->oc_flag = co::kOcFlagOpen;
-        order->price_type = kQOrderTypeLimit;
-        strcpy(order->code, "IF2406.CFFEX");
-        order->market = kMarketCFFEX;
-        LOG_INFO << "send order, code: " << order->code << ", volume: " << order->volume << ", price: " << order->price;
+string code;
+int64_t market = 0;
+double price = 0;
+int64_t volume = 1;
+
+struct Pending {
+    int type = 0;
+    int64_t time = 0;  // 发送时间
+    string fund_id;
+};
+
+std::mutex mutex_;
+std::unordered_map<string, Pending> pending_;  // 消息ID -> 请求
+std::deque<std::pair<string, string>> order_nos_;  // 已报成功、可以撤单的(资金账号, 委托合同号)
+std::map<string, std::pair<int64_t, int64_t>> fund_stats_;  // 资金账号 -> (发送数, 回报数)
+vector<int64_t> latencies_[kLoadTypes];  // 每种请求的回报延迟，纳秒
+int64_t sent_[kLoadTypes] = {0};
+int64_t errors_[kLoadTypes] = {0};
+int64_t knocks_ = 0;
+std::atomic_bool stop_ {false};
+
+int64_t NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// 每种请求分别按账号轮流，避免请求类型与账号固定对应；只由发送线程调用
+const string& FundId(int type) {
+    static int64_t counts[kLoadTypes] = {0};
+    return fund_ids[counts[type]++ % fund_ids.size()];
+}
+
+void AddPending(const string& id, int type, const string& fund_id) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    Pending& p = pending_[id];
+    p.type = type;
+    p.time = NowNs();
+    p.fund_id = fund_id;
+    ++sent_[type];
+    ++fund_stats_[fund_id].first;
+}
+
+// 收到回报时计算延迟，分批推送的查询结果只统计第一批
+void OnReply(const char* id, const char* error) {
+    int64_t now = NowNs();
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto it = pending_.find(id);
+    if (it == pending_.end()) {
+        return;
     }
-    msg->timestamp = x::RawDateTime();
-    broker->SendTradeOrder(msg);
+    int type = it->second.type;
+    latencies_[type].push_back(now - it->second.time);
+    if (error && strlen(error) > 0) {
+        ++errors_[type];
+    }
+    ++fund_stats_[it->second.fund_id].second;
+    pending_.erase(it);
 }
 
-void order_2(std::shared_ptr<co::MemBroker> broker) {
-    int total_order_num = 1;
+void SendOrder(std::shared_ptr<co::MemBroker> broker, int64_t seq) {
     string id = x::UUID();
-    int length = sizeof(MemTradeOrderMessage) + sizeof(MemTradeOrder) * total_order_num;
-    char buffer[length] = "";
+    char buffer[sizeof(MemTradeOrderMessage) + sizeof(MemTradeOrder)] = "";
     MemTradeOrderMessage* msg = (MemTradeOrderMessage*) buffer;
     strncpy(msg->id, id.c_str(), id.length());
+    const string& fund_id = FundId(kLoadOrder);
     strcpy(msg->fund_id, fund_id.c_str());
-    msg->bs_flag = kBsFlagSell;
-    msg->items_size = total_order_num;
-    MemTradeOrder* item = (MemTradeOrder*)((char*)buffer + sizeof(MemTradeOrderMessage));
-    for (int i = 0; i < total_order_num; i++) {
-        MemTradeOrder* order = item + i;
-        order->volume = 2;
-        order->price = 3590.40;
-        // order->oc_flag = co::kOcFlagOpen;
-        order->price_type = kQOrderTypeLimit;
-        strcpy(order->code, "IF2406.CFFEX");
-        order->market = kMarketCFFEX;
-        LOG_INFO << "send order, code: " << order->code << ", volume: " << order->volume << ", price: " << order->price;
-    }
+    msg->bs_flag = (seq & 1) ? kBsFlagSell : kBsFlagBuy;
+    msg->items_size = 1;
+    MemTradeOrder* order = (MemTradeOrder*)((char*)buffer + sizeof(MemTradeOrderMessage));
+    order->volume = volume;
+    order->price = price;
+    order->price_type = kQOrderTypeLimit;
+    strcpy(order->code, code.c_str());
+    order->market = market;
+    AddPending(id, kLoadOrder, fund_id);
     msg->timestamp = x::RawDateTime();
     broker->SendTradeOrder(msg);
 }
 
-void withdraw(shared_ptr<MemBroker> broker) {
+// 没有可撤的委托时改为报单，撤单使用委托所属的资金账号
+void SendWithdraw(std::shared_ptr<MemBroker> broker, int64_t seq) {
+    string fund_id;
+    string order_no;
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!order_nos_.empty()) {
+            fund_id = order_nos_.front().first;
+            order_no = order_nos_.front().second;
+            order_nos_.pop_front();
+        }
+    }
+    if (order_no.empty()) {
+        SendOrder(broker, seq);
+        return;
+    }
     string id = x::UUID();
     MemTradeWithdrawMessage msg;
     memset(&msg, 0, sizeof(msg));
     strncpy(msg.id, id.c_str(), id.length());
     strcpy(msg.fund_id, fund_id.c_str());
-    cout << "please input order_no" << endl;
-    cin >> msg.order_no;
-    LOG_INFO << "send withdraw, fund_id: " << msg.fund_id << ", order_no: " << msg.order_no;
+    strncpy(msg.order_no, order_no.c_str(), sizeof(msg.order_no) - 1);
+    AddPending(id, kLoadWithdraw, fund_id);
     msg.timestamp = x::RawDateTime();
     broker->SendTradeWithdraw(&msg);
 }
 
-void query_asset(shared_ptr<MemBroker> broker) {
+template<typename T>
+void InitQuery(T* msg, int type) {
     string id = x::UUID();
+    memset(msg, 0, sizeof(T));
+    strncpy(msg->id, id.c_str(), id.length());
+    const string& fund_id = FundId(type);
+    strcpy(msg->fund_id, fund_id.c_str());
+    AddPending(id, type, fund_id);
+    msg->timestamp = x::RawDateTime();
+}
+
+void QueryAsset(shared_ptr<MemBroker> broker) {
     MemGetTradeAssetMessage msg;
-    memset(&msg, 0, sizeof(msg));
-    strncpy(msg.id, id.c_str(), id.length());
-    strcpy(msg.fund_id, fund_id.c_str());
-    msg.timestamp = x::RawDateTime();
+    InitQuery(&msg, kLoadQueryAsset);
     broker->SendQueryTradeAsset(&msg);
 }
 
-void query_position(shared_ptr<MemBroker> broker) {
-    string id = x::UUID();
+void QueryPosition(shared_ptr<MemBroker> broker) {
     MemGetTradePositionMessage msg;
-    memset(&msg, 0, sizeof(msg));
-    strncpy(msg.id, id.c_str(), id.length());
-    strcpy(msg.fund_id, fund_id.c_str());
-    msg.timestamp = x::RawDateTime();
+    InitQuery(&msg, kLoadQueryPosition);
     broker->SendQueryTradePosition(&msg);
 }
 
-void query_knock(shared_ptr<MemBroker> broker) {
-    string id = x::UUID();
+void QueryKnock(shared_ptr<MemBroker> broker) {
     MemGetTradeKnockMessage msg;
-    memset(&msg, 0, sizeof(msg));
-    strncpy(msg.id, id.c_str(), id.length());
-    strcpy(msg.fund_id, fund_id.c_str());
-    msg.timestamp = x::RawDateTime();
+    InitQuery(&msg, kLoadQueryKnock);
     broker->SendQueryTradeKnock(&msg);
 }
 
+// 忙轮询回报文件，不休眠
 void ReadRep() {
     {
         bool exit_flag = false;
@@ -123,110 +186,224 @@ void ReadRep() {
     const void* data = nullptr;
     x::MMapReader common_reader;
     common_reader.Open(mem_dir, mem_rep_file, true);
-    while (true) {
-        x::Sleep(1000);
+    while (!stop_.load(std::memory_order_relaxed)) {
         int32_t type = common_reader.Next(&data);
         if (type == kMemTypeTradeOrderRep) {
             MemTradeOrderMessage* rep = (MemTradeOrderMessage*)data;
-            LOG_INFO << "收到报单响应, " << ToString(rep);
+            MemTradeOrder* items = (MemTradeOrder*)((char*)rep + sizeof(MemTradeOrderMessage));
+            if (strlen(rep->error) == 0 && rep->items_size > 0 && strlen(items[0].order_no) > 0) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                order_nos_.emplace_back(rep->fund_id, items[0].order_no);
+            }
+            OnReply(rep->id, rep->error);
         } else if (type == kMemTypeTradeWithdrawRep) {
             MemTradeWithdrawMessage* rep = (MemTradeWithdrawMessage*) data;
-            LOG_INFO << "收到撤单响应, " << ToString(rep);
+            OnReply(rep->id, rep->error);
+        } else if (type == kMemTypeQueryTradeAssetRep) {
+            MemGetTradeAssetMessage* rep = (MemGetTradeAssetMessage*) data;
+            OnReply(rep->id, rep->error);
+        } else if (type == kMemTypeQueryTradePositionRep) {
+            MemGetTradePositionMessage* rep = (MemGetTradePositionMessage*) data;
+            OnReply(rep->id, rep->error);
+        } else if (type == kMemTypeQueryTradeKnockRep) {
+            MemGetTradeKnockMessage* rep = (MemGetTradeKnockMessage*) data;
+            OnReply(rep->id, rep->error);
         } else if (type == kMemTypeTradeKnock) {
-            MemTradeKnock* msg = (MemTradeKnock*) data;
-            LOG_INFO << "收到成交推送, " << ToString(msg);
-        } else if (type == kMemTypeTradeAsset) {
-            MemTradeAsset *asset = (MemTradeAsset*) data;
-            LOG_INFO << "资金变更, fund_id: " << asset->fund_id
-                     << ", timestamp: " << asset->timestamp
-                     << ", balance: " << asset->balance
-                     << ", usable: " << asset->usable
-                     << ", margin: " << asset->margin
-                     << ", equity: " << asset->equity
-                     << ", long_margin_usable: " << asset->long_margin_usable
-                     << ", short_margin_usable: " << asset->short_margin_usable
-                     << ", short_return_usable: " << asset->short_return_usable;
-
-        } else if (type == kMemTypeTradePosition) {
-            MemTradePosition* position = (MemTradePosition*) data;
-            LOG_INFO << "持仓变更, code: " << position->code
-                     << ", fund_id: " << position->fund_id
-                     << ", timestamp: " << position->timestamp
-                     << ", long_volume: " << position->long_volume
-                     << ", long_market_value: " << position->long_market_value
-                     << ", long_can_close: " << position->long_can_close
-                     << ", short_volume: " << position->short_volume
-                     << ", short_market_value: " << position->short_market_value
-                     << ", short_can_open: " << position->short_can_open;
+            std::unique_lock<std::mutex> lock(mutex_);
+            ++knocks_;
         } else if (type == kMemTypeMonitorRisk) {
             MemMonitorRiskMessage* msg = (MemMonitorRiskMessage*) data;
             LOG_ERROR << "Risk, " << msg->error << ", timestamp: " << msg->timestamp;
-        } else if (type == kMemTypeHeartBeat) {
-            HeartBeatMessage* msg = (HeartBeatMessage*) data;
-            LOG_ERROR << "心跳, " << msg->fund_id << ", timestamp: " << msg->timestamp;
         }
     }
 }
 
+int64_t Percentile(const vector<int64_t>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t index = (size_t)(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+string Report(double elapsed_s) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    stringstream ss;
+    ss << "+-------------------- load test report --------------------+" << endl;
+    ss << "elapsed: " << elapsed_s << "s, knocks: " << knocks_ << ", no reply: " << pending_.size() << endl;
+    for (int i = 0; i < kLoadTypes; ++i) {
+        vector<int64_t>& v = latencies_[i];
+        if (sent_[i] == 0) {
+            continue;
+        }
+        std::sort(v.begin(), v.end());
+        ss << kLoadNames[i] << ": sent = " << sent_[i]
+            << ", replied = " << v.size()
+            << ", errors = " << errors_[i]
+            << ", throughput = " << (elapsed_s > 0 ? v.size() / elapsed_s : 0) << "/s"
+            << ", latency_us p50 = " << Percentile(v, 0.5) / 1000
+            << ", p90 = " << Percentile(v, 0.9) / 1000
+            << ", p99 = " << Percentile(v, 0.99) / 1000
+            << ", p999 = " << Percentile(v, 0.999) / 1000
+            << ", max = " << (v.empty() ? 0 : v.back() / 1000) << endl;
+    }
+    for (auto& it : fund_stats_) {
+        ss << "fund " << it.first << ": sent = " << it.second.first << ", replied = " << it.second.second << endl;
+    }
+    ss << "+-----------------------------------------------------------+";
+    return ss.str();
+}
+
+// 离线回放：不连接CTP前置，按录制文件回放指定账号的回调，统计各回调的处理耗时
+int Replay(const string& file, bool max_speed) {
+    CTPEventLog::Instance()->Start("", false);  // 回调中的事件由后台线程取出丢弃
+    CTPReplayer replayer;
+    if (!replayer.Open(file)) {
+        return 1;
+    }
+    vector<std::shared_ptr<CTPTradeSpi>> spis;
+    for (auto& account : Config::Instance()->ctp_accounts()) {
+        if (std::find(fund_ids.begin(), fund_ids.end(), account.investor_id) == fund_ids.end()) {
+            continue;
+        }
+        std::shared_ptr<CTPTradeSpi> spi = std::make_shared<CTPTradeSpi>(nullptr, account);
+        spi->set_replay(true);
+        replayer.AddSpi(account.investor_id, spi.get());
+        spis.push_back(spi);
+    }
+    replayer.Run(!max_speed);
+    string result = replayer.ToString();
+    LOG_INFO << endl << result;
+    cout << result << endl;
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    po::options_description desc("[Broker Load Test] Usage");
+    int64_t rate = 100;
+    int64_t duration_s = 10;
+    int64_t wait_ms = 3000;
+    string mix = "80:15:1:2:2";
+    string accounts;
+    string replay_file;
+    bool max_speed = false;
+    try {
+        desc.add_options()
+            ("rate", po::value<int64_t>(&rate)->default_value(100), "requests per second")
+            ("duration_s", po::value<int64_t>(&duration_s)->default_value(10), "seconds to send requests")
+            ("wait_ms", po::value<int64_t>(&wait_ms)->default_value(3000), "milliseconds to wait for replies after sending")
+            ("mix", po::value<string>(&mix)->default_value("80:15:1:2:2"), "weights of order:withdraw:query_asset:query_position:query_knock")
+            ("code", po::value<string>(&code)->default_value("IF2406.CFFEX"), "order code")
+            ("price", po::value<double>(&price)->default_value(3500.4), "order price")
+            ("volume", po::value<int64_t>(&volume)->default_value(1), "order volume")
+            ("accounts", po::value<string>(&accounts), "comma separated investor ids, default all configured accounts")
+            ("replay", po::value<string>(&replay_file), "replay ctp record file of the accounts instead of connecting to CTP fronts")
+            ("max_speed", "replay at maximum speed instead of recorded speed")
+            ("help,h", "show help message");
+        po::variables_map vm;
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+        if (vm.count("help")) {
+            cout << desc << endl;
+            return 0;
+        }
+        max_speed = vm.count("max_speed") > 0;
+    } catch (...) {
+        cout << desc << endl;
+        return 0;
+    }
+    for (auto& account : Config::Instance()->ctp_accounts()) {
+        if (accounts.empty()) {
+            fund_ids.push_back(account.investor_id);
+        }
+    }
+    if (!accounts.empty()) {
+        boost::split(fund_ids, accounts, boost::is_any_of(","), boost::token_compress_on);
+        for (auto& id : fund_ids) {
+            bool found = false;
+            for (auto& account : Config::Instance()->ctp_accounts()) {
+                found = found || account.investor_id == id;
+            }
+            if (!found) {
+                cout << "investor is not in configuration: " << id << endl;
+                return 1;
+            }
+        }
+    }
+    if (!replay_file.empty()) {
+        return Replay(replay_file, max_speed);
+    }
+    vector<string> items;
+    boost::split(items, mix, boost::is_any_of(":"));
+    int64_t weights[kLoadTypes] = {0};
+    int64_t total_weight = 0;
+    for (int i = 0; i < kLoadTypes && i < (int)items.size(); ++i) {
+        weights[i] = atoll(items[i].c_str());
+        total_weight += weights[i];
+    }
+    for (auto m : {kMarketCFFEX, kMarketSHFE, kMarketDCE, kMarketCZCE, kMarketINE, kMarketGFE}) {
+        string suffix = MarketToSuffix(m).data();
+        if (boost::algorithm::ends_with(code, suffix)) {
+            market = m;
+        }
+    }
+    if (rate <= 0 || total_weight <= 0 || market == 0) {
+        cout << "illegal rate, mix or code" << endl << desc << endl;
+        return 1;
+    }
 
-int main() {
     MemBrokerOptionsPtr options = Config::Instance()->options();
     shared_ptr<CTPBroker> broker = make_shared<CTPBroker>();
     co::MemBrokerServer server;
     server.Init(options, broker);
     server.Start();
 
-    fund_id = Config::Instance()->ctp_investor_id();
     mem_dir = options->mem_dir();
     mem_req_file = options->mem_req_file();
     mem_rep_file = options->mem_rep_file();
-    std::thread t1(ReadRep);
-
-    string usage("\nTYPE  'q' to quit program\n");
-    usage += "      '1' to order_shfe\n";
-    usage += "      '2' to order_sz\n";
-    usage += "      '3' to withdraw_shfe\n";
-    usage += "      '4' to withdraw_sz\n";
-    usage += "      '5' to query asset\n";
-    usage += "      '6' to query position\n";
-    usage += "      '7' to query order\n";
-    usage += "      '8' to query knock\n";
-    cerr << (usage);
-
-    char c;
-    while ((c = getchar()) != 'q') {
-        switch (c) {
-            case '1': {
-                order_1(broker);
-                break;
-            }
-            case '2': {
-                order_2(broker);
-                break;
-            }
-            case '3': {
-                withdraw(broker);
+    std::thread reader(ReadRep);
+
+    LOG_INFO << "start load test: rate = " << rate << "/s, duration = " << duration_s << "s, mix = " << mix << ", code = " << code
+        << ", accounts = " << boost::algorithm::join(fund_ids, ",");
+    int64_t interval_ns = 1000000000LL / rate;
+    int64_t total = rate * duration_s;
+    int64_t start = NowNs();
+    for (int64_t seq = 0; seq < total; ++seq) {
+        int64_t next = start + seq * interval_ns;
+        while (NowNs() < next) {  // 忙等待到下一个发送时间点，保证速率均匀
+        }
+        int64_t r = seq % total_weight;  // 按权重轮流发送，结果可重复
+        int type = 0;
+        while (r >= weights[type]) {
+            r -= weights[type];
+            ++type;
+        }
+        switch (type) {
+            case kLoadOrder:
+                SendOrder(broker, seq);
                 break;
-            }
-            case '4': {
+            case kLoadWithdraw:
+                SendWithdraw(broker, seq);
                 break;
-            }
-            case '5': {
-                query_asset(broker);
+            case kLoadQueryAsset:
+                QueryAsset(broker);
                 break;
-            }
-            case '6': {
-                query_position(broker);
+            case kLoadQueryPosition:
+                QueryPosition(broker);
                 break;
-            }
-            case '8': {
-                query_knock(broker);
+            case kLoadQueryKnock:
+                QueryKnock(broker);
                 break;
-            }
             default:
                 break;
         }
     }
-    std::cout << "Finished!" << endl;
+    double elapsed_s = (NowNs() - start) / 1e9;
+    x::Sleep(wait_ms);
+    stop_.store(true);
+    reader.join();
+    string report = Report(elapsed_s);
+    LOG_INFO << endl << report;
+    cout << report << endl;
     return 0;
 }
@@ -0,0 +1,219 @@
+// Copyright 2021 Fancapital Inc.  All rights reserved.
+// 单元测试：逐笔持仓明细的平仓顺序（先开先平、郑商所先平单腿、先平今仓）与PeekCloseToday预估
+// ./test_lot，全部通过时返回0
+#include <cmath>
+#include <iostream>
+#include "../libbroker_ctp/inner_future_lot.h"
+
+using namespace co;
+using namespace std;
+
+static int failures = 0;
+
+#define CHECK_EQ(a, b) do { \
+    auto _a = (a); auto _b = (b); \
+    if (!(_a == _b)) { \
+        ++failures; \
+        std::cerr << __FILE__ << ":" << __LINE__ << ": " << #a << " = " << _a << ", expected " << _b << std::endl; \
+    } \
+} while (0)
+
+#define CHECK_NEAR(a, b) do { \
+    double _a = (a); double _b = (b); \
+    if (std::fabs(_a - _b) > 1e-6) { \
+        ++failures; \
+        std::cerr << __FILE__ << ":" << __LINE__ << ": " << #a << " = " << _a << ", expected " << _b << std::endl; \
+    } \
+} while (0)
+
+static const int64_t kTradingDay = 20240612;
+
+static InnerFutureLot YdLot(int64_t volume, double price, bool comb = false) {
+    InnerFutureLot lot;
+    lot.open_date = 20240611;
+    lot.open_price = price;
+    lot.volume = volume;
+    lot.today = false;
+    lot.comb = comb;
+    return lot;
+}
+
+static co::fbs::TradeOrderT Knock(const string& code, int64_t market, int64_t bs_flag, int64_t oc_flag, int64_t volume, double price) {
+    co::fbs::TradeOrderT knock;
+    knock.code = code;
+    knock.market = market;
+    knock.hedge_flag = kHedgeFlagSpeculate;
+    knock.bs_flag = bs_flag;
+    knock.oc_flag = oc_flag;
+    knock.volume = volume;
+    knock.price = price;
+    return knock;
+}
+
+static int64_t PeekToday(const InnerFutureLotBook& book, const string& code, int64_t volume) {
+    int64_t today_volume = -1;
+    if (!book.PeekCloseToday(code, kHedgeFlagSpeculate, kBsFlagBuy, volume, &today_volume)) {
+        return -1;
+    }
+    return today_volume;
+}
+
+// 大商所先开先平：先平昨仓，再平今仓
+static void TestFifo() {
+    string code = "m2409.DCE";
+    InnerFutureLotBook book;
+    book.Init(kTradingDay, {});
+    book.Seed(code, kMarketDCE, 10, kHedgeFlagSpeculate, kBsFlagBuy, YdLot(2, 3000));
+    book.Start();
+    book.Update(Knock(code, kMarketDCE, kBsFlagBuy, kOcFlagOpen, 3, 3100), 10);
+    CHECK_EQ(PeekToday(book, code, 1), 0);
+    CHECK_EQ(PeekToday(book, code, 3), 1);
+    CHECK_EQ(PeekToday(book, code, 9), 3);
+    book.Update(Knock(code, kMarketDCE, kBsFlagSell, kOcFlagClose, 3, 3200), 10);
+    InnerFutureLotSummary summary;
+    CHECK_EQ(book.GetSummary(code, kHedgeFlagSpeculate, kBsFlagBuy, &summary), true);
+    CHECK_EQ(summary.yd_volume, 0);
+    CHECK_EQ(summary.td_volume, 2);
+    CHECK_NEAR(summary.close_profit, (200 * 2 + 100 * 1) * 10);
+    CHECK_EQ(PeekToday(book, code, 1), 1);
+}
+
+// 查询结果中今仓排在昨仓之前时，Start后仍按昨仓在前处理
+static void TestSeedOrder() {
+    string code = "c2409.DCE";
+    InnerFutureLotBook book;
+    book.Init(kTradingDay, {});
+    InnerFutureLot today = YdLot(1, 2500);
+    today.open_date = kTradingDay;
+    today.today = true;
+    book.Seed(code, kMarketDCE, 10, kHedgeFlagSpeculate, kBsFlagBuy, today);
+    book.Seed(code, kMarketDCE, 10, kHedgeFlagSpeculate, kBsFlagBuy, YdLot(1, 2400));
+    book.Start();
+    CHECK_EQ(PeekToday(book, code, 1), 0);
+    book.Update(Knock(code, kMarketDCE, kBsFlagSell, kOcFlagClose, 1, 2450), 10);
+    InnerFutureLotSummary summary;
+    book.GetSummary(code, kHedgeFlagSpeculate, kBsFlagBuy, &summary);
+    CHECK_EQ(summary.yd_volume, 0);
+    CHECK_EQ(summary.td_volume, 1);
+    CHECK_NEAR(summary.close_profit, 50 * 10);
+}
+
+// 郑商所先平单腿持仓（昨仓在前），再平组合持仓
+static void TestCzceSingleFirst() {
+    string code = "SR409.CZCE";
+    InnerFutureLotBook book;
+    book.Init(kTradingDay, {});
+    book.Seed(code, kMarketCZCE, 10, kHedgeFlagSpeculate, kBsFlagBuy, YdLot(2, 6000, true));
+    book.Seed(code, kMarketCZCE, 10, kHedgeFlagSpeculate, kBsFlagBuy, YdLot(1, 6100));
+    book.Start();
+    book.Update(Knock(code, kMarketCZCE, kBsFlagBuy, kOcFlagOpen, 2, 6200), 10);
+    CHECK_EQ(PeekToday(book, code, 1), 0);
+    CHECK_EQ(PeekToday(book, code, 3), 2);
+    CHECK_EQ(PeekToday(book, code, 5), 2);
+    book.Update(Knock(code, kMarketCZCE, kBsFlagSell, kOcFlagClose, 4, 6300), 10);
+    InnerFutureLotSummary summary;
+    book.GetSummary(code, kHedgeFlagSpeculate, kBsFlagBuy, &summary);
+    CHECK_EQ(summary.yd_volume, 1);
+    CHECK_EQ(summary.td_volume, 0);
+    CHECK_EQ(summary.comb_volume, 1);
+    CHECK_NEAR(summary.close_profit, (200 * 1 + 100 * 2 + 300 * 1) * 10);
+}
+
+// 中金所及配置的品种先平今仓，再平昨仓；上期所不指定今昨时等同平昨
+static void TestTodayFirst() {
+    string code = "IF2406.CFFEX";
+    InnerFutureLotBook book;
+    book.Init(kTradingDay, {"jd"});
+    book.Seed(code, kMarketCFFEX, 300, kHedgeFlagSpeculate, kBsFlagBuy, YdLot(2, 3500));
+    book.Seed("jd2409.DCE", kMarketDCE, 10, kHedgeFlagSpeculate, kBsFlagBuy, YdLot(1, 4000));
+    book.Seed("rb2410.SHFE", kMarketSHFE, 10, kHedgeFlagSpeculate, kBsFlagBuy, YdLot(1, 3600));
+    book.Start();
+    book.Update(Knock(code, kMarketCFFEX, kBsFlagBuy, kOcFlagOpen, 2, 3510), 300);
+    book.Update(Knock("jd2409.DCE", kMarketDCE, kBsFlagBuy, kOcFlagOpen, 1, 4100), 10);
+    book.Update(Knock("rb2410.SHFE", kMarketSHFE, kBsFlagBuy, kOcFlagOpen, 1, 3700), 10);
+    CHECK_EQ(PeekToday(book, code, 1), 1);
+    CHECK_EQ(PeekToday(book, code, 3), 2);
+    CHECK_EQ(PeekToday(book, "jd2409.DCE", 1), 1);
+    CHECK_EQ(PeekToday(book, "rb2410.SHFE", 2), 0);
+    book.Update(Knock(code, kMarketCFFEX, kBsFlagSell, kOcFlagClose, 3, 3520), 300);
+    InnerFutureLotSummary summary;
+    book.GetSummary(code, kHedgeFlagSpeculate, kBsFlagBuy, &summary);
+    CHECK_EQ(summary.yd_volume, 1);
+    CHECK_EQ(summary.td_volume, 0);
+    CHECK_NEAR(summary.close_profit, (10 * 2 + 20 * 1) * 300);
+    CHECK_EQ(PeekToday(book, code, 1), 0);
+}
+
+// 盯市持仓盈亏：昨仓相对昨结算价，今仓相对开仓价；有合约取不到价格时计入missing
+static void TestPositionProfit() {
+    InnerFutureLotBook book;
+    book.Init(kTradingDay, {});
+    book.Seed("m2409.DCE", kMarketDCE, 10, kHedgeFlagSpeculate, kBsFlagBuy, YdLot(2, 3000));
+    book.Seed("y2409.DCE", kMarketDCE, 10, kHedgeFlagSpeculate, kBsFlagSell, YdLot(1, 8000));
+    book.Start();
+    book.Update(Knock("m2409.DCE", kMarketDCE, kBsFlagBuy, kOcFlagOpen, 3, 3100), 10);
+    int64_t missing = 0;
+    double profit = book.GetPositionProfit([](const string& code, double* last_price, double* pre_settlement_price) {
+        if (code == "m2409.DCE") {
+            *last_price = 3200;
+            *pre_settlement_price = 3050;
+            return true;
+        }
+        *last_price = 7900;
+        *pre_settlement_price = 7950;
+        return true;
+    }, &missing);
+    CHECK_EQ(missing, 0);
+    CHECK_NEAR(profit, (150 * 2 + 100 * 3) * 10 + 50 * 10);
+    book.GetPositionProfit([](const string& code, double*, double*) { return code == "m2409.DCE"; }, &missing);
+    CHECK_EQ(missing, 2);  // 没有昨结算价也计入missing
+}
+
+// 先开先平的明细从队首出队，中间的空洞在压缩后保持开仓顺序
+static void TestRing() {
+    InnerFutureLotRing ring(2);
+    for (int i = 1; i <= 5; ++i) {
+        InnerFutureLot lot;
+        lot.volume = i;
+        ring.push_back(lot);
+    }
+    CHECK_EQ(ring.size(), 5u);
+    ring.at(0).volume = 0;
+    ring.Release(1);
+    CHECK_EQ(ring.size(), 4u);
+    CHECK_EQ(ring.at(0).volume, 2);
+    ring.at(1).volume = 0;
+    ring.Release(1);
+    CHECK_EQ(ring.size(), 4u);  // 空洞不超过一半时不压缩
+    ring.at(0).volume = 0;
+    ring.Release(1);  // 队首及其后的空洞一起出队
+    CHECK_EQ(ring.size(), 2u);
+    CHECK_EQ(ring.at(0).volume, 4);
+    for (int i = 6; i <= 8; ++i) {
+        InnerFutureLot lot;
+        lot.volume = i;
+        ring.push_back(lot);
+    }
+    ring.at(1).volume = 0;
+    ring.at(2).volume = 0;
+    ring.at(3).volume = 0;
+    ring.Release(3);  // 空洞超过一半，压缩
+    CHECK_EQ(ring.size(), 2u);
+    CHECK_EQ(ring.at(0).volume, 4);
+    CHECK_EQ(ring.at(1).volume, 8);
+}
+
+int main(int argc, char* argv[]) {
+    TestFifo();
+    TestSeedOrder();
+    TestCzceSingleFirst();
+    TestTodayFirst();
+    TestPositionProfit();
+    TestRing();
+    if (failures > 0) {
+        std::cerr << "test_lot failed: " << failures << std::endl;
+        return 1;
+    }
+    std::cout << "test_lot ok" << std::endl;
+    return 0;
+}